@@ -0,0 +1,438 @@
+/**
+ * @file
+ * @author  Juan I Carrano <juan@carrano.com.ar.
+ *
+ * Measure parser throughput on synthetic command lines of different shapes,
+ * with getopt_long() as the baseline.
+ *
+ * For each shape this reports the time per token of optparse_cmd(),
+ * optparse_cmd_compiled() and an equivalent getopt_long() loop, and the number
+ * of allocations and peak memory of one optparse_cmd() call.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "optparse.h"
+
+#define MAX_RULES 256
+#define MAX_ARGS 64
+#define TOKEN_SIZE 24
+
+/* Parse about this many tokens per measurement. */
+#define TOTAL_TOKENS 2000000L
+
+/* Values of getopt_long() for options without a short id. */
+#define LONG_ONLY 256
+
+static struct opt_rule rules[MAX_RULES];
+static int n_rules;
+static char names[MAX_RULES][8];
+
+static struct option longopts[MAX_RULES + 1];
+static int n_longopts;
+static char optstring[3 * MAX_RULES + 1];
+static int short_rule[LONG_ONLY];
+
+static char tokens[MAX_ARGS][TOKEN_SIZE];
+static char *argv[MAX_ARGS + 1];
+static int argc;
+
+/* Keep the compiler from optimizing the baseline away. */
+static volatile long sink;
+
+/**
+ * Allocator that counts allocations and live bytes.
+ */
+struct counter {
+	long allocs;
+	size_t live, peak;
+};
+
+/* Room for the size, keeping the block aligned. */
+#define HEADER sizeof(union opt_data)
+
+static void *count_alloc(void *user, size_t size)
+{
+	struct counter *c = user;
+	char *block = malloc(size + HEADER);
+
+	if (block == NULL) {
+		return NULL;
+	}
+
+	memcpy(block, &size, sizeof(size));
+	c->allocs++;
+	c->live += size;
+	if (c->live > c->peak) {
+		c->peak = c->live;
+	}
+
+	return block + HEADER;
+}
+
+static void count_free(void *user, void *ptr)
+{
+	struct counter *c = user;
+	size_t size;
+
+	if (ptr != NULL) {
+		char *block = (char *)ptr - HEADER;
+
+		memcpy(&size, block, sizeof(size));
+		c->live -= size;
+		free(block);
+	}
+}
+
+static struct counter counter;
+
+static const struct opt_allocator counting_allocator = {
+	count_alloc, count_free, &counter
+};
+
+static struct opt_conf cfg = {
+	.helpstr = "Command line shapes",
+	.tune = OPTPARSE_IGNORE_ARGV0,
+	.rules = rules,
+	.allocator = &counting_allocator
+};
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+}
+
+static void reset(void)
+{
+	n_rules = 0;
+	n_longopts = 0;
+	optstring[0] = '\0';
+	argc = 0;
+	argv[argc++] = "prog";
+}
+
+/**
+ * Add an option, both as a rule and for getopt_long().
+ *
+ * @param   short_id    Short id, or 0 for none.
+ * @param   named       Whether it has a long id ("o" and the rule number).
+ */
+static void add_option(enum OPTPARSE_ACTIONS action, char short_id, int named)
+{
+	struct opt_rule *rule = rules + n_rules;
+	int needs_value = action < _OPTPARSE_MAX_NEEDS_VALUE_END;
+
+	memset(rule, 0, sizeof(*rule));
+	rule->action = action;
+	rule->action_data.option.short_id = short_id;
+
+	if (short_id) {
+		size_t len = strlen(optstring);
+
+		optstring[len++] = short_id;
+		if (needs_value) {
+			optstring[len++] = ':';
+		}
+		optstring[len] = '\0';
+		short_rule[(unsigned char)short_id] = n_rules;
+	}
+
+	if (named) {
+		sprintf(names[n_rules], "o%03d", n_rules);
+		rule->action_data.option.long_id = names[n_rules];
+		longopts[n_longopts].name = names[n_rules];
+		longopts[n_longopts].has_arg = needs_value ? required_argument
+							   : no_argument;
+		longopts[n_longopts].flag = NULL;
+		longopts[n_longopts].val = short_id ? short_id
+						    : LONG_ONLY + n_rules;
+		n_longopts++;
+		memset(longopts + n_longopts, 0, sizeof(*longopts));
+	}
+
+	n_rules++;
+}
+
+static void add_token(const char *token)
+{
+	strcpy(tokens[argc], token);
+	argv[argc] = tokens[argc];
+	argc++;
+	argv[argc] = NULL;
+}
+
+/* Shapes. Each one builds the rules and the command line. */
+
+/** A few short options, each with a numeric value. */
+static void shape_few_short(void)
+{
+	char value[TOKEN_SIZE];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		add_option(OPTPARSE_INT, (char)('a' + i), 0);
+	}
+	for (i = 0; i < 32; i += 2) {
+		sprintf(value, "-%c", 'a' + i % 8);
+		add_token(value);
+		sprintf(value, "%d", i * 37);
+		add_token(value);
+	}
+}
+
+/** Hundreds of long options, a few of them given. */
+static void shape_many_long(void)
+{
+	char value[TOKEN_SIZE];
+	int i;
+
+	for (i = 0; i < 200; i++) {
+		add_option(OPTPARSE_UINT, 0, 1);
+	}
+	for (i = 0; i < 32; i += 2) {
+		sprintf(value, "--o%03d", (i * 53) % 200);
+		add_token(value);
+		sprintf(value, "%d", i);
+		add_token(value);
+	}
+}
+
+/** Switches merged in groups, like -xvf. */
+static void shape_merged(void)
+{
+	int i;
+
+	for (i = 0; i < 24; i++) {
+		add_option(OPTPARSE_COUNT, (char)('a' + i), 0);
+	}
+	for (i = 0; i < 4; i++) {
+		add_token("-abcdefgh");
+		add_token("-ijklmnop");
+		add_token("-qrstuvwx");
+	}
+}
+
+/** Integer and real values. */
+static void shape_numeric(void)
+{
+	int i;
+
+	add_option(OPTPARSE_INT, 'n', 1);
+	add_option(OPTPARSE_INT64, 'l', 1);
+	add_option(OPTPARSE_FLOAT, 'f', 1);
+	add_option(OPTPARSE_DOUBLE, 'd', 1);
+	for (i = 0; i < 4; i++) {
+		add_token("-n");
+		add_token("-12345");
+		add_token("-l");
+		add_token("9000000000");
+		add_token("-f");
+		add_token("0.5");
+		add_token("-d");
+		add_token("3.25e2");
+	}
+}
+
+/** Mostly positional arguments, collected into an array. */
+static void shape_positional(void)
+{
+	char value[TOKEN_SIZE];
+	struct opt_rule *rule;
+	int i;
+
+	add_option(OPTPARSE_COUNT, 'v', 0);
+	rule = rules + n_rules++;
+	memset(rule, 0, sizeof(*rule));
+	rule->action = OPTPARSE_POSITIONAL_OPT;
+	rule->action_data.argument.pos_action = OPTPARSE_POS_COLLECT_STR;
+	rule->action_data.argument.name = "file";
+
+	add_token("-v");
+	for (i = 1; i < 32; i++) {
+		sprintf(value, "dir/file%03d.c", i);
+		add_token(value);
+	}
+}
+
+/** String options, which are copied. */
+static void shape_strings(void)
+{
+	char value[TOKEN_SIZE];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		add_option(OPTPARSE_STR, 0, 1);
+	}
+	for (i = 0; i < 32; i += 2) {
+		sprintf(value, "--o%03d", i % 8);
+		add_token(value);
+		sprintf(value, "value-string-%d", i);
+		add_token(value);
+	}
+}
+
+static const struct {
+	const char *name;
+	void (*build)(void);
+} shapes[] = {
+	{"few-short", shape_few_short},
+	{"many-long", shape_many_long},
+	{"merged", shape_merged},
+	{"numeric", shape_numeric},
+	{"positional", shape_positional},
+	{"strings", shape_strings},
+};
+
+#define N_SHAPES ((int)(sizeof(shapes) / sizeof(*shapes)))
+
+/**
+ * Parse with getopt_long(), converting and copying values like optparse
+ * would.
+ */
+static void getopt_parse(void)
+{
+	static char *strings[MAX_RULES];
+	static const char *positional[MAX_ARGS];
+	long acc = 0;
+	int c, i, n_pos = 0;
+
+#ifdef __GLIBC__
+	optind = 0;     /* Full reinitialization. */
+#else
+	optind = 1;
+#endif
+	while ((c = getopt_long(argc, argv, optstring, longopts, NULL)) != -1) {
+		int r = (c >= LONG_ONLY) ? c - LONG_ONLY : short_rule[c];
+
+		if (c == '?') {
+			abort();
+		}
+
+		switch (rules[r].action) {
+			case OPTPARSE_INT:
+			case OPTPARSE_INT64:
+				acc += strtol(optarg, NULL, 0);
+				break;
+			case OPTPARSE_UINT:
+				acc += (long)strtoul(optarg, NULL, 0);
+				break;
+			case OPTPARSE_FLOAT:
+			case OPTPARSE_DOUBLE:
+				acc += (long)strtod(optarg, NULL);
+				break;
+			case OPTPARSE_STR:
+				free(strings[r]);
+				strings[r] = strdup(optarg);
+				break;
+			default:
+				acc++;
+				break;
+		}
+	}
+
+	for (; optind < argc; optind++) {
+		positional[n_pos++] = argv[optind];
+	}
+
+	for (i = 0; i < n_rules; i++) {
+		free(strings[i]);
+		strings[i] = NULL;
+	}
+
+	sink = acc + (n_pos ? (long)(positional[n_pos - 1] - argv[0]) : 0);
+}
+
+/**
+ * Time reps parses.
+ *
+ * @param   index   Parse with optparse_cmd_compiled() if not NULL.
+ * @param   baseline    Use getopt_long() instead.
+ *
+ * @return  ns per token, or a negative value if the parser failed.
+ */
+static double run(const struct opt_index *index, int baseline, long reps)
+{
+	union opt_data results[MAX_RULES];
+	const char * const *args = (const char * const *)argv;
+	long r;
+	double t0 = now();
+
+	for (r = 0; r < reps; r++) {
+		if (baseline) {
+			getopt_parse();
+			continue;
+		}
+
+		if ((index != NULL ? optparse_cmd_compiled(index, results,
+							   argc, args)
+				   : optparse_cmd(&cfg, results, argc, args))
+		    < 0) {
+			return -1;
+		}
+		optparse_free_strings(&cfg, results);
+	}
+
+	return (now() - t0) / (double)(reps * (argc - 1));
+}
+
+int main(void)
+{
+	int i;
+
+	printf("%-11s %6s %5s %10s %10s %10s %7s %7s\n", "shape", "tokens",
+	       "rules", "plain", "index", "getopt", "allocs", "peak");
+	printf("%-11s %6s %5s %10s %10s %10s %7s %7s\n", "", "", "", "ns/tok",
+	       "ns/tok", "ns/tok", "/parse", "bytes");
+
+	for (i = 0; i < N_SHAPES; i++) {
+		struct opt_index index;
+		double plain, indexed, getopt;
+		union opt_data results[MAX_RULES];
+		size_t base;
+		long reps;
+
+		reset();
+		shapes[i].build();
+		cfg.n_rules = n_rules;
+		reps = TOTAL_TOKENS / (argc - 1);
+
+		if (optparse_compile(&cfg, &index) != OPTPARSE_OK) {
+			printf("%-11s: bad configuration\n", shapes[i].name);
+			continue;
+		}
+
+		plain = run(NULL, 0, reps);
+		indexed = run(&index, 0, reps);
+		getopt = run(NULL, 1, reps);
+
+		/* Measure the memory of a single parse. The index is still
+		 * allocated, so only count what goes above it. */
+		base = counter.live;
+		counter.allocs = 0;
+		counter.peak = base;
+		optparse_cmd(&cfg, results, argc, (const char * const *)argv);
+		optparse_free_strings(&cfg, results);
+
+		if (plain < 0 || indexed < 0) {
+			printf("%-11s: rejected by parser\n", shapes[i].name);
+		} else {
+			printf("%-11s %6d %5d %10.1f %10.1f %10.1f %7ld %7zu\n",
+			       shapes[i].name, argc - 1, n_rules, plain,
+			       indexed, getopt, counter.allocs,
+			       counter.peak - base);
+		}
+
+		optparse_index_free(&index);
+	}
+
+	return 0;
+}
@@ -0,0 +1,79 @@
+/**
+ * @file
+ * @author  Juan I Carrano <juan@carrano.com.ar.
+ *
+ * Compare optparse's integer conversion with strtol() on typical option
+ * values.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+
+#include "optparse.h"
+
+#define REPS 2000000L
+
+static const char *payloads[] = {
+	"0", "1", "8", "42", "-17", "100", "443", "8080", "65535", "1000000",
+	"2147483647", "-2147483648", "0x1f", "0xdeadbeef", "0755", "86400"
+};
+
+#define N_PAYLOADS ((long)(sizeof(payloads) / sizeof(*payloads)))
+
+/* Keep the compiler from optimizing the conversions away. */
+static volatile long sink;
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+}
+
+static double bench_strtol(void)
+{
+	long r, acc = 0;
+	double t0 = now();
+
+	for (r = 0; r < REPS; r++) {
+		char *end;
+
+		acc += strtol(payloads[r % N_PAYLOADS], &end, 0);
+		acc += *end;
+	}
+	sink = acc;
+
+	return (now() - t0) / REPS;
+}
+
+static double bench_optparse(void)
+{
+	long r, acc = 0;
+	double t0 = now();
+
+	for (r = 0; r < REPS; r++) {
+		int64_t v;
+		const char *msg;
+
+		acc += optparse_conv_int(payloads[r % N_PAYLOADS], INT_MIN,
+					 UINT_MAX, &v, &msg);
+		acc += (long)v;
+	}
+	sink = acc;
+
+	return (now() - t0) / REPS;
+}
+
+int main(void)
+{
+	printf("%-20s %8s\n", "conversion", "ns/call");
+	printf("%-20s %8.1f\n", "strtol", bench_strtol());
+	printf("%-20s %8.1f\n", "optparse_conv_int", bench_optparse());
+
+	return 0;
+}
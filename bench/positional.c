@@ -0,0 +1,118 @@
+/**
+ * @file
+ * @author  Juan I Carrano <juan@carrano.com.ar.
+ *
+ * Measure how positional argument dispatch scales with the number of
+ * arguments, with and without a compiled index.
+ *
+ * The cost per argument should stay flat as the number of arguments grows.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "optparse.h"
+
+#define N_OPTS 32
+#define N_POS 8
+#define N_RULES (N_OPTS + N_POS)
+
+#define MAX_ARGS 1000000L
+
+static struct opt_rule rules[N_RULES];
+
+static const struct opt_conf cfg = {
+	.helpstr = "Positional benchmark",
+	.tune = OPTPARSE_COLLECT_LAST_POS,
+	.rules = rules,
+	.n_rules = N_RULES
+};
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+}
+
+static void init_rules(void)
+{
+	int i;
+
+	/* Options come first so that the plain lookup has to skip them. */
+	for (i = 0; i < N_OPTS; i++) {
+		rules[i].action = OPTPARSE_COUNT;
+	}
+
+	for (; i < N_RULES; i++) {
+		rules[i].action = OPTPARSE_POSITIONAL_OPT;
+		rules[i].action_data.argument.pos_action = OPTPARSE_POS_COUNT;
+		rules[i].action_data.argument.name = "file";
+	}
+}
+
+/**
+ * Parse the first n elements of argv, repeating until at least 10^6
+ * arguments have been processed. Returns ns/argument or a negative value if
+ * the parser rejected the input.
+ */
+static double run(const struct opt_index *index, long n,
+		  const char * const argv[])
+{
+	static union opt_data results[N_RULES];
+	long reps = (MAX_ARGS + n - 1) / n;
+	long r;
+	double t0 = now();
+
+	for (r = 0; r < reps; r++) {
+		int ret = (index != NULL)
+			  ? optparse_cmd_compiled(index, results, (int)n, argv)
+			  : optparse_cmd(&cfg, results, (int)n, argv);
+
+		if (ret < 0) {
+			return -1;
+		}
+	}
+
+	return (now() - t0) / (double)(reps * n);
+}
+
+int main(void)
+{
+	struct opt_index index;
+	const char **argv;
+	long n, i;
+
+	init_rules();
+
+	if (optparse_compile(&cfg, &index) != OPTPARSE_OK
+	    || (argv = malloc(MAX_ARGS * sizeof(*argv))) == NULL) {
+		return 1;
+	}
+
+	for (i = 0; i < MAX_ARGS; i++) {
+		argv[i] = "some/file/name";
+	}
+
+	printf("%10s %14s %14s\n", "args", "plain ns/arg", "index ns/arg");
+
+	for (n = 10; n <= MAX_ARGS; n *= 10) {
+		double plain = run(NULL, n, argv);
+		double indexed = run(&index, n, argv);
+
+		if (plain < 0 || indexed < 0) {
+			printf("%10ld %29s\n", n, "rejected by parser");
+		} else {
+			printf("%10ld %14.1f %14.1f\n", n, plain, indexed);
+		}
+	}
+
+	optparse_index_free(&index);
+	free(argv);
+
+	return 0;
+}
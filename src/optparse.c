@@ -30,11 +30,46 @@
  * ```
  */
 
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_POSIX
+#endif
+
+/* Response files are mapped into memory on POSIX systems. Elsewhere (or with
+ * OPTPARSE_NO_MMAP) they are read with stdio. */
+#if !defined(OPTPARSE_NO_MMAP) && defined(HAVE_POSIX)
+#define USE_MMAP
+#endif
+
+/* Batch parsing uses POSIX threads if OPTPARSE_THREADS is defined. */
+#if defined(HAVE_POSIX) || defined(OPTPARSE_THREADS)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <float.h>
+#include <math.h>
+
+#ifdef USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(HAVE_POSIX) || defined(OPTPARSE_THREADS)
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_POSIX
+#include <errno.h>
+#endif
+
+#ifdef OPTPARSE_THREADS
+#include <pthread.h>
+#endif
 
 #include "optparse.h"
 
@@ -49,7 +84,37 @@
 	#define P_DEBUG P_ERR
 #endif /*NDEBUG */
 
-#define HELP_STREAM stdout /* TODO: remove this */
+/** Like P_DEBUG, but silent if errors go to the error context of the parse,
+ * which must not touch stdio. */
+#define ENV_DEBUG(env, ...) \
+	do { if ((env)->ctx->error == NULL) { P_DEBUG(__VA_ARGS__); } } while (0)
+
+#define HELP_STREAM stdout /**< Default destination of the help */
+
+/** Size of the stack buffer used to print the help when it cannot be
+ * allocated. */
+#define HELP_CHUNK 128
+
+#ifdef OPTPARSE_STATS
+
+#ifndef OPTPARSE_STATS_CLOCK
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OPTPARSE_STATS_CLOCK() __builtin_ia32_rdtsc()
+#else
+#include <time.h>
+#define OPTPARSE_STATS_CLOCK() ((uint64_t)clock())
+#endif
+#endif /* OPTPARSE_STATS_CLOCK */
+
+/** Add n to a field of a opt_stats, if it is not NULL. */
+#define STATS_ADD(stats, field, n) \
+	do { if ((stats) != NULL) { (stats)->field += (n); } } while (0)
+
+#else /* OPTPARSE_STATS */
+
+#define STATS_ADD(stats, field, n) ((void)(stats))
+
+#endif /* OPTPARSE_STATS */
 
 /**
  * Like fputs, but the string can be null.
@@ -61,31 +126,224 @@ static void safe_fputs(const char *s, FILE *stream)
 	(s != NULL) ? fputs(s, stream) : 0;
 }
 
+#ifdef OPTPARSE_NO_MALLOC
+static void *default_alloc(void *user, size_t size)
+{
+	(void)user;
+	(void)size;
+
+	return NULL;
+}
+
+static void default_free(void *user, void *ptr)
+{
+	(void)user;
+	(void)ptr;
+}
+#else /* OPTPARSE_NO_MALLOC */
+static void *default_alloc(void *user, size_t size)
+{
+	(void)user;
+
+	return malloc(size);
+}
+
+static void default_free(void *user, void *ptr)
+{
+	(void)user;
+
+	free(ptr);
+}
+#endif /* OPTPARSE_NO_MALLOC */
+
+static const struct opt_allocator default_allocator = {
+	default_alloc, default_free, NULL
+};
+
+/**
+ * Get the allocator to use with a configuration.
+ *
+ * The one in the context (if any) takes precedence over the one in the
+ * configuration.
+ */
+static const struct opt_allocator *get_allocator(const struct opt_conf *config,
+						 const struct opt_context *ctx)
+{
+	if (ctx != NULL && ctx->allocator != NULL) {
+		return ctx->allocator;
+	}
+
+	return (config->allocator != NULL) ? config->allocator
+					   : &default_allocator;
+}
+
+/**
+ * Settings that stay fixed during a parse.
+ */
+struct parse_env {
+	const struct opt_conf *config;
+	struct opt_context *ctx;
+	const struct opt_allocator *allocator;
+};
+
+#define NEEDS_VALUE(rule) ((rule)->action < _OPTPARSE_MAX_NEEDS_VALUE_END)
+
+/** Minimum size of the blocks allocated by an arena. */
+#define ARENA_MIN_BLOCK 256
+
+/**
+ * Header of the blocks allocated by an arena. The data follows it.
+ */
+struct opt_arena_block {
+	struct opt_arena_block *next;
+};
+
 /**
- * Like fputc, but nothing is printed if the character is the terminator.
+ * Padding needed to align the next allocation from an arena.
  */
-static void safe_fputc(int c, FILE *stream)
+static size_t arena_pad(const struct opt_arena *arena, size_t align)
 {
-	(c != TERM) ? fputc(c, stream) : 0;
+	uintptr_t next;
+
+	if (arena->buf == NULL) {
+		return 0;
+	}
+
+	next = (uintptr_t)(arena->buf + arena->used);
+
+	return (align - (next & (align - 1))) & (align - 1);
 }
 
-#if (_XOPEN_SOURCE >= 500) || (_POSIX_C_SOURCE > 200809L)
-	#define my_strdup strdup
-#else /* no posix source */
-	char *my_strdup(const char *s)
-	{
-		char *dup;
-		size_t len = strlen(s) + 1;
+/**
+ * Get size bytes from an arena, allocating a new block if needed.
+ *
+ * align must be a power of two. Blocks grow geometrically so that an arena
+ * that is reset and reused quickly stops allocating.
+ */
+static void *arena_alloc(struct opt_arena *arena,
+			 const struct opt_allocator *allocator, size_t size,
+			 size_t align)
+{
+	void *p;
+	size_t pad = arena_pad(arena, align);
+
+	if (arena->size - arena->used < size + pad) {
+		struct opt_arena_block *block;
+		size_t block_size = arena->size * 2;
+
+		if (block_size < size + align - 1) {
+			block_size = size + align - 1;
+		}
+		if (block_size < ARENA_MIN_BLOCK) {
+			block_size = ARENA_MIN_BLOCK;
+		}
+
+		/* All blocks must be released with the same allocator. */
+		if (arena->allocator == NULL) {
+			arena->allocator = allocator;
+		}
 
-		if ((dup = malloc(len)) != NULL) {
-			memcpy(dup, s, len);
+		block = arena->allocator->alloc(arena->allocator->user,
+						sizeof(*block) + block_size);
+		if (block == NULL) {
+			return NULL;
 		}
 
-		return dup;
+		block->next = arena->blocks;
+		arena->blocks = block;
+		arena->buf = (char *)(block + 1);
+		arena->size = block_size;
+		arena->used = 0;
+		pad = arena_pad(arena, align);
 	}
-#endif /* posix source */
 
-#define NEEDS_VALUE(rule) ((rule)->action < _OPTPARSE_MAX_NEEDS_VALUE_END)
+	p = arena->buf + arena->used + pad;
+	arena->used += pad + size;
+
+	return p;
+}
+
+/**
+ * Copy a string for OPTPARSE_STR, into the arena if there is one.
+ */
+static char *copy_string(const struct parse_env *env, const char *s)
+{
+	char *dup;
+	size_t len = strlen(s) + 1;
+	struct opt_arena *arena = env->ctx->arena;
+
+	dup = (arena != NULL) ? arena_alloc(arena, env->allocator, len, 1)
+			      : env->allocator->alloc(env->allocator->user, len);
+	if (dup != NULL) {
+		memcpy(dup, s, len);
+		STATS_ADD(env->ctx->stats, str_bytes, len);
+	}
+
+	return dup;
+}
+
+/** Initial capacity of the arrays of the append actions. */
+#define APPEND_MIN_CAPACITY 4
+
+/**
+ * Move an array to a new block with room for n elements.
+ *
+ * The old block is released, unless it came from the arena.
+ *
+ * @return  OPTPARSE_OK or -OPTPARSE_NOMEM.
+ */
+static int resize_array(const struct parse_env *env,
+			enum OPTPARSE_ACTIONS action, struct opt_array *array,
+			size_t n)
+{
+	struct opt_arena *arena = env->ctx->arena;
+	size_t elem_size = (action == OPTPARSE_COLLECT_INT64
+			    || action == OPTPARSE_APPEND_INT64)
+			   ? sizeof(*array->items.i64)
+			   : (action == OPTPARSE_COLLECT_DOUBLE
+			      || action == OPTPARSE_APPEND_DOUBLE)
+			   ? sizeof(*array->items.dbl)
+			   : sizeof(*array->items.str);
+	void *items = (arena != NULL)
+		? arena_alloc(arena, env->allocator, n * elem_size, elem_size)
+		: env->allocator->alloc(env->allocator->user, n * elem_size);
+
+	if (items == NULL) {
+		return -OPTPARSE_NOMEM;
+	}
+
+	if (array->count) {
+		memcpy(items, array->items.any, array->count * elem_size);
+	}
+	if (arena == NULL) {
+		env->allocator->free(env->allocator->user, array->items.any);
+	}
+	array->items.any = items;
+
+	return OPTPARSE_OK;
+}
+
+/**
+ * Make room for one more element in the array of an append action.
+ *
+ * The capacity is not stored: it is APPEND_MIN_CAPACITY or the smallest
+ * power of two not below count, so the array is full exactly when count is
+ * zero or a power of two from APPEND_MIN_CAPACITY on.
+ *
+ * @return  OPTPARSE_OK or -OPTPARSE_NOMEM.
+ */
+static int grow_array(const struct parse_env *env,
+		      enum OPTPARSE_ACTIONS action, struct opt_array *array)
+{
+	size_t n = array->count;
+
+	if (n != 0 && (n < APPEND_MIN_CAPACITY || (n & (n - 1)) != 0)) {
+		return OPTPARSE_OK;
+	}
+
+	return resize_array(env, action, array,
+			    n ? 2 * n : APPEND_MIN_CAPACITY);
+}
 
 /**
  * If the string stri starts with a dash, remove it and return a string to
@@ -120,6 +378,32 @@ static bool _is_argument(enum OPTPARSE_ACTIONS action)
 	       && action < _OPTPARSE_POSITIONAL_END;
 }
 
+/**
+ * Return true if the action collects all remaining positional arguments.
+ */
+static bool _is_collect(enum OPTPARSE_ACTIONS action)
+{
+	return action >= OPTPARSE_COLLECT_INT64
+	       && action <= OPTPARSE_COLLECT_STR;
+}
+
+/**
+ * Return true if the action appends to an array each time.
+ */
+static bool _is_append(enum OPTPARSE_ACTIONS action)
+{
+	return action >= OPTPARSE_APPEND_INT64
+	       && action <= OPTPARSE_APPEND_STR;
+}
+
+/**
+ * Return true if the result of the action is an opt_array.
+ */
+static bool _is_array(enum OPTPARSE_ACTIONS action)
+{
+	return _is_collect(action) || _is_append(action);
+}
+
 /**
  * Return true if the action indicates an optional argument OR option.
  */
@@ -128,85 +412,336 @@ static bool _is_optional(enum OPTPARSE_ACTIONS action)
 	return action != OPTPARSE_POSITIONAL;
 }
 
-static void _option_help(const struct opt_rule *rule)
+#ifndef OPTPARSE_NO_HELP_FORMAT
+
+/**
+ * Output of the help renderer.
+ *
+ * Text is copied into buf. When buf is full it is flushed to sink or, if
+ * there is no sink, the rest of the text is only counted.
+ */
+struct help_out {
+	char *buf;
+	size_t size;    /**< Size of buf. */
+	size_t used;    /**< Bytes in buf. */
+	size_t total;   /**< Length of the whole text. */
+	const struct opt_sink *sink;
+	/** Columns taken by the text, counting each UTF-8 sequence as one. */
+	size_t columns;
+};
+
+static void help_put(struct help_out *out, const char *s, size_t n)
+{
+	size_t i;
+
+	out->total += n;
+	for (i = 0; i < n; i++) {
+		out->columns += ((unsigned char)s[i] & 0xC0) != 0x80;
+	}
+
+	while (n > 0) {
+		size_t room = out->size - out->used;
+
+		if (room == 0) {
+			if (out->sink == NULL) {
+				return;
+			}
+			out->sink->write(out->sink->user, out->buf, out->used);
+			out->used = 0;
+			room = out->size;
+		}
+		if (room > n) {
+			room = n;
+		}
+		memcpy(out->buf + out->used, s, room);
+		out->used += room;
+		s += room;
+		n -= room;
+	}
+}
+
+/**
+ * Like help_put, but the string can be null.
+ */
+static void help_puts(struct help_out *out, const char *s)
+{
+	if (s != NULL) {
+		help_put(out, s, strlen(s));
+	}
+}
+
+/**
+ * Like help_put, but nothing is written if the character is the terminator.
+ */
+static void help_putc(struct help_out *out, char c)
+{
+	if (c != TERM) {
+		help_put(out, &c, 1);
+	}
+}
+
+/** Indentation of the rule lines of the help. */
+#define HELP_INDENT "  "
+/** Minimum space between the name of a rule and its description. */
+#define HELP_GAP 2
+
+/** Like help_put, but writes n spaces. */
+static void help_pad(struct help_out *out, size_t n)
 {
-	safe_fputc('-', HELP_STREAM);
-	safe_fputc(rule->action_data.option.short_id, HELP_STREAM);
-	safe_fputs("\t--", HELP_STREAM);
-	safe_fputs(rule->action_data.option.long_id, HELP_STREAM);
+	while (n--) {
+		help_putc(out, ' ');
+	}
 }
 
-static void _argument_help(const struct opt_rule *rule)
+/**
+ * Write the name of a rule, as it appears in the first column of the help:
+ * "-s, --long", "-s" or "    --long" for options and "name" or "name?" for
+ * arguments. Missing ids are left out.
+ *
+ * @return  Width of the name, in columns.
+ */
+static size_t _rule_help(struct help_out *out, const struct opt_rule *rule)
 {
-	safe_fputs(rule->action_data.argument.name, HELP_STREAM);
+	size_t start = out->columns;
+
+	if (_is_argument(rule->action)) {
+		help_puts(out, rule->action_data.argument.name);
+		if (_is_optional(rule->action)) {
+			help_putc(out, '?');
+		}
+	} else {
+		char short_id = rule->action_data.option.short_id;
+		const char *long_id = rule->action_data.option.long_id;
 
-	if (_is_optional(rule->action)) {
-		safe_fputc('?', HELP_STREAM);
+		if (short_id != OPTPARSE_NO_SHORT) {
+			help_putc(out, '-');
+			help_putc(out, short_id);
+		} else if (long_id != NULL) {
+			help_puts(out, "  ");
+		}
+		if (long_id != NULL) {
+			help_puts(out, (short_id != OPTPARSE_NO_SHORT) ? ", --"
+								: "  --");
+			help_puts(out, long_id);
+		}
 	}
+
+	return out->columns - start;
 }
 
-/* TODO: make help stream into an argument */
-/* TODO: Expose this function in the public API */
-static void do_help(const struct opt_conf *config)
+/**
+ * Write the help: the help string and then one line per rule, with the
+ * descriptions aligned.
+ */
+static void render_help(struct help_out *out, const struct opt_conf *config)
 {
+	struct help_out measure = {.buf = NULL};
+	size_t width = 0;
 	int rule_i;
 
-	safe_fputs(config->helpstr, HELP_STREAM);
-	safe_fputc('\n', HELP_STREAM);
+	for (rule_i = 0; rule_i < config->n_rules; rule_i++) {
+		size_t len = _rule_help(&measure, config->rules + rule_i);
+
+		if (len > width) {
+			width = len;
+		}
+	}
+
+	help_puts(out, config->helpstr);
+	help_putc(out, '\n');
 
 	for (rule_i = 0; rule_i < config->n_rules; rule_i++) {
 		const struct opt_rule *rule = config->rules + rule_i;
+		size_t len;
 
-		if (_is_argument(rule->action)) {
-			_argument_help(rule);
-		} else {
-			_option_help(rule);
+		help_puts(out, HELP_INDENT);
+		len = _rule_help(out, rule);
+		if (rule->desc != NULL) {
+			help_pad(out, width - len + HELP_GAP);
+			help_puts(out, rule->desc);
+		}
+		help_putc(out, '\n');
+	}
+}
+
+size_t optparse_help_render(const struct opt_conf *config, char *buf,
+			    size_t size)
+{
+	struct help_out out = {.buf = buf,
+			       .size = (size > 0) ? size - 1 : 0};
+
+	render_help(&out, config);
+	if (size > 0) {
+		buf[out.used] = TERM;
+	}
+
+	return out.total;
+}
+
+/**
+ * Render the help into a newly allocated buffer.
+ */
+static char *alloc_help(const struct opt_conf *config,
+			const struct opt_allocator *allocator, size_t *len)
+{
+	char *text;
+
+	*len = optparse_help_render(config, NULL, 0);
+	text = allocator->alloc(allocator->user, *len + 1);
+	if (text != NULL) {
+		optparse_help_render(config, text, *len + 1);
+	}
+
+	return text;
+}
+
+const char *optparse_help_text(const struct opt_conf *config, size_t *len)
+{
+	struct opt_help_cache *cache = config->help_cache;
+
+	if (config->help_text != NULL) {
+		if (len != NULL) {
+			*len = strlen(config->help_text);
+		}
+		return config->help_text;
+	}
+
+	if (cache == NULL) {
+		return NULL;
+	}
+
+	if (cache->text == NULL) {
+		cache->text = alloc_help(config, get_allocator(config, NULL),
+					 &cache->len);
+	}
+	if (len != NULL) {
+		*len = cache->len;
+	}
+
+	return cache->text;
+}
+
+void optparse_help_cache_free(const struct opt_conf *config)
+{
+	const struct opt_allocator *allocator = get_allocator(config, NULL);
+	struct opt_help_cache *cache = config->help_cache;
+
+	if (cache != NULL) {
+		allocator->free(allocator->user, cache->text);
+		cache->text = NULL;
+		cache->len = 0;
+	}
+}
+
+#endif /* OPTPARSE_NO_HELP_FORMAT */
+
+static void file_write(void *user, const char *text, size_t len)
+{
+	fwrite(text, 1, len, user);
+}
+
+#ifdef HAVE_POSIX
+void optparse_fd_write(void *user, const char *text, size_t len)
+{
+	int fd = *(const int *)user;
+
+	while (len > 0) {
+		ssize_t n = write(fd, text, len);
+
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
 		}
+		text += n;
+		len -= (size_t)n;
+	}
+}
+#endif /* HAVE_POSIX */
+
+void optparse_help(const struct opt_conf *config)
+{
+	struct opt_sink default_sink = {file_write, HELP_STREAM};
+	const struct opt_sink *sink = (config->help_sink != NULL)
+				      ? config->help_sink : &default_sink;
+#ifdef OPTPARSE_NO_HELP_FORMAT
+	if (config->help_text != NULL) {
+		sink->write(sink->user, config->help_text,
+			    strlen(config->help_text));
+	}
+#else /* OPTPARSE_NO_HELP_FORMAT */
+	const struct opt_allocator *allocator = get_allocator(config, NULL);
+	const char *text;
+	char *tmp;
+	size_t len;
+
+	if ((text = optparse_help_text(config, &len)) != NULL) {
+		sink->write(sink->user, text, len);
+	} else if ((tmp = alloc_help(config, allocator, &len)) != NULL) {
+		sink->write(sink->user, tmp, len);
+		allocator->free(allocator->user, tmp);
+	} else {
+		char chunk[HELP_CHUNK];
+		struct help_out out = {.buf = chunk,
+				       .size = sizeof(chunk),
+				       .sink = sink};
 
-		safe_fputc('\t', HELP_STREAM);
-		safe_fputs(rule->desc, HELP_STREAM);
-		safe_fputc('\n', HELP_STREAM);
+		render_help(&out, config);
+		sink->write(sink->user, chunk, out.used);
 	}
+#endif /* OPTPARSE_NO_HELP_FORMAT */
 }
 
 /**
- * Check that there are no optional arguments before non optional ones.
+ * Check that there are no optional arguments before non optional ones, and
+ * that collect actions are only used in the last positional argument.
  *
  * @return zero on success, nonzero on error.
  */
 static bool sanity_check(const struct opt_conf *config)
 {
 	int rule_i;
-	bool found_optional = false;
+	bool found_optional = false, found_collect = false;
 
 	for (rule_i = 0; rule_i < config->n_rules; rule_i++) {
-		bool is_positional = _is_argument(config->rules[rule_i].action);
-		bool is_optional = _is_optional(config->rules[rule_i].action);
+		const struct opt_rule *rule = config->rules + rule_i;
+		bool is_positional = _is_argument(rule->action);
+		bool is_optional = _is_optional(rule->action);
 
 		if (!is_positional) {
+			if (_is_collect(rule->action)) {
+				return true;
+			}
 			continue;
 		}
 
-		if (found_optional && !is_optional) {
+		if ((found_optional && !is_optional) || found_collect) {
 			return true;
 		}
 
 		found_optional = found_optional || is_optional;
+		found_collect = _is_collect((enum OPTPARSE_ACTIONS)
+				rule->action_data.argument.pos_action);
 	}
 
 	return false;
 }
 
-static int do_user_callback(const struct opt_rule *rule, union opt_data *dest,
+static int do_user_callback(const struct parse_env *env,
+			    const struct opt_rule *rule, union opt_data *dest,
 			    int positional_idx, const char *value,
 			    const char **custom_message)
 {
 	union opt_key key;
 	struct opt_positionalkey pkey;
 	int ret;
+#ifdef OPTPARSE_STATS
+	uint64_t t0 = OPTPARSE_STATS_CLOCK();
+#endif
 
 	if (_is_argument(rule->action)) {
-		pkey.position = positional_idx;
+		pkey.position = (optparse_pos)positional_idx;
 		pkey.name = rule->action_data.argument.name;
 		key.argument = &pkey;
 	} else {
@@ -216,390 +751,3652 @@ static int do_user_callback(const struct opt_rule *rule, union opt_data *dest,
 	ret = rule->default_value._thin_callback(key, value,
 						 dest, custom_message);
 
+	STATS_ADD(env->ctx->stats, callbacks, 1);
+	STATS_ADD(env->ctx->stats, callback_ticks, OPTPARSE_STATS_CLOCK() - t0);
+
 	return ret;
 }
 
-static enum OPTPARSE_ACTIONS real_action(const struct opt_rule *rule)
+/**
+ * Return true for the characters that isspace() accepts in the "C" locale.
+ */
+static bool is_space(char c)
 {
-	return _is_argument(rule->action)? rule->action_data.argument.pos_action
-				         : rule->action;
+	return c == ' ' || (c >= '\t' && c <= '\r');
 }
 
 /**
- * Execute the action associated with an argument.
+ * Get the value of a digit in bases up to 36, or a value >= 36 if c is not
+ * a digit.
+ */
+static unsigned int digit_value(char c)
+{
+	unsigned int d = (unsigned int)(unsigned char)c - '0';
+
+	if (d > 9) {
+		/* Map 'a'-'z' and 'A'-'Z' to 10-35, everything else to >= 36 */
+		d = ((unsigned int)(unsigned char)c | 0x20) - 'a';
+		d = (d < 26) ? d + 10 : 36;
+	}
+
+	return d;
+}
+
+/**
+ * Skip blanks and an optional sign.
  *
- * positional_idx is only used for custom commands in positional arguments.
- * value is only used for commands that need it.
- * This assumes key and value are not null if they should not be.
+ * @return  true if there was a minus sign.
+ */
+static bool skip_sign(const char **str)
+{
+	const char *s = *str;
+	bool negative;
+
+	while (is_space(*s)) {
+		s++;
+	}
+
+	negative = *s == '-';
+	if (negative || *s == '+') {
+		s++;
+	}
+
+	*str = s;
+
+	return negative;
+}
+
+/**
+ * Convert an unsigned integer, in the same format as strtoul() with base 0:
+ * "0x" or "0X" introduces a hexadecimal number, a leading zero an octal one.
  *
- * @return  An exit code from OPTPARSE_RESULT.
+ * This does not depend on the locale and does not check for the terminator.
+ *
+ * @param   str     Start of the digits. Updated to point after the last
+ *                  one.
+ * @param   limit   Maximum value accepted.
+ * @param   value   Output value. Clamped to limit on overflow.
+ *
+ * @return  -1 if there are no digits, 1 if the result exceeds limit, else 0.
  */
-static int do_action(const struct opt_rule *rule,
-		     union opt_data *dest,
-		     int positional_idx, const char *value,
-		     const char **msg)
+static int conv_digits(const char **str, uint64_t limit, uint64_t *value)
 {
-	int ret = OPTPARSE_OK;
-	char *end_of_conversion;
-	enum OPTPARSE_ACTIONS action = real_action(rule);
+	const char *s = *str;
+	uint64_t v = 0;
+	unsigned int base = 10, d;
+	/* Number of digits that cannot overflow 64 bits. */
+	int n_safe = 19;
+	int ret = 0;
 
-	switch (action) {
-		case OPTPARSE_IGNORE: case OPTPARSE_IGNORE_SWITCH:
-			break;
-		case OPTPARSE_INT:
-			dest->d_int = strtol(value, &end_of_conversion, 0);
-			if (*end_of_conversion != '\0') {
-				*msg = "Expected integer";
-				ret = -OPTPARSE_BADSYNTAX;
-			}
-			break;
+	if (s[0] == '0') {
+		if ((s[1] | 0x20) == 'x' && digit_value(s[2]) < 16) {
+			base = 16;
+			n_safe = 16;
+			s += 2;
+		} else {
+			base = 8;
+			n_safe = 21;
+		}
+	}
+
+	if (digit_value(*s) >= base) {
+		return -1;
+	}
+
+	/* The overflow check is only needed after n_safe digits, so the
+	 * common case is a plain multiply-add per character. Decimal numbers
+	 * get their own loop, without the letter handling of digit_value. */
+	if (base == 10) {
+		while ((d = (unsigned int)(unsigned char)*s - '0') <= 9
+		       && n_safe-- > 0) {
+			v = v * 10 + d;
+			s++;
+		}
+	}
+
+	for (; (d = digit_value(*s)) < base; s++) {
+		if (n_safe-- <= 0 && v > (UINT64_MAX - d) / base) {
+			ret = 1;
+		}
+		v = v * base + d;
+	}
+
+	if (ret || v > limit) {
+		v = limit;
+		ret = 1;
+	}
+
+	*value = v;
+	*str = s;
+
+	return ret;
+}
+
+/**
+ * Check the result of conv_digits and the end of the string.
+ */
+static int conv_result(int conv_ret, const char *end, const char **msg)
+{
+	if (conv_ret < 0 || *end != TERM) {
+		*msg = "Expected integer";
+		return -OPTPARSE_BADSYNTAX;
+	} else if (conv_ret > 0) {
+		*msg = "Integer out of range";
+		return -OPTPARSE_BADSYNTAX;
+	}
+
+	return OPTPARSE_OK;
+}
+
+int optparse_conv_int(const char *str, int64_t min, int64_t max,
+		      int64_t *value, const char **msg)
+{
+	bool negative = skip_sign(&str);
+	/* Careful: -min may not be representable as a int64_t */
+	uint64_t limit = negative ? (min < 0 ? (uint64_t)-(min + 1) + 1 : 0)
+				  : (max < 0 ? 0 : (uint64_t)max);
+	uint64_t magnitude;
+	int ret = conv_digits(&str, limit, &magnitude);
+
+	if (negative) {
+		*value = (magnitude == 0) ? 0 : -(int64_t)(magnitude - 1) - 1;
+	} else {
+		*value = (int64_t)magnitude;
+	}
+
+	/* The range may not include zero. */
+	if (!ret && (*value < min || *value > max)) {
+		ret = 1;
+	}
+
+	return conv_result(ret, str, msg);
+}
+
+int optparse_conv_uint(const char *str, uint64_t max, uint64_t *value,
+		       const char **msg)
+{
+	bool negative = skip_sign(&str);
+	int ret = conv_digits(&str, negative ? 0 : max, value);
+
+	return conv_result(ret, str, msg);
+}
+
+/*
+ * Quantities with unit suffixes.
+ *
+ * The number is read as fixed point (integer part plus up to
+ * UNIT_FRAC_DIGITS decimals), the suffix is looked up in a table and the
+ * result is computed with integer arithmetic only, so "1.5G" is exactly
+ * 1500000000 and there is no rounding through a double.
+ */
+
+/** Decimals kept in a quantity. Further digits are accepted but ignored. */
+#define UNIT_FRAC_DIGITS 9
+
+/** Longest unit name, without the terminator. */
+#define UNIT_NAME_MAX 3
+
+struct unit {
+	char name[UNIT_NAME_MAX + 1];
+	uint64_t scale;
+};
+
+#define KILO UINT64_C(1000)
+#define KIBI UINT64_C(1024)
+
+/* A trailing 'B' is removed before the lookup, so "KiB" matches "Ki" and
+ * "B" matches "". */
+static const struct unit size_units[] = {
+	{"", 1},
+	{"k", KILO}, {"K", KILO}, {"Ki", KIBI},
+	{"M", KILO*KILO}, {"Mi", KIBI*KIBI},
+	{"G", KILO*KILO*KILO}, {"Gi", KIBI*KIBI*KIBI},
+	{"T", KILO*KILO*KILO*KILO}, {"Ti", KIBI*KIBI*KIBI*KIBI},
+	{"P", KILO*KILO*KILO*KILO*KILO}, {"Pi", KIBI*KIBI*KIBI*KIBI*KIBI},
+	{"E", KILO*KILO*KILO*KILO*KILO*KILO},
+	{"Ei", KIBI*KIBI*KIBI*KIBI*KIBI*KIBI},
+};
+
+#define SECOND (KILO*KILO*KILO)
+
+/* The first entry is used for numbers without a unit. */
+static const struct unit duration_units[] = {
+	{"s", SECOND}, {"ns", 1}, {"us", KILO}, {"ms", KILO*KILO},
+	{"m", 60*SECOND}, {"h", 60*60*SECOND}, {"d", 24*60*60*SECOND},
+};
+
+#define N_UNITS(table) (sizeof(table) / sizeof(*(table)))
+
+/**
+ * A decimal number split into an integer part and a fraction
+ * frac/frac_div.
+ */
+struct fixed {
+	uint64_t integer;
+	uint64_t frac;
+	uint64_t frac_div;
+};
+
+/**
+ * Read a decimal number with an optional fractional part.
+ *
+ * @return  -1 if there are no digits, 1 if the integer part overflows,
+ *          else 0.
+ */
+static int read_fixed(const char **str, struct fixed *f)
+{
+	const char *s = *str;
+	unsigned int d;
+	int n_safe = 19, n_frac = UNIT_FRAC_DIGITS;
+	int ret = -1;
+
+	f->integer = 0;
+	f->frac = 0;
+	f->frac_div = 1;
+
+	for (; (d = (unsigned int)(unsigned char)*s - '0') <= 9; s++) {
+		if (n_safe-- <= 0 && f->integer > (UINT64_MAX - d) / 10) {
+			ret = 1;
+		}
+		f->integer = f->integer * 10 + d;
+		if (ret < 0) {
+			ret = 0;
+		}
+	}
+
+	if (*s == '.') {
+		for (s++; (d = (unsigned int)(unsigned char)*s - '0') <= 9; s++) {
+			if (n_frac-- > 0) {
+				f->frac = f->frac * 10 + d;
+				f->frac_div *= 10;
+			}
+			if (ret < 0) {
+				ret = 0;
+			}
+		}
+	}
+
+	*str = s;
+
+	return ret;
+}
+
+/**
+ * Compute f * scale, truncating the fraction.
+ *
+ * @return  true if the result exceeds limit.
+ */
+static bool scale_fixed(const struct fixed *f, uint64_t scale, uint64_t limit,
+			uint64_t *value)
+{
+	uint64_t v, q, r;
+
+	if (f->integer > limit / scale) {
+		return true;
+	}
+
+	/* frac < frac_div <= 10^9 and r < frac_div, so frac * r fits. */
+	q = scale / f->frac_div;
+	r = scale % f->frac_div;
+	v = f->integer * scale;
+	v += f->frac * q + f->frac * r / f->frac_div;
+
+	*value = v;
+
+	return v > limit || v < f->integer * scale;
+}
+
+/**
+ * Read a unit name (a run of letters) and look it up in a table.
+ *
+ * @return  The unit, or NULL if it is not in the table.
+ */
+static const struct unit *read_unit(const char **str, const struct unit *table,
+				    size_t n_units, bool strip_b)
+{
+	const char *start = *str, *s = start;
+	size_t len, i;
+
+	while (((unsigned int)(unsigned char)*s | 0x20) - 'a' < 26) {
+		s++;
+	}
+	*str = s;
+
+	len = (size_t)(s - start);
+	if (strip_b && len > 0 && s[-1] == 'B') {
+		len--;
+	}
+
+	for (i = 0; len <= UNIT_NAME_MAX && i < n_units; i++) {
+		if (strncmp(table[i].name, start, len) == 0
+		    && table[i].name[len] == TERM) {
+			return table + i;
+		}
+	}
+
+	return NULL;
+}
+
+int optparse_conv_size(const char *str, uint64_t *value, const char **msg)
+{
+	bool negative = skip_sign(&str);
+	const struct unit *unit;
+	struct fixed f;
+	uint64_t v;
+	int ret = read_fixed(&str, &f);
+
+	if (ret < 0 || (unit = read_unit(&str, size_units, N_UNITS(size_units),
+					 true)) == NULL
+	    || *str != TERM) {
+		*msg = "Expected size (e.g. 64Ki, 1.5G)";
+		return -OPTPARSE_BADSYNTAX;
+	}
+
+	if (ret > 0 || scale_fixed(&f, unit->scale, UINT64_MAX, &v)
+	    || (negative && v != 0)) {
+		*msg = "Size out of range";
+		return -OPTPARSE_BADSYNTAX;
+	}
+
+	*value = v;
+
+	return OPTPARSE_OK;
+}
+
+int optparse_conv_duration(const char *str, int64_t *value, const char **msg)
+{
+	bool negative = skip_sign(&str);
+	uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : INT64_MAX;
+	uint64_t total = 0;
+	int n_parts = 0;
+
+	do {
+		const struct unit *unit;
+		struct fixed f;
+		uint64_t v;
+		int ret = read_fixed(&str, &f);
+
+		if (ret < 0) {
+			goto bad_syntax;
+		}
+
+		if (*str == TERM && n_parts == 0) {
+			/* A plain number is a number of seconds. */
+			unit = duration_units;
+		} else if ((unit = read_unit(&str, duration_units,
+					     N_UNITS(duration_units),
+					     false)) == NULL) {
+			goto bad_syntax;
+		}
+
+		if (ret > 0 || scale_fixed(&f, unit->scale, limit - total, &v)) {
+			*msg = "Duration out of range";
+			return -OPTPARSE_BADSYNTAX;
+		}
+
+		total += v;
+		n_parts++;
+	} while (*str != TERM);
+
+	*value = negative ? ((total == 0) ? 0 : -(int64_t)(total - 1) - 1)
+			  : (int64_t)total;
+
+	return OPTPARSE_OK;
+
+bad_syntax:
+	*msg = "Expected duration (e.g. 250ms, 1h30m)";
+	return -OPTPARSE_BADSYNTAX;
+}
+
+/*
+ * Real number conversion.
+ *
+ * Short numbers that can be represented exactly are converted with a
+ * single floating point operation (Clinger's fast path). Numbers with up to
+ * 19 significant digits are converted by multiplying them by a 128 bit
+ * approximation of the power of ten (the Eisel-Lemire algorithm), which
+ * also handles longer numbers when their first 19 digits decide the
+ * result. The few cases left (results that are too close to halfway
+ * between two numbers, denormals and overflows) go through an exact
+ * decimal representation that is scaled by powers of two until the binary
+ * mantissa can be read off it (the "simple decimal conversion" algorithm).
+ * All paths are correctly rounded and none depends on the locale.
+ *
+ * This assumes IEEE-754 float and double.
+ */
+
+#ifndef OPTPARSE_FLOAT_DIGITS
+/**
+ * Number of significant digits kept when converting real numbers.
+ *
+ * Longer inputs are still rounded correctly as long as this is at least 800
+ * (768 digits are enough to tell apart any two doubles). Smaller values save
+ * stack space at the cost of some rare halfway cases. The digits are only
+ * on the stack while the slow path runs.
+ */
+#define OPTPARSE_FLOAT_DIGITS 800
+#endif
+
+/** Significant digits that fit in the 64 bit mantissa of the fast paths. */
+#define REAL_DIGITS 19
+
+/** Maximum shift applied to a decimal in one step. */
+#define DECIMAL_MAX_SHIFT 60
+
+/** Extra room for the digits added by a left shift before trimming. */
+#define DECIMAL_HEADROOM 20
+
+/**
+ * A real number as read by read_real(): w * 10^q.
+ *
+ * Only the first REAL_DIGITS significant digits are kept in w. If nonzero
+ * digits follow them, trunc is set and the number is between w * 10^q and
+ * (w + 1) * 10^q.
+ */
+struct real {
+	uint64_t w;     /**< Significant digits. */
+	int q;          /**< Power of ten of the last digit of w. */
+	bool trunc;     /**< Nonzero digits were dropped after w. */
+};
+
+/**
+ * Arbitrary precision decimal number: 0.d[0]d[1]...d[nd-1] * 10^dp
+ *
+ * Digits are stored as values (0-9), not characters. It is only used by
+ * the slow path.
+ */
+struct decimal {
+	unsigned char d[OPTPARSE_FLOAT_DIGITS + DECIMAL_HEADROOM];
+	int nd;         /**< Number of digits in use. */
+	int dp;         /**< Position of the decimal point. */
+	bool trunc;     /**< Nonzero digits were dropped after d[nd-1]. */
+};
+
+/**
+ * Description of a binary floating point format.
+ */
+struct float_format {
+	int mant_bits;  /**< Explicit mantissa bits. */
+	int exp_bits;   /**< Exponent bits. */
+	int bias;       /**< Exponent bias (negative). */
+};
+
+static const struct float_format float32_format = {23, 8, -127};
+static const struct float_format float64_format = {52, 11, -1023};
+
+/**
+ * Remove trailing zeros.
+ */
+static void decimal_trim(struct decimal *a)
+{
+	while (a->nd > 0 && a->d[a->nd - 1] == 0) {
+		a->nd--;
+	}
+
+	if (a->nd == 0) {
+		a->dp = 0;
+	}
+}
+
+/**
+ * Multiply by 2^k, with k <= DECIMAL_MAX_SHIFT.
+ */
+static void decimal_left_shift(struct decimal *a, unsigned int k)
+{
+	/* Upper bound of the number of new digits: 78/256 > log10(2) */
+	int max_delta = (int)((k * 78) >> 8) + 1;
+	int r = a->nd, w = a->nd + max_delta, delta;
+	uint64_t n = 0;
+
+	while (r-- > 0) {
+		n += (uint64_t)a->d[r] << k;
+		a->d[--w] = (unsigned char)(n % 10);
+		n /= 10;
+	}
+
+	while (n > 0) {
+		a->d[--w] = (unsigned char)(n % 10);
+		n /= 10;
+	}
+
+	/* w is now the number of slots left unused at the start. */
+	delta = max_delta - w;
+	memmove(a->d, a->d + w, (size_t)(a->nd + delta));
+	a->nd += delta;
+	a->dp += delta;
+
+	if (a->nd > OPTPARSE_FLOAT_DIGITS) {
+		for (r = OPTPARSE_FLOAT_DIGITS; r < a->nd; r++) {
+			a->trunc = a->trunc || a->d[r] != 0;
+		}
+		a->nd = OPTPARSE_FLOAT_DIGITS;
+	}
+
+	decimal_trim(a);
+}
+
+/**
+ * Divide by 2^k, with k <= DECIMAL_MAX_SHIFT.
+ */
+static void decimal_right_shift(struct decimal *a, unsigned int k)
+{
+	int r = 0, w = 0;
+	uint64_t n = 0, mask = ((uint64_t)1 << k) - 1;
+
+	/* Read enough leading digits to get a nonzero first digit. */
+	for (; (n >> k) == 0; r++) {
+		if (r >= a->nd) {
+			if (n == 0) {
+				a->nd = 0;
+				return;
+			}
+			while ((n >> k) == 0) {
+				n *= 10;
+				r++;
+			}
+			break;
+		}
+		n = n * 10 + a->d[r];
+	}
+	a->dp -= r - 1;
+
+	for (; r < a->nd; r++) {
+		a->d[w++] = (unsigned char)(n >> k);
+		n = (n & mask) * 10 + a->d[r];
+	}
+
+	while (n > 0) {
+		unsigned char digit = (unsigned char)(n >> k);
+
+		n = (n & mask) * 10;
+		if (w < OPTPARSE_FLOAT_DIGITS) {
+			a->d[w++] = digit;
+		} else if (digit > 0) {
+			a->trunc = true;
+		}
+	}
+
+	a->nd = w;
+	decimal_trim(a);
+}
+
+/**
+ * Multiply by 2^k (k > 0) or divide by 2^-k (k < 0).
+ */
+static void decimal_shift(struct decimal *a, int k)
+{
+	if (a->nd == 0) {
+		return;
+	}
+
+	for (; k > DECIMAL_MAX_SHIFT; k -= DECIMAL_MAX_SHIFT) {
+		decimal_left_shift(a, DECIMAL_MAX_SHIFT);
+	}
+	if (k > 0) {
+		decimal_left_shift(a, (unsigned int)k);
+	}
+
+	for (; k < -DECIMAL_MAX_SHIFT; k += DECIMAL_MAX_SHIFT) {
+		decimal_right_shift(a, DECIMAL_MAX_SHIFT);
+	}
+	if (k < 0) {
+		decimal_right_shift(a, (unsigned int)-k);
+	}
+}
+
+/**
+ * Return true if rounding to nd digits should round up (half to even).
+ */
+static bool decimal_round_up(const struct decimal *a, int nd)
+{
+	if (nd < 0 || nd >= a->nd) {
+		return false;
+	}
+
+	if (a->d[nd] == 5 && nd + 1 == a->nd) {
+		/* Exactly halfway, unless digits were dropped. */
+		return a->trunc || (nd > 0 && (a->d[nd - 1] & 1));
+	}
+
+	return a->d[nd] >= 5;
+}
+
+/**
+ * Get the integer part, rounded. The decimal must be less than 2^64.
+ */
+static uint64_t decimal_rounded_integer(const struct decimal *a)
+{
+	uint64_t n = 0;
+	int i;
+
+	for (i = 0; i < a->dp && i < a->nd; i++) {
+		n = n * 10 + a->d[i];
+	}
+	for (; i < a->dp; i++) {
+		n *= 10;
+	}
+
+	return n + decimal_round_up(a, a->dp);
+}
+
+/**
+ * Convert a decimal to the bits of a floating point number (without sign).
+ *
+ * @return  true on overflow (the result is then infinity).
+ */
+static bool decimal_to_bits(struct decimal *a, const struct float_format *fmt,
+			    uint64_t *bits)
+{
+	/* Number of bits to shift by to take a decimal point position down
+	 * to zero, indexed by dp. */
+	static const unsigned char powtab[] = {1, 3, 6, 9, 13, 16, 19, 23, 26};
+	int max_exp = (1 << fmt->exp_bits) - 1;
+	int exp = 0;
+	uint64_t mant;
+
+	if (a->nd == 0 || a->dp < -330) {
+		*bits = 0;
+		return false;
+	}
+
+	if (a->dp > 310) {
+		goto overflow;
+	}
+
+	/* Scale to [0.5, 1) */
+	while (a->dp > 0) {
+		int n = (a->dp >= (int)sizeof(powtab)) ? 27 : powtab[a->dp];
+
+		decimal_shift(a, -n);
+		exp += n;
+	}
+	while (a->dp < 0 || (a->dp == 0 && a->d[0] < 5)) {
+		int n = (-a->dp >= (int)sizeof(powtab)) ? 27 : powtab[-a->dp];
+
+		decimal_shift(a, n);
+		exp -= n;
+	}
+
+	/* The range of the mantissa is [1, 2) */
+	exp--;
+
+	/* Denormals. */
+	if (exp < fmt->bias + 1) {
+		int n = fmt->bias + 1 - exp;
+
+		decimal_shift(a, -n);
+		exp += n;
+	}
+
+	if (exp - fmt->bias >= max_exp) {
+		goto overflow;
+	}
+
+	decimal_shift(a, 1 + fmt->mant_bits);
+	mant = decimal_rounded_integer(a);
+
+	/* Rounding may have carried into a new bit. */
+	if (mant == (uint64_t)2 << fmt->mant_bits) {
+		mant >>= 1;
+		exp++;
+		if (exp - fmt->bias >= max_exp) {
+			goto overflow;
+		}
+	}
+
+	if (!(mant & ((uint64_t)1 << fmt->mant_bits))) {
+		exp = fmt->bias;
+	}
+
+	*bits = (mant & (((uint64_t)1 << fmt->mant_bits) - 1))
+		| (uint64_t)(exp - fmt->bias) << fmt->mant_bits;
+	return false;
+
+overflow:
+	*bits = (uint64_t)max_exp << fmt->mant_bits;
+	return true;
+}
+
+/** Smallest power of ten in pow10_128. Below it, a number with
+ * REAL_DIGITS digits is a double denormal at most. */
+#define POW10_MIN (-326)
+/** Largest power of ten in pow10_128. Above it, any number overflows. */
+#define POW10_MAX 308
+
+/**
+ * The 128 most significant bits of the powers of ten from 10^POW10_MIN to
+ * 10^POW10_MAX, rounded down. The most significant word comes first.
+ */
+static const uint64_t pow10_128[][2] = {
+	{0x84a57695fe98746d, 0x014bb630f7604b57},
+	{0xa5ced43b7e3e9188, 0x419ea3bd35385e2d},
+	{0xcf42894a5dce35ea, 0x52064cac828675b9},
+	{0x818995ce7aa0e1b2, 0x7343efebd1940993},
+	{0xa1ebfb4219491a1f, 0x1014ebe6c5f90bf8},
+	{0xca66fa129f9b60a6, 0xd41a26e077774ef6},
+	{0xfd00b897478238d0, 0x8920b098955522b4},
+	{0x9e20735e8cb16382, 0x55b46e5f5d5535b0},
+	{0xc5a890362fddbc62, 0xeb2189f734aa831d},
+	{0xf712b443bbd52b7b, 0xa5e9ec7501d523e4},
+	{0x9a6bb0aa55653b2d, 0x47b233c92125366e},
+	{0xc1069cd4eabe89f8, 0x999ec0bb696e840a},
+	{0xf148440a256e2c76, 0xc00670ea43ca250d},
+	{0x96cd2a865764dbca, 0x380406926a5e5728},
+	{0xbc807527ed3e12bc, 0xc605083704f5ecf2},
+	{0xeba09271e88d976b, 0xf7864a44c633682e},
+	{0x93445b8731587ea3, 0x7ab3ee6afbe0211d},
+	{0xb8157268fdae9e4c, 0x5960ea05bad82964},
+	{0xe61acf033d1a45df, 0x6fb92487298e33bd},
+	{0x8fd0c16206306bab, 0xa5d3b6d479f8e056},
+	{0xb3c4f1ba87bc8696, 0x8f48a4899877186c},
+	{0xe0b62e2929aba83c, 0x331acdabfe94de87},
+	{0x8c71dcd9ba0b4925, 0x9ff0c08b7f1d0b14},
+	{0xaf8e5410288e1b6f, 0x07ecf0ae5ee44dd9},
+	{0xdb71e91432b1a24a, 0xc9e82cd9f69d6150},
+	{0x892731ac9faf056e, 0xbe311c083a225cd2},
+	{0xab70fe17c79ac6ca, 0x6dbd630a48aaf406},
+	{0xd64d3d9db981787d, 0x092cbbccdad5b108},
+	{0x85f0468293f0eb4e, 0x25bbf56008c58ea5},
+	{0xa76c582338ed2621, 0xaf2af2b80af6f24e},
+	{0xd1476e2c07286faa, 0x1af5af660db4aee1},
+	{0x82cca4db847945ca, 0x50d98d9fc890ed4d},
+	{0xa37fce126597973c, 0xe50ff107bab528a0},
+	{0xcc5fc196fefd7d0c, 0x1e53ed49a96272c8},
+	{0xff77b1fcbebcdc4f, 0x25e8e89c13bb0f7a},
+	{0x9faacf3df73609b1, 0x77b191618c54e9ac},
+	{0xc795830d75038c1d, 0xd59df5b9ef6a2417},
+	{0xf97ae3d0d2446f25, 0x4b0573286b44ad1d},
+	{0x9becce62836ac577, 0x4ee367f9430aec32},
+	{0xc2e801fb244576d5, 0x229c41f793cda73f},
+	{0xf3a20279ed56d48a, 0x6b43527578c1110f},
+	{0x9845418c345644d6, 0x830a13896b78aaa9},
+	{0xbe5691ef416bd60c, 0x23cc986bc656d553},
+	{0xedec366b11c6cb8f, 0x2cbfbe86b7ec8aa8},
+	{0x94b3a202eb1c3f39, 0x7bf7d71432f3d6a9},
+	{0xb9e08a83a5e34f07, 0xdaf5ccd93fb0cc53},
+	{0xe858ad248f5c22c9, 0xd1b3400f8f9cff68},
+	{0x91376c36d99995be, 0x23100809b9c21fa1},
+	{0xb58547448ffffb2d, 0xabd40a0c2832a78a},
+	{0xe2e69915b3fff9f9, 0x16c90c8f323f516c},
+	{0x8dd01fad907ffc3b, 0xae3da7d97f6792e3},
+	{0xb1442798f49ffb4a, 0x99cd11cfdf41779c},
+	{0xdd95317f31c7fa1d, 0x40405643d711d583},
+	{0x8a7d3eef7f1cfc52, 0x482835ea666b2572},
+	{0xad1c8eab5ee43b66, 0xda3243650005eecf},
+	{0xd863b256369d4a40, 0x90bed43e40076a82},
+	{0x873e4f75e2224e68, 0x5a7744a6e804a291},
+	{0xa90de3535aaae202, 0x711515d0a205cb36},
+	{0xd3515c2831559a83, 0x0d5a5b44ca873e03},
+	{0x8412d9991ed58091, 0xe858790afe9486c2},
+	{0xa5178fff668ae0b6, 0x626e974dbe39a872},
+	{0xce5d73ff402d98e3, 0xfb0a3d212dc8128f},
+	{0x80fa687f881c7f8e, 0x7ce66634bc9d0b99},
+	{0xa139029f6a239f72, 0x1c1fffc1ebc44e80},
+	{0xc987434744ac874e, 0xa327ffb266b56220},
+	{0xfbe9141915d7a922, 0x4bf1ff9f0062baa8},
+	{0x9d71ac8fada6c9b5, 0x6f773fc3603db4a9},
+	{0xc4ce17b399107c22, 0xcb550fb4384d21d3},
+	{0xf6019da07f549b2b, 0x7e2a53a146606a48},
+	{0x99c102844f94e0fb, 0x2eda7444cbfc426d},
+	{0xc0314325637a1939, 0xfa911155fefb5308},
+	{0xf03d93eebc589f88, 0x793555ab7eba27ca},
+	{0x96267c7535b763b5, 0x4bc1558b2f3458de},
+	{0xbbb01b9283253ca2, 0x9eb1aaedfb016f16},
+	{0xea9c227723ee8bcb, 0x465e15a979c1cadc},
+	{0x92a1958a7675175f, 0x0bfacd89ec191ec9},
+	{0xb749faed14125d36, 0xcef980ec671f667b},
+	{0xe51c79a85916f484, 0x82b7e12780e7401a},
+	{0x8f31cc0937ae58d2, 0xd1b2ecb8b0908810},
+	{0xb2fe3f0b8599ef07, 0x861fa7e6dcb4aa15},
+	{0xdfbdcece67006ac9, 0x67a791e093e1d49a},
+	{0x8bd6a141006042bd, 0xe0c8bb2c5c6d24e0},
+	{0xaecc49914078536d, 0x58fae9f773886e18},
+	{0xda7f5bf590966848, 0xaf39a475506a899e},
+	{0x888f99797a5e012d, 0x6d8406c952429603},
+	{0xaab37fd7d8f58178, 0xc8e5087ba6d33b83},
+	{0xd5605fcdcf32e1d6, 0xfb1e4a9a90880a64},
+	{0x855c3be0a17fcd26, 0x5cf2eea09a55067f},
+	{0xa6b34ad8c9dfc06f, 0xf42faa48c0ea481e},
+	{0xd0601d8efc57b08b, 0xf13b94daf124da26},
+	{0x823c12795db6ce57, 0x76c53d08d6b70858},
+	{0xa2cb1717b52481ed, 0x54768c4b0c64ca6e},
+	{0xcb7ddcdda26da268, 0xa9942f5dcf7dfd09},
+	{0xfe5d54150b090b02, 0xd3f93b35435d7c4c},
+	{0x9efa548d26e5a6e1, 0xc47bc5014a1a6daf},
+	{0xc6b8e9b0709f109a, 0x359ab6419ca1091b},
+	{0xf867241c8cc6d4c0, 0xc30163d203c94b62},
+	{0x9b407691d7fc44f8, 0x79e0de63425dcf1d},
+	{0xc21094364dfb5636, 0x985915fc12f542e4},
+	{0xf294b943e17a2bc4, 0x3e6f5b7b17b2939d},
+	{0x979cf3ca6cec5b5a, 0xa705992ceecf9c42},
+	{0xbd8430bd08277231, 0x50c6ff782a838353},
+	{0xece53cec4a314ebd, 0xa4f8bf5635246428},
+	{0x940f4613ae5ed136, 0x871b7795e136be99},
+	{0xb913179899f68584, 0x28e2557b59846e3f},
+	{0xe757dd7ec07426e5, 0x331aeada2fe589cf},
+	{0x9096ea6f3848984f, 0x3ff0d2c85def7621},
+	{0xb4bca50b065abe63, 0x0fed077a756b53a9},
+	{0xe1ebce4dc7f16dfb, 0xd3e8495912c62894},
+	{0x8d3360f09cf6e4bd, 0x64712dd7abbbd95c},
+	{0xb080392cc4349dec, 0xbd8d794d96aacfb3},
+	{0xdca04777f541c567, 0xecf0d7a0fc5583a0},
+	{0x89e42caaf9491b60, 0xf41686c49db57244},
+	{0xac5d37d5b79b6239, 0x311c2875c522ced5},
+	{0xd77485cb25823ac7, 0x7d633293366b828b},
+	{0x86a8d39ef77164bc, 0xae5dff9c02033197},
+	{0xa8530886b54dbdeb, 0xd9f57f830283fdfc},
+	{0xd267caa862a12d66, 0xd072df63c324fd7b},
+	{0x8380dea93da4bc60, 0x4247cb9e59f71e6d},
+	{0xa46116538d0deb78, 0x52d9be85f074e608},
+	{0xcd795be870516656, 0x67902e276c921f8b},
+	{0x806bd9714632dff6, 0x00ba1cd8a3db53b6},
+	{0xa086cfcd97bf97f3, 0x80e8a40eccd228a4},
+	{0xc8a883c0fdaf7df0, 0x6122cd128006b2cd},
+	{0xfad2a4b13d1b5d6c, 0x796b805720085f81},
+	{0x9cc3a6eec6311a63, 0xcbe3303674053bb0},
+	{0xc3f490aa77bd60fc, 0xbedbfc4411068a9c},
+	{0xf4f1b4d515acb93b, 0xee92fb5515482d44},
+	{0x991711052d8bf3c5, 0x751bdd152d4d1c4a},
+	{0xbf5cd54678eef0b6, 0xd262d45a78a0635d},
+	{0xef340a98172aace4, 0x86fb897116c87c34},
+	{0x9580869f0e7aac0e, 0xd45d35e6ae3d4da0},
+	{0xbae0a846d2195712, 0x8974836059cca109},
+	{0xe998d258869facd7, 0x2bd1a438703fc94b},
+	{0x91ff83775423cc06, 0x7b6306a34627ddcf},
+	{0xb67f6455292cbf08, 0x1a3bc84c17b1d542},
+	{0xe41f3d6a7377eeca, 0x20caba5f1d9e4a93},
+	{0x8e938662882af53e, 0x547eb47b7282ee9c},
+	{0xb23867fb2a35b28d, 0xe99e619a4f23aa43},
+	{0xdec681f9f4c31f31, 0x6405fa00e2ec94d4},
+	{0x8b3c113c38f9f37e, 0xde83bc408dd3dd04},
+	{0xae0b158b4738705e, 0x9624ab50b148d445},
+	{0xd98ddaee19068c76, 0x3badd624dd9b0957},
+	{0x87f8a8d4cfa417c9, 0xe54ca5d70a80e5d6},
+	{0xa9f6d30a038d1dbc, 0x5e9fcf4ccd211f4c},
+	{0xd47487cc8470652b, 0x7647c3200069671f},
+	{0x84c8d4dfd2c63f3b, 0x29ecd9f40041e073},
+	{0xa5fb0a17c777cf09, 0xf468107100525890},
+	{0xcf79cc9db955c2cc, 0x7182148d4066eeb4},
+	{0x81ac1fe293d599bf, 0xc6f14cd848405530},
+	{0xa21727db38cb002f, 0xb8ada00e5a506a7c},
+	{0xca9cf1d206fdc03b, 0xa6d90811f0e4851c},
+	{0xfd442e4688bd304a, 0x908f4a166d1da663},
+	{0x9e4a9cec15763e2e, 0x9a598e4e043287fe},
+	{0xc5dd44271ad3cdba, 0x40eff1e1853f29fd},
+	{0xf7549530e188c128, 0xd12bee59e68ef47c},
+	{0x9a94dd3e8cf578b9, 0x82bb74f8301958ce},
+	{0xc13a148e3032d6e7, 0xe36a52363c1faf01},
+	{0xf18899b1bc3f8ca1, 0xdc44e6c3cb279ac1},
+	{0x96f5600f15a7b7e5, 0x29ab103a5ef8c0b9},
+	{0xbcb2b812db11a5de, 0x7415d448f6b6f0e7},
+	{0xebdf661791d60f56, 0x111b495b3464ad21},
+	{0x936b9fcebb25c995, 0xcab10dd900beec34},
+	{0xb84687c269ef3bfb, 0x3d5d514f40eea742},
+	{0xe65829b3046b0afa, 0x0cb4a5a3112a5112},
+	{0x8ff71a0fe2c2e6dc, 0x47f0e785eaba72ab},
+	{0xb3f4e093db73a093, 0x59ed216765690f56},
+	{0xe0f218b8d25088b8, 0x306869c13ec3532c},
+	{0x8c974f7383725573, 0x1e414218c73a13fb},
+	{0xafbd2350644eeacf, 0xe5d1929ef90898fa},
+	{0xdbac6c247d62a583, 0xdf45f746b74abf39},
+	{0x894bc396ce5da772, 0x6b8bba8c328eb783},
+	{0xab9eb47c81f5114f, 0x066ea92f3f326564},
+	{0xd686619ba27255a2, 0xc80a537b0efefebd},
+	{0x8613fd0145877585, 0xbd06742ce95f5f36},
+	{0xa798fc4196e952e7, 0x2c48113823b73704},
+	{0xd17f3b51fca3a7a0, 0xf75a15862ca504c5},
+	{0x82ef85133de648c4, 0x9a984d73dbe722fb},
+	{0xa3ab66580d5fdaf5, 0xc13e60d0d2e0ebba},
+	{0xcc963fee10b7d1b3, 0x318df905079926a8},
+	{0xffbbcfe994e5c61f, 0xfdf17746497f7052},
+	{0x9fd561f1fd0f9bd3, 0xfeb6ea8bedefa633},
+	{0xc7caba6e7c5382c8, 0xfe64a52ee96b8fc0},
+	{0xf9bd690a1b68637b, 0x3dfdce7aa3c673b0},
+	{0x9c1661a651213e2d, 0x06bea10ca65c084e},
+	{0xc31bfa0fe5698db8, 0x486e494fcff30a62},
+	{0xf3e2f893dec3f126, 0x5a89dba3c3efccfa},
+	{0x986ddb5c6b3a76b7, 0xf89629465a75e01c},
+	{0xbe89523386091465, 0xf6bbb397f1135823},
+	{0xee2ba6c0678b597f, 0x746aa07ded582e2c},
+	{0x94db483840b717ef, 0xa8c2a44eb4571cdc},
+	{0xba121a4650e4ddeb, 0x92f34d62616ce413},
+	{0xe896a0d7e51e1566, 0x77b020baf9c81d17},
+	{0x915e2486ef32cd60, 0x0ace1474dc1d122e},
+	{0xb5b5ada8aaff80b8, 0x0d819992132456ba},
+	{0xe3231912d5bf60e6, 0x10e1fff697ed6c69},
+	{0x8df5efabc5979c8f, 0xca8d3ffa1ef463c1},
+	{0xb1736b96b6fd83b3, 0xbd308ff8a6b17cb2},
+	{0xddd0467c64bce4a0, 0xac7cb3f6d05ddbde},
+	{0x8aa22c0dbef60ee4, 0x6bcdf07a423aa96b},
+	{0xad4ab7112eb3929d, 0x86c16c98d2c953c6},
+	{0xd89d64d57a607744, 0xe871c7bf077ba8b7},
+	{0x87625f056c7c4a8b, 0x11471cd764ad4972},
+	{0xa93af6c6c79b5d2d, 0xd598e40d3dd89bcf},
+	{0xd389b47879823479, 0x4aff1d108d4ec2c3},
+	{0x843610cb4bf160cb, 0xcedf722a585139ba},
+	{0xa54394fe1eedb8fe, 0xc2974eb4ee658828},
+	{0xce947a3da6a9273e, 0x733d226229feea32},
+	{0x811ccc668829b887, 0x0806357d5a3f525f},
+	{0xa163ff802a3426a8, 0xca07c2dcb0cf26f7},
+	{0xc9bcff6034c13052, 0xfc89b393dd02f0b5},
+	{0xfc2c3f3841f17c67, 0xbbac2078d443ace2},
+	{0x9d9ba7832936edc0, 0xd54b944b84aa4c0d},
+	{0xc5029163f384a931, 0x0a9e795e65d4df11},
+	{0xf64335bcf065d37d, 0x4d4617b5ff4a16d5},
+	{0x99ea0196163fa42e, 0x504bced1bf8e4e45},
+	{0xc06481fb9bcf8d39, 0xe45ec2862f71e1d6},
+	{0xf07da27a82c37088, 0x5d767327bb4e5a4c},
+	{0x964e858c91ba2655, 0x3a6a07f8d510f86f},
+	{0xbbe226efb628afea, 0x890489f70a55368b},
+	{0xeadab0aba3b2dbe5, 0x2b45ac74ccea842e},
+	{0x92c8ae6b464fc96f, 0x3b0b8bc90012929d},
+	{0xb77ada0617e3bbcb, 0x09ce6ebb40173744},
+	{0xe55990879ddcaabd, 0xcc420a6a101d0515},
+	{0x8f57fa54c2a9eab6, 0x9fa946824a12232d},
+	{0xb32df8e9f3546564, 0x47939822dc96abf9},
+	{0xdff9772470297ebd, 0x59787e2b93bc56f7},
+	{0x8bfbea76c619ef36, 0x57eb4edb3c55b65a},
+	{0xaefae51477a06b03, 0xede622920b6b23f1},
+	{0xdab99e59958885c4, 0xe95fab368e45eced},
+	{0x88b402f7fd75539b, 0x11dbcb0218ebb414},
+	{0xaae103b5fcd2a881, 0xd652bdc29f26a119},
+	{0xd59944a37c0752a2, 0x4be76d3346f0495f},
+	{0x857fcae62d8493a5, 0x6f70a4400c562ddb},
+	{0xa6dfbd9fb8e5b88e, 0xcb4ccd500f6bb952},
+	{0xd097ad07a71f26b2, 0x7e2000a41346a7a7},
+	{0x825ecc24c873782f, 0x8ed400668c0c28c8},
+	{0xa2f67f2dfa90563b, 0x728900802f0f32fa},
+	{0xcbb41ef979346bca, 0x4f2b40a03ad2ffb9},
+	{0xfea126b7d78186bc, 0xe2f610c84987bfa8},
+	{0x9f24b832e6b0f436, 0x0dd9ca7d2df4d7c9},
+	{0xc6ede63fa05d3143, 0x91503d1c79720dbb},
+	{0xf8a95fcf88747d94, 0x75a44c6397ce912a},
+	{0x9b69dbe1b548ce7c, 0xc986afbe3ee11aba},
+	{0xc24452da229b021b, 0xfbe85badce996168},
+	{0xf2d56790ab41c2a2, 0xfae27299423fb9c3},
+	{0x97c560ba6b0919a5, 0xdccd879fc967d41a},
+	{0xbdb6b8e905cb600f, 0x5400e987bbc1c920},
+	{0xed246723473e3813, 0x290123e9aab23b68},
+	{0x9436c0760c86e30b, 0xf9a0b6720aaf6521},
+	{0xb94470938fa89bce, 0xf808e40e8d5b3e69},
+	{0xe7958cb87392c2c2, 0xb60b1d1230b20e04},
+	{0x90bd77f3483bb9b9, 0xb1c6f22b5e6f48c2},
+	{0xb4ecd5f01a4aa828, 0x1e38aeb6360b1af3},
+	{0xe2280b6c20dd5232, 0x25c6da63c38de1b0},
+	{0x8d590723948a535f, 0x579c487e5a38ad0e},
+	{0xb0af48ec79ace837, 0x2d835a9df0c6d851},
+	{0xdcdb1b2798182244, 0xf8e431456cf88e65},
+	{0x8a08f0f8bf0f156b, 0x1b8e9ecb641b58ff},
+	{0xac8b2d36eed2dac5, 0xe272467e3d222f3f},
+	{0xd7adf884aa879177, 0x5b0ed81dcc6abb0f},
+	{0x86ccbb52ea94baea, 0x98e947129fc2b4e9},
+	{0xa87fea27a539e9a5, 0x3f2398d747b36224},
+	{0xd29fe4b18e88640e, 0x8eec7f0d19a03aad},
+	{0x83a3eeeef9153e89, 0x1953cf68300424ac},
+	{0xa48ceaaab75a8e2b, 0x5fa8c3423c052dd7},
+	{0xcdb02555653131b6, 0x3792f412cb06794d},
+	{0x808e17555f3ebf11, 0xe2bbd88bbee40bd0},
+	{0xa0b19d2ab70e6ed6, 0x5b6aceaeae9d0ec4},
+	{0xc8de047564d20a8b, 0xf245825a5a445275},
+	{0xfb158592be068d2e, 0xeed6e2f0f0d56712},
+	{0x9ced737bb6c4183d, 0x55464dd69685606b},
+	{0xc428d05aa4751e4c, 0xaa97e14c3c26b886},
+	{0xf53304714d9265df, 0xd53dd99f4b3066a8},
+	{0x993fe2c6d07b7fab, 0xe546a8038efe4029},
+	{0xbf8fdb78849a5f96, 0xde98520472bdd033},
+	{0xef73d256a5c0f77c, 0x963e66858f6d4440},
+	{0x95a8637627989aad, 0xdde7001379a44aa8},
+	{0xbb127c53b17ec159, 0x5560c018580d5d52},
+	{0xe9d71b689dde71af, 0xaab8f01e6e10b4a6},
+	{0x9226712162ab070d, 0xcab3961304ca70e8},
+	{0xb6b00d69bb55c8d1, 0x3d607b97c5fd0d22},
+	{0xe45c10c42a2b3b05, 0x8cb89a7db77c506a},
+	{0x8eb98a7a9a5b04e3, 0x77f3608e92adb242},
+	{0xb267ed1940f1c61c, 0x55f038b237591ed3},
+	{0xdf01e85f912e37a3, 0x6b6c46dec52f6688},
+	{0x8b61313bbabce2c6, 0x2323ac4b3b3da015},
+	{0xae397d8aa96c1b77, 0xabec975e0a0d081a},
+	{0xd9c7dced53c72255, 0x96e7bd358c904a21},
+	{0x881cea14545c7575, 0x7e50d64177da2e54},
+	{0xaa242499697392d2, 0xdde50bd1d5d0b9e9},
+	{0xd4ad2dbfc3d07787, 0x955e4ec64b44e864},
+	{0x84ec3c97da624ab4, 0xbd5af13bef0b113e},
+	{0xa6274bbdd0fadd61, 0xecb1ad8aeacdd58e},
+	{0xcfb11ead453994ba, 0x67de18eda5814af2},
+	{0x81ceb32c4b43fcf4, 0x80eacf948770ced7},
+	{0xa2425ff75e14fc31, 0xa1258379a94d028d},
+	{0xcad2f7f5359a3b3e, 0x096ee45813a04330},
+	{0xfd87b5f28300ca0d, 0x8bca9d6e188853fc},
+	{0x9e74d1b791e07e48, 0x775ea264cf55347d},
+	{0xc612062576589dda, 0x95364afe032a819d},
+	{0xf79687aed3eec551, 0x3a83ddbd83f52204},
+	{0x9abe14cd44753b52, 0xc4926a9672793542},
+	{0xc16d9a0095928a27, 0x75b7053c0f178293},
+	{0xf1c90080baf72cb1, 0x5324c68b12dd6338},
+	{0x971da05074da7bee, 0xd3f6fc16ebca5e03},
+	{0xbce5086492111aea, 0x88f4bb1ca6bcf584},
+	{0xec1e4a7db69561a5, 0x2b31e9e3d06c32e5},
+	{0x9392ee8e921d5d07, 0x3aff322e62439fcf},
+	{0xb877aa3236a4b449, 0x09befeb9fad487c2},
+	{0xe69594bec44de15b, 0x4c2ebe687989a9b3},
+	{0x901d7cf73ab0acd9, 0x0f9d37014bf60a10},
+	{0xb424dc35095cd80f, 0x538484c19ef38c94},
+	{0xe12e13424bb40e13, 0x2865a5f206b06fb9},
+	{0x8cbccc096f5088cb, 0xf93f87b7442e45d3},
+	{0xafebff0bcb24aafe, 0xf78f69a51539d748},
+	{0xdbe6fecebdedd5be, 0xb573440e5a884d1b},
+	{0x89705f4136b4a597, 0x31680a88f8953030},
+	{0xabcc77118461cefc, 0xfdc20d2b36ba7c3d},
+	{0xd6bf94d5e57a42bc, 0x3d32907604691b4c},
+	{0x8637bd05af6c69b5, 0xa63f9a49c2c1b10f},
+	{0xa7c5ac471b478423, 0x0fcf80dc33721d53},
+	{0xd1b71758e219652b, 0xd3c36113404ea4a8},
+	{0x83126e978d4fdf3b, 0x645a1cac083126e9},
+	{0xa3d70a3d70a3d70a, 0x3d70a3d70a3d70a3},
+	{0xcccccccccccccccc, 0xcccccccccccccccc},
+	{0x8000000000000000, 0x0000000000000000},
+	{0xa000000000000000, 0x0000000000000000},
+	{0xc800000000000000, 0x0000000000000000},
+	{0xfa00000000000000, 0x0000000000000000},
+	{0x9c40000000000000, 0x0000000000000000},
+	{0xc350000000000000, 0x0000000000000000},
+	{0xf424000000000000, 0x0000000000000000},
+	{0x9896800000000000, 0x0000000000000000},
+	{0xbebc200000000000, 0x0000000000000000},
+	{0xee6b280000000000, 0x0000000000000000},
+	{0x9502f90000000000, 0x0000000000000000},
+	{0xba43b74000000000, 0x0000000000000000},
+	{0xe8d4a51000000000, 0x0000000000000000},
+	{0x9184e72a00000000, 0x0000000000000000},
+	{0xb5e620f480000000, 0x0000000000000000},
+	{0xe35fa931a0000000, 0x0000000000000000},
+	{0x8e1bc9bf04000000, 0x0000000000000000},
+	{0xb1a2bc2ec5000000, 0x0000000000000000},
+	{0xde0b6b3a76400000, 0x0000000000000000},
+	{0x8ac7230489e80000, 0x0000000000000000},
+	{0xad78ebc5ac620000, 0x0000000000000000},
+	{0xd8d726b7177a8000, 0x0000000000000000},
+	{0x878678326eac9000, 0x0000000000000000},
+	{0xa968163f0a57b400, 0x0000000000000000},
+	{0xd3c21bcecceda100, 0x0000000000000000},
+	{0x84595161401484a0, 0x0000000000000000},
+	{0xa56fa5b99019a5c8, 0x0000000000000000},
+	{0xcecb8f27f4200f3a, 0x0000000000000000},
+	{0x813f3978f8940984, 0x4000000000000000},
+	{0xa18f07d736b90be5, 0x5000000000000000},
+	{0xc9f2c9cd04674ede, 0xa400000000000000},
+	{0xfc6f7c4045812296, 0x4d00000000000000},
+	{0x9dc5ada82b70b59d, 0xf020000000000000},
+	{0xc5371912364ce305, 0x6c28000000000000},
+	{0xf684df56c3e01bc6, 0xc732000000000000},
+	{0x9a130b963a6c115c, 0x3c7f400000000000},
+	{0xc097ce7bc90715b3, 0x4b9f100000000000},
+	{0xf0bdc21abb48db20, 0x1e86d40000000000},
+	{0x96769950b50d88f4, 0x1314448000000000},
+	{0xbc143fa4e250eb31, 0x17d955a000000000},
+	{0xeb194f8e1ae525fd, 0x5dcfab0800000000},
+	{0x92efd1b8d0cf37be, 0x5aa1cae500000000},
+	{0xb7abc627050305ad, 0xf14a3d9e40000000},
+	{0xe596b7b0c643c719, 0x6d9ccd05d0000000},
+	{0x8f7e32ce7bea5c6f, 0xe4820023a2000000},
+	{0xb35dbf821ae4f38b, 0xdda2802c8a800000},
+	{0xe0352f62a19e306e, 0xd50b2037ad200000},
+	{0x8c213d9da502de45, 0x4526f422cc340000},
+	{0xaf298d050e4395d6, 0x9670b12b7f410000},
+	{0xdaf3f04651d47b4c, 0x3c0cdd765f114000},
+	{0x88d8762bf324cd0f, 0xa5880a69fb6ac800},
+	{0xab0e93b6efee0053, 0x8eea0d047a457a00},
+	{0xd5d238a4abe98068, 0x72a4904598d6d880},
+	{0x85a36366eb71f041, 0x47a6da2b7f864750},
+	{0xa70c3c40a64e6c51, 0x999090b65f67d924},
+	{0xd0cf4b50cfe20765, 0xfff4b4e3f741cf6d},
+	{0x82818f1281ed449f, 0xbff8f10e7a8921a4},
+	{0xa321f2d7226895c7, 0xaff72d52192b6a0d},
+	{0xcbea6f8ceb02bb39, 0x9bf4f8a69f764490},
+	{0xfee50b7025c36a08, 0x02f236d04753d5b4},
+	{0x9f4f2726179a2245, 0x01d762422c946590},
+	{0xc722f0ef9d80aad6, 0x424d3ad2b7b97ef5},
+	{0xf8ebad2b84e0d58b, 0xd2e0898765a7deb2},
+	{0x9b934c3b330c8577, 0x63cc55f49f88eb2f},
+	{0xc2781f49ffcfa6d5, 0x3cbf6b71c76b25fb},
+	{0xf316271c7fc3908a, 0x8bef464e3945ef7a},
+	{0x97edd871cfda3a56, 0x97758bf0e3cbb5ac},
+	{0xbde94e8e43d0c8ec, 0x3d52eeed1cbea317},
+	{0xed63a231d4c4fb27, 0x4ca7aaa863ee4bdd},
+	{0x945e455f24fb1cf8, 0x8fe8caa93e74ef6a},
+	{0xb975d6b6ee39e436, 0xb3e2fd538e122b44},
+	{0xe7d34c64a9c85d44, 0x60dbbca87196b616},
+	{0x90e40fbeea1d3a4a, 0xbc8955e946fe31cd},
+	{0xb51d13aea4a488dd, 0x6babab6398bdbe41},
+	{0xe264589a4dcdab14, 0xc696963c7eed2dd1},
+	{0x8d7eb76070a08aec, 0xfc1e1de5cf543ca2},
+	{0xb0de65388cc8ada8, 0x3b25a55f43294bcb},
+	{0xdd15fe86affad912, 0x49ef0eb713f39ebe},
+	{0x8a2dbf142dfcc7ab, 0x6e3569326c784337},
+	{0xacb92ed9397bf996, 0x49c2c37f07965404},
+	{0xd7e77a8f87daf7fb, 0xdc33745ec97be906},
+	{0x86f0ac99b4e8dafd, 0x69a028bb3ded71a3},
+	{0xa8acd7c0222311bc, 0xc40832ea0d68ce0c},
+	{0xd2d80db02aabd62b, 0xf50a3fa490c30190},
+	{0x83c7088e1aab65db, 0x792667c6da79e0fa},
+	{0xa4b8cab1a1563f52, 0x577001b891185938},
+	{0xcde6fd5e09abcf26, 0xed4c0226b55e6f86},
+	{0x80b05e5ac60b6178, 0x544f8158315b05b4},
+	{0xa0dc75f1778e39d6, 0x696361ae3db1c721},
+	{0xc913936dd571c84c, 0x03bc3a19cd1e38e9},
+	{0xfb5878494ace3a5f, 0x04ab48a04065c723},
+	{0x9d174b2dcec0e47b, 0x62eb0d64283f9c76},
+	{0xc45d1df942711d9a, 0x3ba5d0bd324f8394},
+	{0xf5746577930d6500, 0xca8f44ec7ee36479},
+	{0x9968bf6abbe85f20, 0x7e998b13cf4e1ecb},
+	{0xbfc2ef456ae276e8, 0x9e3fedd8c321a67e},
+	{0xefb3ab16c59b14a2, 0xc5cfe94ef3ea101e},
+	{0x95d04aee3b80ece5, 0xbba1f1d158724a12},
+	{0xbb445da9ca61281f, 0x2a8a6e45ae8edc97},
+	{0xea1575143cf97226, 0xf52d09d71a3293bd},
+	{0x924d692ca61be758, 0x593c2626705f9c56},
+	{0xb6e0c377cfa2e12e, 0x6f8b2fb00c77836c},
+	{0xe498f455c38b997a, 0x0b6dfb9c0f956447},
+	{0x8edf98b59a373fec, 0x4724bd4189bd5eac},
+	{0xb2977ee300c50fe7, 0x58edec91ec2cb657},
+	{0xdf3d5e9bc0f653e1, 0x2f2967b66737e3ed},
+	{0x8b865b215899f46c, 0xbd79e0d20082ee74},
+	{0xae67f1e9aec07187, 0xecd8590680a3aa11},
+	{0xda01ee641a708de9, 0xe80e6f4820cc9495},
+	{0x884134fe908658b2, 0x3109058d147fdcdd},
+	{0xaa51823e34a7eede, 0xbd4b46f0599fd415},
+	{0xd4e5e2cdc1d1ea96, 0x6c9e18ac7007c91a},
+	{0x850fadc09923329e, 0x03e2cf6bc604ddb0},
+	{0xa6539930bf6bff45, 0x84db8346b786151c},
+	{0xcfe87f7cef46ff16, 0xe612641865679a63},
+	{0x81f14fae158c5f6e, 0x4fcb7e8f3f60c07e},
+	{0xa26da3999aef7749, 0xe3be5e330f38f09d},
+	{0xcb090c8001ab551c, 0x5cadf5bfd3072cc5},
+	{0xfdcb4fa002162a63, 0x73d9732fc7c8f7f6},
+	{0x9e9f11c4014dda7e, 0x2867e7fddcdd9afa},
+	{0xc646d63501a1511d, 0xb281e1fd541501b8},
+	{0xf7d88bc24209a565, 0x1f225a7ca91a4226},
+	{0x9ae757596946075f, 0x3375788de9b06958},
+	{0xc1a12d2fc3978937, 0x0052d6b1641c83ae},
+	{0xf209787bb47d6b84, 0xc0678c5dbd23a49a},
+	{0x9745eb4d50ce6332, 0xf840b7ba963646e0},
+	{0xbd176620a501fbff, 0xb650e5a93bc3d898},
+	{0xec5d3fa8ce427aff, 0xa3e51f138ab4cebe},
+	{0x93ba47c980e98cdf, 0xc66f336c36b10137},
+	{0xb8a8d9bbe123f017, 0xb80b0047445d4184},
+	{0xe6d3102ad96cec1d, 0xa60dc059157491e5},
+	{0x9043ea1ac7e41392, 0x87c89837ad68db2f},
+	{0xb454e4a179dd1877, 0x29babe4598c311fb},
+	{0xe16a1dc9d8545e94, 0xf4296dd6fef3d67a},
+	{0x8ce2529e2734bb1d, 0x1899e4a65f58660c},
+	{0xb01ae745b101e9e4, 0x5ec05dcff72e7f8f},
+	{0xdc21a1171d42645d, 0x76707543f4fa1f73},
+	{0x899504ae72497eba, 0x6a06494a791c53a8},
+	{0xabfa45da0edbde69, 0x0487db9d17636892},
+	{0xd6f8d7509292d603, 0x45a9d2845d3c42b6},
+	{0x865b86925b9bc5c2, 0x0b8a2392ba45a9b2},
+	{0xa7f26836f282b732, 0x8e6cac7768d7141e},
+	{0xd1ef0244af2364ff, 0x3207d795430cd926},
+	{0x8335616aed761f1f, 0x7f44e6bd49e807b8},
+	{0xa402b9c5a8d3a6e7, 0x5f16206c9c6209a6},
+	{0xcd036837130890a1, 0x36dba887c37a8c0f},
+	{0x802221226be55a64, 0xc2494954da2c9789},
+	{0xa02aa96b06deb0fd, 0xf2db9baa10b7bd6c},
+	{0xc83553c5c8965d3d, 0x6f92829494e5acc7},
+	{0xfa42a8b73abbf48c, 0xcb772339ba1f17f9},
+	{0x9c69a97284b578d7, 0xff2a760414536efb},
+	{0xc38413cf25e2d70d, 0xfef5138519684aba},
+	{0xf46518c2ef5b8cd1, 0x7eb258665fc25d69},
+	{0x98bf2f79d5993802, 0xef2f773ffbd97a61},
+	{0xbeeefb584aff8603, 0xaafb550ffacfd8fa},
+	{0xeeaaba2e5dbf6784, 0x95ba2a53f983cf38},
+	{0x952ab45cfa97a0b2, 0xdd945a747bf26183},
+	{0xba756174393d88df, 0x94f971119aeef9e4},
+	{0xe912b9d1478ceb17, 0x7a37cd5601aab85d},
+	{0x91abb422ccb812ee, 0xac62e055c10ab33a},
+	{0xb616a12b7fe617aa, 0x577b986b314d6009},
+	{0xe39c49765fdf9d94, 0xed5a7e85fda0b80b},
+	{0x8e41ade9fbebc27d, 0x14588f13be847307},
+	{0xb1d219647ae6b31c, 0x596eb2d8ae258fc8},
+	{0xde469fbd99a05fe3, 0x6fca5f8ed9aef3bb},
+	{0x8aec23d680043bee, 0x25de7bb9480d5854},
+	{0xada72ccc20054ae9, 0xaf561aa79a10ae6a},
+	{0xd910f7ff28069da4, 0x1b2ba1518094da04},
+	{0x87aa9aff79042286, 0x90fb44d2f05d0842},
+	{0xa99541bf57452b28, 0x353a1607ac744a53},
+	{0xd3fa922f2d1675f2, 0x42889b8997915ce8},
+	{0x847c9b5d7c2e09b7, 0x69956135febada11},
+	{0xa59bc234db398c25, 0x43fab9837e699095},
+	{0xcf02b2c21207ef2e, 0x94f967e45e03f4bb},
+	{0x8161afb94b44f57d, 0x1d1be0eebac278f5},
+	{0xa1ba1ba79e1632dc, 0x6462d92a69731732},
+	{0xca28a291859bbf93, 0x7d7b8f7503cfdcfe},
+	{0xfcb2cb35e702af78, 0x5cda735244c3d43e},
+	{0x9defbf01b061adab, 0x3a0888136afa64a7},
+	{0xc56baec21c7a1916, 0x088aaa1845b8fdd0},
+	{0xf6c69a72a3989f5b, 0x8aad549e57273d45},
+	{0x9a3c2087a63f6399, 0x36ac54e2f678864b},
+	{0xc0cb28a98fcf3c7f, 0x84576a1bb416a7dd},
+	{0xf0fdf2d3f3c30b9f, 0x656d44a2a11c51d5},
+	{0x969eb7c47859e743, 0x9f644ae5a4b1b325},
+	{0xbc4665b596706114, 0x873d5d9f0dde1fee},
+	{0xeb57ff22fc0c7959, 0xa90cb506d155a7ea},
+	{0x9316ff75dd87cbd8, 0x09a7f12442d588f2},
+	{0xb7dcbf5354e9bece, 0x0c11ed6d538aeb2f},
+	{0xe5d3ef282a242e81, 0x8f1668c8a86da5fa},
+	{0x8fa475791a569d10, 0xf96e017d694487bc},
+	{0xb38d92d760ec4455, 0x37c981dcc395a9ac},
+	{0xe070f78d3927556a, 0x85bbe253f47b1417},
+	{0x8c469ab843b89562, 0x93956d7478ccec8e},
+	{0xaf58416654a6babb, 0x387ac8d1970027b2},
+	{0xdb2e51bfe9d0696a, 0x06997b05fcc0319e},
+	{0x88fcf317f22241e2, 0x441fece3bdf81f03},
+	{0xab3c2fddeeaad25a, 0xd527e81cad7626c3},
+	{0xd60b3bd56a5586f1, 0x8a71e223d8d3b074},
+	{0x85c7056562757456, 0xf6872d5667844e49},
+	{0xa738c6bebb12d16c, 0xb428f8ac016561db},
+	{0xd106f86e69d785c7, 0xe13336d701beba52},
+	{0x82a45b450226b39c, 0xecc0024661173473},
+	{0xa34d721642b06084, 0x27f002d7f95d0190},
+	{0xcc20ce9bd35c78a5, 0x31ec038df7b441f4},
+	{0xff290242c83396ce, 0x7e67047175a15271},
+	{0x9f79a169bd203e41, 0x0f0062c6e984d386},
+	{0xc75809c42c684dd1, 0x52c07b78a3e60868},
+	{0xf92e0c3537826145, 0xa7709a56ccdf8a82},
+	{0x9bbcc7a142b17ccb, 0x88a66076400bb691},
+	{0xc2abf989935ddbfe, 0x6acff893d00ea435},
+	{0xf356f7ebf83552fe, 0x0583f6b8c4124d43},
+	{0x98165af37b2153de, 0xc3727a337a8b704a},
+	{0xbe1bf1b059e9a8d6, 0x744f18c0592e4c5c},
+	{0xeda2ee1c7064130c, 0x1162def06f79df73},
+	{0x9485d4d1c63e8be7, 0x8addcb5645ac2ba8},
+	{0xb9a74a0637ce2ee1, 0x6d953e2bd7173692},
+	{0xe8111c87c5c1ba99, 0xc8fa8db6ccdd0437},
+	{0x910ab1d4db9914a0, 0x1d9c9892400a22a2},
+	{0xb54d5e4a127f59c8, 0x2503beb6d00cab4b},
+	{0xe2a0b5dc971f303a, 0x2e44ae64840fd61d},
+	{0x8da471a9de737e24, 0x5ceaecfed289e5d2},
+	{0xb10d8e1456105dad, 0x7425a83e872c5f47},
+	{0xdd50f1996b947518, 0xd12f124e28f77719},
+	{0x8a5296ffe33cc92f, 0x82bd6b70d99aaa6f},
+	{0xace73cbfdc0bfb7b, 0x636cc64d1001550b},
+	{0xd8210befd30efa5a, 0x3c47f7e05401aa4e},
+	{0x8714a775e3e95c78, 0x65acfaec34810a71},
+	{0xa8d9d1535ce3b396, 0x7f1839a741a14d0d},
+	{0xd31045a8341ca07c, 0x1ede48111209a050},
+	{0x83ea2b892091e44d, 0x934aed0aab460432},
+	{0xa4e4b66b68b65d60, 0xf81da84d5617853f},
+	{0xce1de40642e3f4b9, 0x36251260ab9d668e},
+	{0x80d2ae83e9ce78f3, 0xc1d72b7c6b426019},
+	{0xa1075a24e4421730, 0xb24cf65b8612f81f},
+	{0xc94930ae1d529cfc, 0xdee033f26797b627},
+	{0xfb9b7cd9a4a7443c, 0x169840ef017da3b1},
+	{0x9d412e0806e88aa5, 0x8e1f289560ee864e},
+	{0xc491798a08a2ad4e, 0xf1a6f2bab92a27e2},
+	{0xf5b5d7ec8acb58a2, 0xae10af696774b1db},
+	{0x9991a6f3d6bf1765, 0xacca6da1e0a8ef29},
+	{0xbff610b0cc6edd3f, 0x17fd090a58d32af3},
+	{0xeff394dcff8a948e, 0xddfc4b4cef07f5b0},
+	{0x95f83d0a1fb69cd9, 0x4abdaf101564f98e},
+	{0xbb764c4ca7a4440f, 0x9d6d1ad41abe37f1},
+	{0xea53df5fd18d5513, 0x84c86189216dc5ed},
+	{0x92746b9be2f8552c, 0x32fd3cf5b4e49bb4},
+	{0xb7118682dbb66a77, 0x3fbc8c33221dc2a1},
+	{0xe4d5e82392a40515, 0x0fabaf3feaa5334a},
+	{0x8f05b1163ba6832d, 0x29cb4d87f2a7400e},
+	{0xb2c71d5bca9023f8, 0x743e20e9ef511012},
+	{0xdf78e4b2bd342cf6, 0x914da9246b255416},
+	{0x8bab8eefb6409c1a, 0x1ad089b6c2f7548e},
+	{0xae9672aba3d0c320, 0xa184ac2473b529b1},
+	{0xda3c0f568cc4f3e8, 0xc9e5d72d90a2741e},
+	{0x8865899617fb1871, 0x7e2fa67c7a658892},
+	{0xaa7eebfb9df9de8d, 0xddbb901b98feeab7},
+	{0xd51ea6fa85785631, 0x552a74227f3ea565},
+	{0x8533285c936b35de, 0xd53a88958f87275f},
+	{0xa67ff273b8460356, 0x8a892abaf368f137},
+	{0xd01fef10a657842c, 0x2d2b7569b0432d85},
+	{0x8213f56a67f6b29b, 0x9c3b29620e29fc73},
+	{0xa298f2c501f45f42, 0x8349f3ba91b47b8f},
+	{0xcb3f2f7642717713, 0x241c70a936219a73},
+	{0xfe0efb53d30dd4d7, 0xed238cd383aa0110},
+	{0x9ec95d1463e8a506, 0xf4363804324a40aa},
+	{0xc67bb4597ce2ce48, 0xb143c6053edcd0d5},
+	{0xf81aa16fdc1b81da, 0xdd94b7868e94050a},
+	{0x9b10a4e5e9913128, 0xca7cf2b4191c8326},
+	{0xc1d4ce1f63f57d72, 0xfd1c2f611f63a3f0},
+	{0xf24a01a73cf2dccf, 0xbc633b39673c8cec},
+	{0x976e41088617ca01, 0xd5be0503e085d813},
+	{0xbd49d14aa79dbc82, 0x4b2d8644d8a74e18},
+	{0xec9c459d51852ba2, 0xddf8e7d60ed1219e},
+	{0x93e1ab8252f33b45, 0xcabb90e5c942b503},
+	{0xb8da1662e7b00a17, 0x3d6a751f3b936243},
+	{0xe7109bfba19c0c9d, 0x0cc512670a783ad4},
+	{0x906a617d450187e2, 0x27fb2b80668b24c5},
+	{0xb484f9dc9641e9da, 0xb1f9f660802dedf6},
+	{0xe1a63853bbd26451, 0x5e7873f8a0396973},
+	{0x8d07e33455637eb2, 0xdb0b487b6423e1e8},
+	{0xb049dc016abc5e5f, 0x91ce1a9a3d2cda62},
+	{0xdc5c5301c56b75f7, 0x7641a140cc7810fb},
+	{0x89b9b3e11b6329ba, 0xa9e904c87fcb0a9d},
+	{0xac2820d9623bf429, 0x546345fa9fbdcd44},
+	{0xd732290fbacaf133, 0xa97c177947ad4095},
+	{0x867f59a9d4bed6c0, 0x49ed8eabcccc485d},
+	{0xa81f301449ee8c70, 0x5c68f256bfff5a74},
+	{0xd226fc195c6a2f8c, 0x73832eec6fff3111},
+	{0x83585d8fd9c25db7, 0xc831fd53c5ff7eab},
+	{0xa42e74f3d032f525, 0xba3e7ca8b77f5e55},
+	{0xcd3a1230c43fb26f, 0x28ce1bd2e55f35eb},
+	{0x80444b5e7aa7cf85, 0x7980d163cf5b81b3},
+	{0xa0555e361951c366, 0xd7e105bcc332621f},
+	{0xc86ab5c39fa63440, 0x8dd9472bf3fefaa7},
+	{0xfa856334878fc150, 0xb14f98f6f0feb951},
+	{0x9c935e00d4b9d8d2, 0x6ed1bf9a569f33d3},
+	{0xc3b8358109e84f07, 0x0a862f80ec4700c8},
+	{0xf4a642e14c6262c8, 0xcd27bb612758c0fa},
+	{0x98e7e9cccfbd7dbd, 0x8038d51cb897789c},
+	{0xbf21e44003acdd2c, 0xe0470a63e6bd56c3},
+	{0xeeea5d5004981478, 0x1858ccfce06cac74},
+	{0x95527a5202df0ccb, 0x0f37801e0c43ebc8},
+	{0xbaa718e68396cffd, 0xd30560258f54e6ba},
+	{0xe950df20247c83fd, 0x47c6b82ef32a2069},
+	{0x91d28b7416cdd27e, 0x4cdc331d57fa5441},
+	{0xb6472e511c81471d, 0xe0133fe4adf8e952},
+	{0xe3d8f9e563a198e5, 0x58180fddd97723a6},
+	{0x8e679c2f5e44ff8f, 0x570f09eaa7ea7648}
+};
+
+/**
+ * 128 bit product of two 64 bit numbers.
+ *
+ * @return  The most significant 64 bits. The rest are stored in lo.
+ */
+static uint64_t mul_128(uint64_t a, uint64_t b, uint64_t *lo)
+{
+#ifdef __SIZEOF_INT128__
+	__extension__ unsigned __int128 p = (unsigned __int128)a * b;
+
+	*lo = (uint64_t)p;
+	return (uint64_t)(p >> 64);
+#else
+	uint64_t ll = (a & 0xffffffff) * (b & 0xffffffff),
+		 lh = (a & 0xffffffff) * (b >> 32),
+		 hl = (a >> 32) * (b & 0xffffffff),
+		 hh = (a >> 32) * (b >> 32),
+		 mid = (ll >> 32) + (lh & 0xffffffff) + (hl & 0xffffffff);
+
+	*lo = (mid << 32) | (ll & 0xffffffff);
+	return hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+}
+
+/**
+ * Number of leading zero bits of a nonzero number.
+ */
+static int leading_zeros(uint64_t x)
+{
+	int n = 0, k;
+
+	for (k = 32; k > 0; k >>= 1) {
+		if (x >> (64 - k) == 0) {
+			x <<= k;
+			n += k;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * Convert w * 10^q to the bits of a floating point number (without sign)
+ * with the Eisel-Lemire algorithm.
+ *
+ * @return  false if the result cannot be decided from the 128 bits of the
+ *          power of ten, or is a denormal or an overflow. The slow path
+ *          must be used then.
+ */
+static bool eisel_lemire(uint64_t w, int q, const struct float_format *fmt,
+			 uint64_t *bits)
+{
+	/* Bits of the product below the mantissa and its rounding bit. */
+	int low_bits = 64 - fmt->mant_bits - 3;
+	uint64_t mask = ((uint64_t)1 << low_bits) - 1;
+	int max_exp = (1 << fmt->exp_bits) - 1;
+	uint64_t hi, lo, hi2, lo2, mant;
+	int lz, msb, exp, log2_pow;
+
+	if (w == 0) {
+		*bits = 0;
+		return true;
+	}
+	if (q < POW10_MIN || q > POW10_MAX) {
+		return false;
+	}
+
+	lz = leading_zeros(w);
+	w <<= lz;
+	/* floor(q * log2(10)), for |q| < 1500 */
+	log2_pow = (q * 217706 - ((q < 0) ? 65535 : 0)) / 65536;
+	exp = log2_pow + 64 - fmt->bias - lz;
+
+	hi = mul_128(w, pow10_128[q - POW10_MIN][0], &lo);
+
+	/* If the low bits are all ones, the rest of the power of ten may carry
+	 * into them. */
+	if ((hi & mask) == mask && lo + w < w) {
+		hi2 = mul_128(w, pow10_128[q - POW10_MIN][1], &lo2);
+		lo += hi2;
+		hi += lo < hi2;
+		if ((hi & mask) == mask && lo + 1 == 0 && lo2 + w < w) {
+			return false;
+		}
+	}
+
+	msb = (int)(hi >> 63);
+	mant = hi >> (msb + low_bits);
+	exp -= 1 ^ msb;
+
+	/* Possibly halfway between two numbers. */
+	if (lo == 0 && (hi & mask) == 0 && (mant & 3) == 1) {
+		return false;
+	}
+
+	mant += mant & 1;
+	mant >>= 1;
+	if (mant >> (fmt->mant_bits + 1) > 0) {
+		mant >>= 1;
+		exp++;
+	}
+
+	if (exp <= 0 || exp >= max_exp) {
+		return false;
+	}
+
+	*bits = (mant & (((uint64_t)1 << fmt->mant_bits) - 1))
+		| (uint64_t)exp << fmt->mant_bits;
+	return true;
+}
+
+/**
+ * Compare the rest of a string with a lowercase word, ignoring case.
+ */
+static bool match_word(const char *s, const char *word)
+{
+	while (*word != TERM && (*s | 0x20) == *word) {
+		s++;
+		word++;
+	}
+
+	return *word == TERM && *s == TERM;
+}
+
+/**
+ * Result of read_real.
+ */
+enum real_kind {
+	REAL_BAD,
+	REAL_NUMBER,
+	REAL_INF,
+	REAL_NAN
+};
+
+/**
+ * Parse a real number.
+ *
+ * The syntax is: optional blanks and sign, then either "inf", "infinity" or
+ * "nan" (in any case), or a decimal number with an optional exponent.
+ * Hexadecimal floats are not accepted.
+ *
+ * @param   a       If not NULL, all the digits are also stored here, for
+ *                  the slow path.
+ */
+static enum real_kind read_real(const char *s, struct real *r,
+				struct decimal *a, bool *negative)
+{
+	bool saw_digits = false, saw_dot = false;
+	unsigned int d;
+	int dp = 0, nw = 0;
+
+	*negative = skip_sign(&s);
+
+	if (match_word(s, "inf") || match_word(s, "infinity")) {
+		return REAL_INF;
+	} else if (match_word(s, "nan")) {
+		return REAL_NAN;
+	}
+
+	r->w = 0;
+	r->trunc = false;
+	if (a != NULL) {
+		a->nd = 0;
+		a->trunc = false;
+	}
+
+	for (;; s++) {
+		if (*s == '.' && !saw_dot) {
+			saw_dot = true;
+			continue;
+		}
+
+		if ((d = (unsigned int)(unsigned char)*s - '0') > 9) {
+			break;
+		}
+
+		saw_digits = true;
+		if (r->w == 0 && d == 0) {
+			/* Leading zeros only count after the point. */
+			dp -= saw_dot;
+			continue;
+		}
+
+		dp += !saw_dot;
+		if (nw < REAL_DIGITS) {
+			r->w = r->w * 10 + d;
+			nw++;
+		} else if (d != 0) {
+			r->trunc = true;
+		}
+
+		if (a == NULL) {
+			continue;
+		}
+		if (a->nd < OPTPARSE_FLOAT_DIGITS) {
+			a->d[a->nd++] = (unsigned char)d;
+		} else if (d != 0) {
+			a->trunc = true;
+		}
+	}
+
+	if (saw_digits && (*s | 0x20) == 'e') {
+		bool exp_negative;
+		int exp = 0;
+
+		s++;
+		exp_negative = *s == '-';
+		if (exp_negative || *s == '+') {
+			s++;
+		}
+
+		if ((unsigned int)(unsigned char)*s - '0' > 9) {
+			return REAL_BAD;
+		}
+
+		/* Saturate: anything this big is an over/underflow anyway. */
+		for (; (d = (unsigned int)(unsigned char)*s - '0') <= 9; s++) {
+			exp = (exp < 100000) ? exp * 10 + (int)d : exp;
+		}
+
+		dp += exp_negative ? -exp : exp;
+	}
+
+	r->q = dp - nw;
+	if (a != NULL) {
+		a->dp = dp;
+		decimal_trim(a);
+	}
+
+	return (saw_digits && *s == TERM) ? REAL_NUMBER : REAL_BAD;
+}
+
+#if FLT_EVAL_METHOD == 0 && DBL_MANT_DIG == 53
+/**
+ * Convert short decimals to double with a single floating point operation.
+ *
+ * If the digits and the power of ten are exactly representable, the result
+ * of the multiplication or division is correctly rounded.
+ *
+ * @return  true if the conversion could be done.
+ */
+static bool fast_double(const struct real *r, double *out)
+{
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	if (r->trunc || r->q < -22 || r->q > 22
+	    || r->w > ((uint64_t)1 << 53)) {
+		return false;
+	}
+
+	*out = (r->q >= 0) ? (double)r->w * pow10[r->q]
+			   : (double)r->w / pow10[-r->q];
+
+	return true;
+}
+#else
+#define fast_double(a, r) false
+#endif
+
+#ifdef __GNUC__
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+/**
+ * Convert a real number with the exact decimal algorithm.
+ *
+ * str is read again to get all of its digits. This is kept out of line so
+ * that the digits are only on the stack while it runs.
+ *
+ * @return  true on overflow (the result is then infinity).
+ */
+static NOINLINE bool slow_to_bits(const char *str,
+				  const struct float_format *fmt,
+				  uint64_t *bits)
+{
+	struct decimal a;
+	struct real r;
+	bool negative;
+
+	read_real(str, &r, &a, &negative);
+
+	return decimal_to_bits(&a, fmt, bits);
+}
+
+/**
+ * Convert a real number read from str to the bits of a floating point
+ * number (without sign).
+ *
+ * If digits were dropped, the result of the fast path is only used if the
+ * numbers just below and above the real one round to the same.
+ *
+ * @return  true on overflow (the result is then infinity).
+ */
+static bool real_to_bits(const char *str, const struct real *r,
+			 const struct float_format *fmt, uint64_t *bits)
+{
+	uint64_t bits_up;
+
+	if (eisel_lemire(r->w, r->q, fmt, bits)
+	    && (!r->trunc
+		|| (eisel_lemire(r->w + 1, r->q, fmt, &bits_up)
+		    && bits_up == *bits))) {
+		return false;
+	}
+
+	return slow_to_bits(str, fmt, bits);
+}
+
+static const char *const real_syntax_msg = "Expected real number";
+static const char *const real_range_msg = "Real number out of range";
+
+int optparse_conv_double(const char *str, double *value, const char **msg)
+{
+	struct real a;
+	bool negative, overflow;
+	uint64_t bits;
+	double r;
+
+	switch (read_real(str, &a, NULL, &negative)) {
+		case REAL_BAD:
+			*msg = real_syntax_msg;
+			return -OPTPARSE_BADSYNTAX;
+		case REAL_INF:
+			*value = negative ? -HUGE_VAL : HUGE_VAL;
+			return OPTPARSE_OK;
+		case REAL_NAN:
+			*value = NAN;
+			return OPTPARSE_OK;
+		case REAL_NUMBER:
+			break;
+	}
+
+	if (fast_double(&a, &r)) {
+		*value = negative ? -r : r;
+		return OPTPARSE_OK;
+	}
+
+#if DBL_MANT_DIG == 53
+	overflow = real_to_bits(str, &a, &float64_format, &bits);
+	memcpy(&r, &bits, sizeof(r));
+#else /* double is the same as float */
+	{
+		uint32_t bits32;
+
+		overflow = real_to_bits(str, &a, &float32_format, &bits);
+		bits32 = (uint32_t)bits;
+		memcpy(&r, &bits32, sizeof(r));
+	}
+#endif
+	if (overflow) {
+		*msg = real_range_msg;
+		return -OPTPARSE_BADSYNTAX;
+	}
+
+	*value = negative ? -r : r;
+
+	return OPTPARSE_OK;
+}
+
+int optparse_conv_float(const char *str, float *value, const char **msg)
+{
+	struct real a;
+	bool negative, overflow;
+	uint64_t bits;
+	uint32_t bits32;
+	double d;
+	float r;
+
+	switch (read_real(str, &a, NULL, &negative)) {
+		case REAL_BAD:
+			*msg = real_syntax_msg;
+			return -OPTPARSE_BADSYNTAX;
+		case REAL_INF:
+			*value = negative ? -HUGE_VALF : HUGE_VALF;
+			return OPTPARSE_OK;
+		case REAL_NAN:
+			*value = NAN;
+			return OPTPARSE_OK;
+		case REAL_NUMBER:
+			break;
+	}
+
+	/* Rounding first to double and then to float gives the correctly
+	 * rounded float, except when the double lands exactly halfway between
+	 * two floats. Float denormals are left to the slow path. */
+	if (fast_double(&a, &d) && d >= FLT_MIN && d <= FLT_MAX) {
+		memcpy(&bits, &d, sizeof(bits));
+		if ((bits & ((UINT64_C(1) << 29) - 1)) != (UINT64_C(1) << 28)) {
+			r = (float)d;
+			*value = negative ? -r : r;
+			return OPTPARSE_OK;
+		}
+	}
+
+	overflow = real_to_bits(str, &a, &float32_format, &bits);
+	if (overflow) {
+		*msg = real_range_msg;
+		return -OPTPARSE_BADSYNTAX;
+	}
+
+	bits32 = (uint32_t)bits;
+	memcpy(&r, &bits32, sizeof(r));
+	*value = negative ? -r : r;
+
+	return OPTPARSE_OK;
+}
+
+static enum OPTPARSE_ACTIONS real_action(const struct opt_rule *rule)
+{
+	return _is_argument(rule->action)? rule->action_data.argument.pos_action
+				         : rule->action;
+}
+
+/**
+ * Execute the action associated with an argument.
+ *
+ * positional_idx is only used for custom commands in positional arguments.
+ * value is only used for commands that need it.
+ * This assumes key and value are not null if they should not be, and that
+ * the array of a collect action has room for one more element.
+ *
+ * The generated actions of the configuration, if any, are tried first.
+ *
+ * @return  An exit code from OPTPARSE_RESULT.
+ */
+static int do_action(const struct parse_env *env,
+		     const struct opt_rule *rule,
+		     union opt_data *dest,
+		     int positional_idx, const char *value,
+		     const char **msg)
+{
+	int ret = OPTPARSE_OK;
+	int64_t i_value;
+	uint64_t u_value;
+	enum OPTPARSE_ACTIONS action = real_action(rule);
+
+	STATS_ADD(env->ctx->stats, actions[action], 1);
+
+	if (env->config->apply != NULL) {
+		ret = env->config->apply((int)(rule - env->config->rules),
+					 value, dest, msg);
+		if (ret != OPTPARSE_DEFAULT_ACTION) {
+			return ret;
+		}
+		ret = OPTPARSE_OK;
+	}
+
+	if (_is_append(action)) {
+		ret = grow_array(env, action, &dest->d_array);
+		if (ret != OPTPARSE_OK) {
+			*msg = "Parser out of memory";
+			return ret;
+		}
+	}
+
+	switch (action) {
+		case OPTPARSE_IGNORE: case OPTPARSE_IGNORE_SWITCH:
+			break;
+		case OPTPARSE_INT:
+			ret = optparse_conv_int(value, INT_MIN, INT_MAX,
+						&i_value, msg);
+			if (ret == OPTPARSE_OK) {
+				dest->d_int = (int)i_value;
+			}
+			break;
 		case OPTPARSE_UINT:
-			dest->d_uint = strtoul(value, &end_of_conversion, 0);
-			if (*end_of_conversion != '\0') {
-				*msg = "Expected integer";
-				ret = -OPTPARSE_BADSYNTAX;
+			ret = optparse_conv_uint(value, UINT_MAX, &u_value, msg);
+			if (ret == OPTPARSE_OK) {
+				dest->d_uint = (unsigned int)u_value;
+			}
+			break;
+		case OPTPARSE_INT64:
+			ret = optparse_conv_int(value, INT64_MIN, INT64_MAX,
+						&dest->d_int64, msg);
+			break;
+		case OPTPARSE_UINT64:
+			ret = optparse_conv_uint(value, UINT64_MAX,
+						 &dest->d_uint64, msg);
+			break;
+		case OPTPARSE_SIZE:
+			ret = optparse_conv_size(value, &dest->d_uint64, msg);
+			break;
+		case OPTPARSE_DURATION:
+			ret = optparse_conv_duration(value, &dest->d_int64, msg);
+			break;
+		case OPTPARSE_FLOAT:
+			ret = optparse_conv_float(value, &dest->d_float, msg);
+			break;
+		case OPTPARSE_DOUBLE:
+			ret = optparse_conv_double(value, &dest->d_double, msg);
+			break;
+		case OPTPARSE_STR_NOCOPY:
+			dest->d_cstr = value;
+			break;
+		case OPTPARSE_VIEW:
+			dest->d_view.ptr = value;
+			dest->d_view.len = strlen(value);
+			break;
+		case OPTPARSE_COLLECT_INT64: case OPTPARSE_APPEND_INT64:
+			ret = optparse_conv_int(value, INT64_MIN, INT64_MAX,
+				dest->d_array.items.i64 + dest->d_array.count, msg);
+			dest->d_array.count += (ret == OPTPARSE_OK);
+			break;
+		case OPTPARSE_COLLECT_DOUBLE: case OPTPARSE_APPEND_DOUBLE:
+			ret = optparse_conv_double(value,
+				dest->d_array.items.dbl + dest->d_array.count, msg);
+			dest->d_array.count += (ret == OPTPARSE_OK);
+			break;
+		case OPTPARSE_COLLECT_STR: case OPTPARSE_APPEND_STR:
+			dest->d_array.items.str[dest->d_array.count++] = value;
+			break;
+		case OPTPARSE_SET_BOOL:
+			dest->d_bool = true;
+			break;
+		case OPTPARSE_UNSET_BOOL:
+			dest->d_bool = false;
+			break;
+		case OPTPARSE_COUNT:
+			dest->d_int++;
+			break;
+		case OPTPARSE_STR:
+			{
+				/* avoid memory leak if the option is given
+				 * multiple times. */
+				if (env->ctx->arena == NULL) {
+					env->allocator->free(env->allocator->user,
+							     dest->d_str);
+				}
+				dest->d_str = copy_string(env, value);
+				if (dest->d_str == NULL) {
+					*msg = "Parser out of memory";
+					ret = -OPTPARSE_NOMEM;
+				}
+			}
+			break;
+		case OPTPARSE_DO_HELP:
+			ENV_DEBUG(env, "do_action found OPTPARSE_DO_HELP\n");
+			 /*this is a meta-action and has to be implemented in
+			   generic_parser!! */
+			assert(0);
+			break;
+		case OPTPARSE_CUSTOM_ACTION:
+			ret = do_user_callback(env, rule, dest, positional_idx,
+					       value, msg);
+			break;
+		default:
+			ENV_DEBUG(env, "Unknown action: %d\n", rule->action);
+			ret = -OPTPARSE_BADCONFIG;
+			break;
+	}
+
+	return ret;
+}
+
+static bool _match_optionkey(struct opt_optionkey opt_key,
+							 const char *long_id, char short_id)
+{
+	return (short_id && opt_key.short_id == short_id)
+	       || ((long_id != NULL) && (opt_key.long_id != NULL)
+		   && strcmp(long_id, opt_key.long_id) == 0);
+}
+
+/**
+ * Find a rule with the given short id or long id.
+ *
+ * A short id of 0 never matches. A NULL long id never matches.
+ */
+static const struct opt_rule *find_opt_rule(const struct opt_conf *config,
+					    const char *long_id,
+					    char short_id,
+					    struct opt_stats *stats)
+{
+	const struct opt_rule *this_rule = config->rules;
+	int i = config->n_rules;
+
+	/* This iteration seems weird but it provides perceptible code size
+	 * savings in both gcc and clang (at least in cortexm/thumb).*/
+	while(i--) {
+		if (!_is_argument(this_rule->action)) {
+			STATS_ADD(stats, str_compares, long_id != NULL
+				  && this_rule->action_data.option.long_id
+				     != NULL);
+			if (_match_optionkey(this_rule->action_data.option,
+					     long_id, short_id)) {
+				return this_rule;
+			}
+		}
+		this_rule++;
+	}
+
+	return NULL;
+}
+
+/**
+ * Hash a long option id (32 bit FNV-1a).
+ */
+static uint32_t hash_long_id(const char *long_id)
+{
+	uint32_t h = 2166136261u;
+
+	while (*long_id != TERM) {
+		h = (h ^ (unsigned char)*long_id++) * 16777619u;
+	}
+
+	return h;
+}
+
+/**
+ * Like find_opt_rule, but using the tables built by optparse_compile.
+ */
+static const struct opt_rule *find_indexed_rule(const struct opt_index *index,
+						const char *long_id,
+						char short_id,
+						struct opt_stats *stats)
+{
+	int rule_n = 0;
+
+	if (short_id) {
+		rule_n = index->short_ids[(unsigned char)short_id];
+	} else if (long_id != NULL && index->long_ids != NULL) {
+		uint32_t slot = hash_long_id(long_id);
+
+		while ((rule_n = index->long_ids[slot &= index->long_mask]) != 0) {
+			STATS_ADD(stats, str_compares, 1);
+			if (strcmp(long_id, index->config->rules[rule_n - 1]
+					    .action_data.option.long_id) == 0) {
+				break;
+			}
+			slot++;
+		}
+	}
+
+	return rule_n ? index->config->rules + (rule_n - 1) : NULL;
+}
+
+/**
+ * Find an option rule, using the generated matcher or the index if there is
+ * one.
+ */
+static const struct opt_rule *lookup_opt_rule(const struct opt_conf *config,
+					      const struct opt_index *index,
+					      const char *long_id,
+					      char short_id,
+					      struct opt_stats *stats)
+{
+	STATS_ADD(stats, opt_lookups, 1);
+
+	if (config->matcher != NULL) {
+		int rule_n = config->matcher(long_id, short_id);
+
+		return (rule_n >= 0) ? config->rules + rule_n : NULL;
+	}
+
+	return (index != NULL)
+	       ? find_indexed_rule(index, long_id, short_id, stats)
+	       : find_opt_rule(config, long_id, short_id, stats);
+}
+
+/**
+ * Find the positional argument handler for the arg_n-th position (arg_n counts
+ * from zero).
+ *
+ * If repeat_last is true, if arg_n is greater than or equal to the number of
+ * available handler, the last one (if any) is returned.
+ *
+ * @returns     pointer to the matching rule, or NULL if none is found.
+ */
+static const struct opt_rule *find_arg_rule(const struct opt_conf *config,
+					    int arg_n)
+{
+	int rule_i;
+	int last_handler;
+	int handlers_found = 0;
+	bool repeat_last = !!(config->tune & OPTPARSE_COLLECT_LAST_POS);
+
+	for (rule_i = 0; rule_i < config->n_rules; rule_i++) {
+		const struct opt_rule this_rule = config->rules[rule_i];
+
+		if (_is_argument(this_rule.action)) {
+			handlers_found++;
+			last_handler = rule_i;
+			if (handlers_found > arg_n) {
+				return config->rules + rule_i;
+			}
+		}
+	}
+
+	if (handlers_found && _is_collect(real_action(config->rules
+						     + last_handler))) {
+		repeat_last = true;
+	}
+
+	return (repeat_last && handlers_found)? config->rules + last_handler
+						: NULL;
+}
+
+/**
+ * Find a positional argument rule, using the index if there is one.
+ */
+static const struct opt_rule *lookup_arg_rule(const struct opt_conf *config,
+					      const struct opt_index *index,
+					      int arg_n,
+					      struct opt_stats *stats)
+{
+	int rule_n;
+
+	STATS_ADD(stats, pos_lookups, 1);
+
+	if (index == NULL) {
+		return find_arg_rule(config, arg_n);
+	}
+
+	rule_n = (arg_n < index->n_pos) ? index->pos_rules[arg_n]
+					: index->last_pos;
+
+	return rule_n ? config->rules + (rule_n - 1) : NULL;
+}
+
+/**
+ * Get the memory location where the parse result should be stored.
+ */
+static union opt_data *get_destination(const struct opt_conf *config,
+					const struct opt_rule *rule,
+					union opt_data *result_base)
+{
+	return result_base + (rule - config->rules);
+}
+
+/**
+ * Copy over the default values from the rules array to the result array.
+ *
+ * For custom actions, the callback will be called with value = NULL.
+ *
+ * This procedure also counts the number of required positional arguments and
+ * returns it in n_required (which must NOT be null).
+ *
+ * On error, n_required may not be accurate.
+ *
+ * This procedure ensures guarantees that no result item will have a wild
+ * pointer in d_str (i.e, it will point to an allocated block or be NULL.)
+ */
+static int assign_default(const struct parse_env *env,
+			  union opt_data *result, int *n_required)
+{
+	const struct opt_conf *config = env->config;
+	int rule_i;
+	int error = 0;
+	int positional_idx = 0;
+	int _required = 0;
+
+	for (rule_i = 0; !error && rule_i < config->n_rules; rule_i++) {
+		enum OPTPARSE_ACTIONS action;
+		const struct opt_rule *this_rule = config->rules + rule_i;
+		const char *msg = NULL;
+
+		if (!_is_optional(this_rule->action)) {
+			_required++;
+		}
+
+		if (_is_argument(this_rule->action)) {
+			positional_idx++;
+		}
+
+		action = real_action(this_rule);
+
+		if (action == OPTPARSE_STR
+		    && this_rule->default_value.d_str != NULL) {
+			result[rule_i].d_str = copy_string(env,
+						this_rule->default_value.d_str);
+			if (result[rule_i].d_str == NULL) {
+				ENV_DEBUG(env, "initialization failed: "
+					  "out of memory\n");
+				error = -OPTPARSE_NOMEM;
+			}
+		} else if (_is_array(action)) {
+			result[rule_i].d_array.items.any = NULL;
+			result[rule_i].d_array.count = 0;
+		} else if (action == OPTPARSE_VIEW) {
+			const char *dfl = this_rule->default_value.d_view.ptr;
+
+			result[rule_i].d_view.ptr = dfl;
+			result[rule_i].d_view.len = (dfl != NULL) ? strlen(dfl) : 0;
+		} else if (action != OPTPARSE_CUSTOM_ACTION) {
+			result[rule_i] = this_rule->default_value;
+		} else {
+			error = do_user_callback(env, this_rule, result + rule_i,
+						 positional_idx, NULL, &msg);
+			if (env->ctx->error == NULL) {
+				safe_fputs(msg, HELP_STREAM);
+			}
+			if (error) {
+				ENV_DEBUG(env, "User cb at index %d failed in "
+					  "init with code %d.\n", rule_i, error);
+			}
+		}
+	}
+
+	/* If we exited early, ensure that we do not leave any wild pointer.
+	 * We will have to free them later. */
+	for (; rule_i < config->n_rules; rule_i++) {
+		enum OPTPARSE_ACTIONS action = real_action(config->rules + rule_i);
+
+		if (action == OPTPARSE_STR) {
+			result[rule_i].d_str = NULL;
+		} else if (_is_array(action)) {
+			result[rule_i].d_array.items.any = NULL;
+		}
+	}
+
+	*n_required = _required;
+
+	return error;
+}
+
+
+/**
+ * Free all OPTPARSE_STR strings and collected arrays with the given
+ * allocator and clear their slots.
+ *
+ * If allocator is NULL the slots are only cleared: their memory belongs to
+ * an arena.
+ */
+static void free_strings(const struct opt_conf *config,
+			 const struct opt_allocator *allocator,
+			 union opt_data *result)
+{
+	const struct opt_rule *this_rule = config->rules;
+	int i = config->n_rules;
+
+	/* This iteration seems weird but it provides perceptible code size savings
+	 * in both gcc and clang (at least in cortexm/thumb).*/
+	while(i--) {
+		enum OPTPARSE_ACTIONS action = real_action(this_rule);
+
+		if (action == OPTPARSE_STR) {
+			if (allocator != NULL) {
+				allocator->free(allocator->user, result->d_str);
+			}
+			result->d_str = NULL;
+		} else if (_is_array(action)) {
+			if (allocator != NULL) {
+				allocator->free(allocator->user,
+						result->d_array.items.any);
+			}
+			result->d_array.items.any = NULL;
+			result->d_array.count = 0;
+		}
+		result++;
+		this_rule++;
+	}
+}
+
+void optparse_free_strings(const struct opt_conf *config, union opt_data *result)
+{
+	free_strings(config, get_allocator(config, NULL), result);
+}
+
+void optparse_free_strings_ctx(const struct opt_conf *config,
+			       const struct opt_context *ctx,
+			       union opt_data *result)
+{
+	free_strings(config, get_allocator(config, ctx), result);
+}
+
+void optparse_arena_reset(struct opt_arena *arena)
+{
+	if (arena->blocks != NULL) {
+		struct opt_arena_block *block = arena->blocks->next;
+
+		/* The first block is the newest and biggest one: keep it. */
+		while (block != NULL) {
+			struct opt_arena_block *next = block->next;
+
+			arena->allocator->free(arena->allocator->user, block);
+			block = next;
+		}
+		arena->blocks->next = NULL;
+	}
+
+	arena->used = 0;
+}
+
+void optparse_arena_release(struct opt_arena *arena)
+{
+	optparse_arena_reset(arena);
+	if (arena->blocks != NULL) {
+		arena->allocator->free(arena->allocator->user, arena->blocks);
+	}
+
+	arena->blocks = NULL;
+	arena->buf = NULL;
+	arena->size = 0;
+}
+
+/**
+ * Append a string to buf, truncating it to fit.
+ *
+ * @return  The new length of the string in buf.
+ */
+static size_t append_str(char *buf, size_t size, size_t len, const char *str)
+{
+	while (*str != TERM && len + 1 < size) {
+		buf[len++] = *str++;
+	}
+	buf[len] = TERM;
+
+	return len;
+}
+
+/**
+ * Report an error, either to the error context of the parse or to stderr.
+ *
+ * @param   token       Token or name that caused the error, or NULL.
+ * @param   token_idx   See opt_error::token.
+ */
+static void report_error(struct opt_state *state, int error, const char *msg,
+			 const char *token, int token_idx)
+{
+	struct opt_error *err = state->ctx.error;
+
+	if (err == NULL) {
+		if (msg != NULL && token != NULL) {
+			P_ERR("%s: %s\n", msg, token);
+		} else if (msg != NULL) {
+			P_ERR("%s\n", msg);
+		}
+		return;
+	}
+
+	err->code = error;
+	err->token = token_idx;
+	err->msg = msg;
+
+	if (err->buf != NULL && err->buf_size > 0) {
+		size_t len = append_str(err->buf, err->buf_size, 0,
+					(msg != NULL) ? msg : "");
+
+		if (msg != NULL && token != NULL) {
+			len = append_str(err->buf, err->buf_size, len, ": ");
+			append_str(err->buf, err->buf_size, len, token);
+		}
+	}
+}
+
+/**
+ * Stop the parse with an error.
+ *
+ * The error is reported with report_error(), unless the parse had already
+ * failed. Strings and arrays allocated so far are released, or the arena is
+ * rolled back, so an abandoned state does not leak.
+ */
+static void fail_parse(struct opt_state *state, int error, const char *msg,
+		       const char *token, int token_idx)
+{
+	struct opt_arena *arena = state->ctx.arena;
+
+	if (state->error < OPTPARSE_OK) {
+		return;
+	}
+
+	report_error(state, error, msg, token, token_idx);
+	state->error = error;
+
+	if (state->result == NULL) {
+		/* Iterating: nothing was allocated. */
+	} else if (arena == NULL) {
+		free_strings(state->config, state->allocator, state->result);
+	} else {
+		/* Do not leave pointers into the memory given back below. */
+		free_strings(state->config, NULL, state->result);
+		if (arena->blocks == state->arena_block) {
+			arena->used = state->arena_mark;
+		}
+	}
+}
+
+/**
+ * Apply a rule to a value, making room first in the array of a collect
+ * action.
+ *
+ * remaining is the number of tokens left, including this one, or zero if it
+ * is not known. In the latter case collect arrays grow like append arrays.
+ */
+static int apply_rule(struct opt_state *state, const struct parse_env *env,
+		      const struct opt_rule *rule, const char *value,
+		      size_t remaining, const char **msg)
+{
+	union opt_data *dest = get_destination(state->config, rule,
+					       state->result);
+	enum OPTPARSE_ACTIONS action = real_action(rule);
+	int error = OPTPARSE_OK;
+
+	if (state->ctx.given != NULL) {
+		size_t rule_i = (size_t)(rule - state->config->rules);
+
+		state->ctx.given[rule_i / 8] |= (unsigned char)(1u << rule_i % 8);
+	}
+
+	if (_is_collect(action)) {
+		if (remaining == 0) {
+			error = grow_array(env, action, &dest->d_array);
+		} else if (dest->d_array.items.any == NULL) {
+			error = resize_array(env, action, &dest->d_array,
+					     remaining);
+		}
+	}
+
+	if (error != OPTPARSE_OK) {
+		*msg = "Parser out of memory";
+		return error;
+	}
+
+	return do_action(env, rule, dest, state->positional_idx, value, msg);
+}
+
+/** Default limit for nested response files. */
+#define RESPONSE_FILE_DEPTH 8
+
+/**
+ * A response file held in memory, as a NUL terminated string.
+ */
+struct opt_loaded_file {
+	struct opt_loaded_file *next;
+	char *text;
+	/** Length of the mapping, or 0 if text follows this header in the same
+	 *  allocated block. */
+	size_t map_len;
+};
+
+/** Size of the first block used to read a file that cannot seek. */
+#define READ_CHUNK 1024
+
+/**
+ * Read a stream of unknown size (e.g. a pipe) into an allocated block, after
+ * a opt_loaded_file header, doubling the block as it fills up.
+ */
+static struct opt_loaded_file *read_stream(const struct opt_allocator *allocator,
+					   FILE *stream)
+{
+	size_t size = READ_CHUNK, len = 0;
+	struct opt_loaded_file *file = allocator->alloc(allocator->user,
+							sizeof(*file) + size
+							+ 1);
+
+	while (file != NULL) {
+		struct opt_loaded_file *grown = NULL;
+		char *text = (char *)(file + 1);
+
+		len += fread(text + len, 1, size - len, stream);
+		if (len < size) {
+			if (ferror(stream)) {
+				allocator->free(allocator->user, file);
+				return NULL;
+			}
+			break;
+		}
+
+		if (size <= (SIZE_MAX - sizeof(*file) - 1) / 2) {
+			grown = allocator->alloc(allocator->user,
+						 sizeof(*file) + 2 * size + 1);
+		}
+		if (grown != NULL) {
+			memcpy(grown + 1, text, len);
+			size *= 2;
+		}
+		allocator->free(allocator->user, file);
+		file = grown;
+	}
+
+	if (file != NULL) {
+		file->text = (char *)(file + 1);
+		file->text[len] = TERM;
+		file->map_len = 0;
+	}
+
+	return file;
+}
+
+/**
+ * Read a whole file into an allocated block, after a opt_loaded_file header.
+ *
+ * Files that cannot seek, such as pipes, are read with read_stream().
+ */
+static struct opt_loaded_file *read_file(const struct opt_allocator *allocator,
+					 const char *path)
+{
+	struct opt_loaded_file *file = NULL;
+	FILE *stream = fopen(path, "rb");
+	long size;
+
+	if (stream == NULL) {
+		return NULL;
+	}
+
+	if (fseek(stream, 0, SEEK_END) != 0 || (size = ftell(stream)) < 0
+	    || fseek(stream, 0, SEEK_SET) != 0) {
+		file = read_stream(allocator, stream);
+		fclose(stream);
+		return file;
+	}
+
+	file = allocator->alloc(allocator->user,
+				sizeof(*file) + (size_t)size + 1);
+	if (file != NULL) {
+		file->text = (char *)(file + 1);
+		file->map_len = 0;
+		if (fread(file->text, 1, (size_t)size, stream) != (size_t)size) {
+			allocator->free(allocator->user, file);
+			file = NULL;
+		} else {
+			file->text[size] = TERM;
+		}
+	}
+
+	fclose(stream);
+
+	return file;
+}
+
+/**
+ * Load a response file.
+ *
+ * With mmap, the file is mapped privately (copy on write), so only the pages
+ * that the tokenizer modifies are copied. If the size is a multiple of the
+ * page size there would be no room for the terminator, and the file is read
+ * instead. It is also read if it cannot be mapped (e.g. it is on a file
+ * system that does not support mmap()).
+ *
+ * @return  The file, or NULL on error.
+ */
+static struct opt_loaded_file *load_file(const struct opt_allocator *allocator,
+					 const char *path)
+{
+#ifdef USE_MMAP
+	struct opt_loaded_file *file;
+	struct stat st;
+	long page = sysconf(_SC_PAGESIZE);
+	void *map;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0
+	    || page <= 0 || st.st_size % page == 0) {
+		close(fd);
+		return read_file(allocator, path);
+	}
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return read_file(allocator, path);
+	}
+
+	file = allocator->alloc(allocator->user, sizeof(*file));
+	if (file == NULL) {
+		munmap(map, (size_t)st.st_size);
+		return NULL;
+	}
+
+	/* The rest of the last page reads as zeros: that is the terminator. */
+	file->text = map;
+	file->map_len = (size_t)st.st_size;
+
+	return file;
+#else /* USE_MMAP */
+	return read_file(allocator, path);
+#endif /* USE_MMAP */
+}
+
+void optparse_release_files(struct opt_response_files *files)
+{
+	struct opt_loaded_file *file = files->loaded;
+
+	while (file != NULL) {
+		struct opt_loaded_file *next = file->next;
+
+#ifdef USE_MMAP
+		if (file->map_len) {
+			munmap(file->text, file->map_len);
+		}
+#endif
+		files->allocator->free(files->allocator->user, file);
+		file = next;
+	}
+
+	files->loaded = NULL;
+}
+
+/**
+ * Split the next token off a command line, in place.
+ *
+ * Quotes and backslashes are removed by moving the rest of the token back
+ * over them, so the token never grows and nothing is allocated.
+ *
+ * @param   cursor  Position in the line. Updated to point after the token.
+ * @param   token   Output: start of the token, NUL terminated.
+ * @param   msg     Set to an error message on error.
+ *
+ * @return  1 if a token was found, 0 at the end of the line, or
+ *          -OPTPARSE_BADSYNTAX.
+ */
+static int next_token(char **cursor, char **token, const char **msg)
+{
+	char *r = *cursor, *w;
+	char quote = TERM;
+	bool more;
+
+	while (is_space(*r)) {
+		r++;
+	}
+
+	if (*r == TERM) {
+		*cursor = r;
+		return 0;
+	}
+
+	*token = w = r;
+
+	for (; *r != TERM && (quote != TERM || !is_space(*r)); r++) {
+		if (quote == TERM && (*r == '\'' || *r == '"')) {
+			quote = *r;
+			continue;
+		} else if (quote != TERM && *r == quote) {
+			quote = TERM;
+			continue;
+		}
+
+		/* Inside double quotes, only \" and \\ are escapes. Inside
+		 * single quotes, nothing is. */
+		if (*r == '\\' && (quote == TERM
+				    || (quote == '"'
+					&& (r[1] == '"' || r[1] == '\\')))) {
+			r++;
+			if (*r == TERM) {
+				*msg = "Backslash at end of line";
+				return -OPTPARSE_BADSYNTAX;
 			}
-			break;
-		case OPTPARSE_FLOAT:
-			dest->d_float = strtof(value, &end_of_conversion);
-			if (*end_of_conversion != '\0') {
-				*msg = "Expected real number";
-				ret = -OPTPARSE_BADSYNTAX;
+		}
+
+		*w++ = *r;
+	}
+
+	if (quote != TERM) {
+		*msg = "Unterminated quote";
+		return -OPTPARSE_BADSYNTAX;
+	}
+
+	more = *r != TERM;
+	*w = TERM;
+	*cursor = more ? r + 1 : r;
+
+	return 1;
+}
+
+static int feed_token(struct opt_state *state, const char *token,
+		      size_t remaining);
+
+/**
+ * Load a response file and parse its contents.
+ *
+ * Errors in the contents are reported by feed_token and stop the parse.
+ * Errors loading the file are returned with a message.
+ */
+static int expand_file(struct opt_state *state, const char *path,
+		       const char **msg)
+{
+	struct opt_response_files *files = state->ctx.files;
+	int max_depth = (files->max_depth > 0) ? files->max_depth
+					       : RESPONSE_FILE_DEPTH;
+	struct opt_loaded_file *file;
+	char *cursor, *token;
+	int ret = 0;
+
+	if (state->depth >= max_depth) {
+		*msg = "Response files nested too deeply";
+		return -OPTPARSE_BADSYNTAX;
+	}
+
+	if (files->allocator == NULL) {
+		files->allocator = state->allocator;
+	}
+
+	file = load_file(files->allocator, path);
+	if (file == NULL) {
+		*msg = "Cannot read response file";
+		return -OPTPARSE_BADSYNTAX;
+	}
+
+	/* The file must stay loaded as long as the results point into it. */
+	file->next = files->loaded;
+	files->loaded = file;
+
+	state->depth++;
+	cursor = file->text;
+	while (state->error >= OPTPARSE_OK
+	       && (ret = next_token(&cursor, &token, msg)) > 0) {
+		feed_token(state, token, 0);
+	}
+	state->depth--;
+
+	return (state->error < OPTPARSE_OK) ? state->error : ret;
+}
+
+/**
+ * Decode the next step of a token.
+ *
+ * A token is normally decoded in one step, but a group of switches like -axf
+ * (equivalent to -a -x -f) takes one step per switch. Instead of going to the
+ * next token, the rest of the group is kept in *pending.
+ *
+ * On success, *rule is the rule to apply to *value, or NULL if there is
+ * nothing to apply: the token was "--", or it is an option that takes its
+ * value from the next token. The caller must advance state->positional_idx
+ * after applying an argument rule.
+ *
+ * @return  OPTPARSE_OK or a negative error code, with *msg set.
+ */
+static int decode_token(struct opt_state *state, const char *token,
+			const char **pending, const struct opt_rule **rule,
+			const char **value, const char **msg)
+{
+	const struct opt_conf *config = state->config;
+	const struct opt_rule *curr_rule = NULL;
+	const char *key;
+	int error = OPTPARSE_OK;
+
+	*value = NULL;
+
+	if (state->waiting != NULL) {
+		/* The previous token was an option that needs a value. */
+		curr_rule = state->waiting;
+		state->waiting = NULL;
+		*value = token;
+	} else if ((*pending != NULL)
+		   || (!state->no_more_options
+		       && str_notempty(key = strip_dash(token)))) {
+		bool is_long = false;
+
+		if (*pending == NULL) {
+			const char *tmp_key = strip_dash(key);
+
+			is_long = tmp_key != NULL;
+			if (is_long) {
+				key = tmp_key;
 			}
-			break;
-		case OPTPARSE_STR_NOCOPY:
-			dest->d_cstr = value;
-			break;
-		case OPTPARSE_SET_BOOL:
-			dest->d_bool = true;
-			break;
-		case OPTPARSE_UNSET_BOOL:
-			dest->d_bool = false;
-			break;
-		case OPTPARSE_COUNT:
-			dest->d_int++;
-			break;
-		case OPTPARSE_STR:
-			{
-				/* avoid memory leak if the option is given
-				 * multiple times. */
-				free(dest->d_str);
-				dest->d_str = my_strdup(value);
-				if (dest->d_str == NULL) {
-					*msg = "Parser out of memory";
-					ret = -OPTPARSE_NOMEM;
+
+			if (is_long && tmp_key[0] == TERM) { /* we read a "--" */
+				state->no_more_options = true;
+				*rule = NULL;
+				return OPTPARSE_OK;
+			}
+		} else {
+			key = *pending;
+			*pending = NULL; /* We reset this because we need to check again
+					    if the current option is a switch*/
+		}
+
+		curr_rule = lookup_opt_rule(config, state->ctx.index,
+					    is_long ? key : NULL,
+					    (!is_long) ? key[0] : 0,
+					    state->ctx.stats);
+
+		if (curr_rule == NULL) {
+			*msg = "Unknown option";
+			error = -OPTPARSE_BADSYNTAX;
+		} else if (curr_rule->action == OPTPARSE_DO_HELP) {
+			if (state->ctx.error == NULL) {
+				optparse_help(config);
+			}
+			error = -OPTPARSE_REQHELP; /* BYE! */
+		} else if (NEEDS_VALUE(curr_rule)) {
+			if (!is_long && key[1] != TERM) {
+				/* This allows one to write the option value like -d12.6 */
+				*value = key + 1;
+			} else {
+				/* The value is the next token */
+				state->waiting = curr_rule;
+				state->waiting_token = token;
+				curr_rule = NULL;
+			}
+		} else if (!is_long && key[1] != TERM) {
+			/* Handle switches (no arguments) */
+			*pending = key + 1;
+		}
+	} else {
+		curr_rule = lookup_arg_rule(config, state->ctx.index,
+					    state->positional_idx,
+					    state->ctx.stats);
+		*value = token;
+
+#if OPTPARSE_MAX_POSITIONAL < INT_MAX
+		/* Collected values are not numbered, so they have no limit. */
+		if (state->positional_idx > OPTPARSE_MAX_POSITIONAL
+		    && !(curr_rule != NULL
+			 && _is_collect(real_action(curr_rule)))) {
+			*msg = "Max number of arguments exceeded";
+			error = -OPTPARSE_BADSYNTAX;
+		}
+#endif
+
+		if (curr_rule == NULL) {
+			*msg = "Too many arguments";
+			error = -OPTPARSE_BADSYNTAX; /* BYE! */
+		}
+	}
+
+	*rule = curr_rule;
+
+	return error;
+}
+
+/**
+ * Parser implementation: process one token.
+ *
+ * See apply_rule() for the meaning of remaining.
+ */
+static int feed_token(struct opt_state *state, const char *token,
+		      size_t remaining)
+{
+	const struct parse_env env = {state->config, &state->ctx,
+				      state->allocator};
+	const char *msg = NULL;
+	const char *pending_opt = NULL;
+	int error = OPTPARSE_OK;
+
+	if (state->error < OPTPARSE_OK) {
+		return state->error;
+	}
+
+	/* Tokens from response files are not counted. */
+	if (state->depth == 0) {
+		state->argi++;
+	}
+	STATS_ADD(state->ctx.stats, tokens, 1);
+
+	if (state->skip_first) {
+		state->skip_first = false;
+		return OPTPARSE_OK;
+	}
+
+	if (token[0] == '@' && token[1] != TERM && state->ctx.files != NULL
+	    && state->waiting == NULL && !state->no_more_options) {
+		error = expand_file(state, token + 1, &msg);
+	} else {
+		do {
+			const struct opt_rule *rule;
+			const char *value;
+
+			error = decode_token(state, token, &pending_opt, &rule,
+					     &value, &msg);
+
+			if (error >= OPTPARSE_OK && rule != NULL) {
+				error = apply_rule(state, &env, rule, value,
+						   remaining, &msg); /* BYE? */
+				if (_is_argument(rule->action)) {
+					state->positional_idx++;
 				}
 			}
-			break;
-		case OPTPARSE_DO_HELP:
-			P_DEBUG("do_action found OPTPARSE_DO_HELP\n");
-			 /*this is a meta-action and has to be implemented in
-			   generic_parser!! */
-			assert(0);
-			break;
-		case OPTPARSE_CUSTOM_ACTION:
-			ret = do_user_callback(rule, dest, positional_idx, value, msg);
-			break;
-		default:
-			P_DEBUG("Unknown action: %d\n", rule->action);
-			ret = -OPTPARSE_BADCONFIG;
-			break;
+		} while (error >= OPTPARSE_OK && pending_opt != NULL);
+	}
+
+	if (error < OPTPARSE_OK) {
+		fail_parse(state, error, msg, token, state->argi - 1);
+	} else if (msg != NULL && state->ctx.error == NULL) {
+		/* A custom action can give a message without failing. */
+		P_ERR("%s: %s\n", msg, token);
+	}
+
+	return error;
+}
+
+/**
+ * Initialize a parse state, without touching the result.
+ *
+ * @return  OPTPARSE_OK or -OPTPARSE_BADCONFIG.
+ */
+static int init_state(struct opt_state *state, const struct opt_conf *config,
+		      const struct opt_context *ctx, union opt_data *result)
+{
+	static const struct opt_context no_ctx = {NULL};
+
+	state->config = config;
+	state->ctx = (ctx != NULL) ? *ctx : no_ctx;
+	state->result = result;
+	state->allocator = get_allocator(config, &state->ctx);
+	state->waiting = NULL;
+	state->waiting_token = NULL;
+	/* Used to roll back the arena if the parse fails. */
+	state->arena_mark = (state->ctx.arena != NULL)
+			    ? state->ctx.arena->used : 0;
+	state->arena_block = (state->ctx.arena != NULL)
+			     ? state->ctx.arena->blocks : NULL;
+	state->positional_idx = 0;
+	state->n_required = 0;
+	state->depth = 0;
+	state->error = OPTPARSE_OK;
+	state->no_more_options = false;
+	state->skip_first = !!(config->tune & OPTPARSE_IGNORE_ARGV0);
+	state->argv = NULL;
+	state->argc = 0;
+	state->argi = 0;
+	state->pending = NULL;
+
+	if (state->ctx.given != NULL) {
+		memset(state->ctx.given, 0, ((size_t)config->n_rules + 7) / 8);
+	}
+
+	if (state->ctx.error != NULL) {
+		state->ctx.error->code = OPTPARSE_OK;
+		state->ctx.error->token = -1;
+		state->ctx.error->msg = NULL;
+		if (state->ctx.error->buf != NULL
+		    && state->ctx.error->buf_size > 0) {
+			state->ctx.error->buf[0] = TERM;
+		}
+	}
+
+	/* If the index is given, the configuration is assumed to be sane. */
+	if (state->ctx.index == NULL && !(config->tune & OPTPARSE_CHECKED)
+	    && sanity_check(config)) {
+		report_error(state, -OPTPARSE_BADCONFIG,
+			     "Invalid parser configuration", NULL, -1);
+		state->error = -OPTPARSE_BADCONFIG;
+	}
+
+	return state->error;
+}
+
+int optparse_begin(struct opt_state *state, const struct opt_conf *config,
+		   const struct opt_context *ctx, union opt_data *result)
+{
+	struct parse_env env;
+	int error;
+
+	if (init_state(state, config, ctx, result) != OPTPARSE_OK) {
+		/* Nothing was allocated yet: do not use fail_parse(). */
+		return state->error;
+	}
+
+	env.config = config;
+	env.ctx = &state->ctx;
+	env.allocator = state->allocator;
+
+	error = assign_default(&env, result, &state->n_required);
+	if (error) {
+		fail_parse(state, error, "Error initializing default values",
+			   NULL, -1);
+	}
+
+	return state->error;
+}
+
+int optparse_feed(struct opt_state *state, const char *token)
+{
+	return feed_token(state, token, 0);
+}
+
+int optparse_end(struct opt_state *state)
+{
+	if (state->error >= OPTPARSE_OK && state->waiting != NULL) {
+		fail_parse(state, -OPTPARSE_BADSYNTAX, "Option needs value",
+			   state->waiting_token, state->argi);
+	}
+
+	if (state->error >= OPTPARSE_OK
+	    && state->n_required > state->positional_idx) {
+		const struct opt_rule *missing = lookup_arg_rule(state->config,
+							state->ctx.index,
+							state->positional_idx,
+							NULL);
+
+		fail_parse(state, -OPTPARSE_BADSYNTAX, "Missing argument",
+			   (missing != NULL) ? missing->action_data.argument.name
+					     : NULL,
+			   state->argi);
+	}
+
+	return state->error >= OPTPARSE_OK ? state->positional_idx
+					   : state->error;
+}
+
+int optparse_iter_begin(struct opt_state *state, const struct opt_conf *config,
+			const struct opt_context *ctx,
+			int argc, const char * const argv[])
+{
+	struct opt_context iter_ctx = {NULL};
+	const struct opt_index *index;
+	int i;
+
+	if (ctx != NULL) {
+		iter_ctx.index = ctx->index;
+		iter_ctx.error = ctx->error;
+		iter_ctx.stats = ctx->stats;
+	}
+
+	if (init_state(state, config, &iter_ctx, NULL) != OPTPARSE_OK) {
+		return state->error;
+	}
+
+	state->argv = argv;
+	state->argc = argc;
+
+	/* Mandatory arguments come first, so only those are counted. */
+	index = iter_ctx.index;
+	if (index != NULL) {
+		for (i = 0; i < index->n_pos
+		     && config->rules[index->pos_rules[i] - 1].action
+			== OPTPARSE_POSITIONAL; i++) {
+			state->n_required++;
+		}
+	} else {
+		for (i = 0; i < config->n_rules; i++) {
+			if (config->rules[i].action == OPTPARSE_POSITIONAL) {
+				state->n_required++;
+			}
+		}
+	}
+
+	return OPTPARSE_OK;
+}
+
+int optparse_next(struct opt_state *state, struct opt_event *event)
+{
+	const struct opt_rule *rule = NULL;
+	const char *value;
+	const char *msg = NULL;
+	int error;
+
+	while (rule == NULL) {
+		const char *token;
+
+		if (state->error < OPTPARSE_OK) {
+			return state->error;
+		}
+
+		if (state->pending != NULL) {
+			token = state->argv[state->argi - 1];
+		} else if (state->argi < state->argc) {
+			token = state->argv[state->argi++];
+			STATS_ADD(state->ctx.stats, tokens, 1);
+			if (state->skip_first) {
+				state->skip_first = false;
+				continue;
+			}
+		} else {
+			error = optparse_end(state);
+			return (error < OPTPARSE_OK) ? error : 0;
+		}
+
+		error = decode_token(state, token, &state->pending, &rule,
+				     &value, &msg);
+		if (error < OPTPARSE_OK) {
+			fail_parse(state, error, msg, token, state->argi - 1);
+			return error;
+		}
+	}
+
+	event->rule = rule;
+	event->value = value;
+	event->position = _is_argument(rule->action) ? state->positional_idx++
+						     : -1;
+	event->argi = state->argi - 1;
+
+	return 1;
+}
+
+int optparse_tokenize_inplace(char *line, const char **argv, int max_args)
+{
+	const char *msg;
+	char *token;
+	int argc = 0, ret;
+
+	while ((ret = next_token(&line, &token, &msg)) > 0) {
+		if (argc >= max_args) {
+			return -OPTPARSE_NOMEM;
+		}
+		argv[argc++] = token;
+	}
+
+	return (ret < 0) ? ret : argc;
+}
+
+int optparse_cmd_line(const struct opt_conf *config,
+		      const struct opt_context *ctx,
+		      union opt_data *result, char *line)
+{
+	struct opt_state state;
+	const char *msg;
+	char *token;
+	int ret = 0;
+
+	optparse_begin(&state, config, ctx, result);
+
+	while (state.error >= OPTPARSE_OK
+	       && (ret = next_token(&line, &token, &msg)) > 0) {
+		feed_token(&state, token, 0);
+	}
+
+	if (ret < 0) {
+		fail_parse(&state, ret, msg, NULL, state.argi);
+	}
+
+	return optparse_end(&state);
+}
+
+/**
+ * Parse a whole argument vector.
+ *
+ * If ctx->index is not NULL, it must have been compiled from config.
+ */
+static int generic_parser(const struct opt_conf *config,
+			  const struct opt_context *ctx,
+			  union opt_data *result,
+			  int argc, const char * const argv[])
+{
+	struct opt_state state;
+	int i;
+
+	optparse_begin(&state, config, ctx, result);
+
+	for (i = 0; i < argc && state.error >= OPTPARSE_OK; i++) {
+		/* A response file can add any number of arguments. */
+		feed_token(&state, argv[i], (state.ctx.files == NULL)
+					    ? (size_t)(argc - i) : 0);
+	}
+
+	return optparse_end(&state);
+}
+
+int optparse_cmd(const struct opt_conf *config,
+				 union opt_data *result,
+				 int argc, const char * const argv[])
+{
+	struct opt_context ctx = {NULL};
+
+	return generic_parser(config, &ctx, result, argc, argv);
+}
+
+int optparse_cmd_compiled(const struct opt_index *index,
+			  union opt_data *result,
+			  int argc, const char * const argv[])
+{
+	struct opt_context ctx = {NULL};
+
+	ctx.index = index;
+
+	return generic_parser(index->config, &ctx, result, argc, argv);
+}
+
+int optparse_cmd_ctx(const struct opt_conf *config,
+		     struct opt_context *ctx,
+		     union opt_data *result,
+		     int argc, const char * const argv[])
+{
+	return generic_parser(config, ctx, result, argc, argv);
+}
+
+int optparse_compile(const struct opt_conf *config, struct opt_index *index)
+{
+	const struct opt_allocator *allocator = get_allocator(config, NULL);
+	int rule_i;
+	unsigned int n_buckets = 1;
+	int n_long = 0, n_pos;
+
+	memset(index, 0, sizeof(*index));
+	index->config = config;
+	index->allocator = allocator;
+
+	if (sanity_check(config)) {
+		return -OPTPARSE_BADCONFIG;
+	}
+
+	for (rule_i = 0; rule_i < config->n_rules; rule_i++) {
+		const struct opt_rule *rule = config->rules + rule_i;
+
+		if (_is_argument(rule->action)) {
+			index->n_pos++;
+		} else if (rule->action_data.option.long_id != NULL) {
+			n_long++;
+		}
+	}
+
+	if (index->n_pos) {
+		index->pos_rules = allocator->alloc(allocator->user,
+					(size_t)index->n_pos
+					* sizeof(*index->pos_rules));
+		if (index->pos_rules == NULL) {
+			return -OPTPARSE_NOMEM;
+		}
+	}
+
+	/* Keep the load factor under 1/2 so that probe sequences are short. */
+	while (n_long && n_buckets < 2u * (unsigned int)n_long) {
+		n_buckets <<= 1;
+	}
+
+	if (n_long) {
+		size_t table_size = n_buckets * sizeof(*index->long_ids);
+
+		index->long_ids = allocator->alloc(allocator->user, table_size);
+		if (index->long_ids == NULL) {
+			optparse_index_free(index);
+			return -OPTPARSE_NOMEM;
+		}
+		memset(index->long_ids, 0, table_size);
+		index->long_mask = n_buckets - 1;
+	}
+
+	/* When an id is repeated, the first rule wins, like in find_opt_rule. */
+	for (rule_i = 0, n_pos = 0; rule_i < config->n_rules; rule_i++) {
+		const struct opt_rule *rule = config->rules + rule_i;
+		unsigned char short_id;
+		const char *long_id;
+
+		if (_is_argument(rule->action)) {
+			index->pos_rules[n_pos++] = rule_i + 1;
+			continue;
+		}
+
+		short_id = (unsigned char)rule->action_data.option.short_id;
+		long_id = rule->action_data.option.long_id;
+
+		if (short_id && !index->short_ids[short_id]) {
+			index->short_ids[short_id] = rule_i + 1;
+		}
+
+		if (long_id != NULL
+		    && find_indexed_rule(index, long_id, 0, NULL) == NULL) {
+			uint32_t slot = hash_long_id(long_id);
+
+			while (index->long_ids[slot &= index->long_mask]) {
+				slot++;
+			}
+			index->long_ids[slot] = rule_i + 1;
+		}
 	}
 
-	return ret;
+	if (n_pos && ((config->tune & OPTPARSE_COLLECT_LAST_POS)
+		      || _is_collect(real_action(config->rules
+						 + index->pos_rules[n_pos - 1]
+						 - 1)))) {
+		index->last_pos = index->pos_rules[n_pos - 1];
+	}
+
+	return OPTPARSE_OK;
 }
 
-static bool _match_optionkey(struct opt_optionkey opt_key,
-							 const char *long_id, char short_id)
+void optparse_index_free(struct opt_index *index)
 {
-	return (short_id && opt_key.short_id == short_id)
-	       || ((long_id != NULL) && (opt_key.long_id != NULL)
-		   && strcmp(long_id, opt_key.long_id) == 0);
+	if (index->allocator != NULL) {
+		index->allocator->free(index->allocator->user, index->long_ids);
+		index->allocator->free(index->allocator->user, index->pos_rules);
+	}
+	index->long_ids = NULL;
+	index->pos_rules = NULL;
 }
 
 /**
- * Find a rule with the given short id or long id.
- *
- * A short id of 0 never matches. A NULL long id never matches.
+ * Lines to be parsed by optparse_cmd_batch().
  */
-static const struct opt_rule *find_opt_rule(const struct opt_conf *config,
-					    const char *long_id,
-					    char short_id)
+struct opt_batch {
+	const struct opt_index *index;
+	const int *argc;
+	const char * const **argv;
+	union opt_data *results;
+	/** If not NULL, results is scratch space for one line and the values
+	 *  are moved here. */
+	struct opt_columns *cols;
+	int *status;
+};
+
+/**
+ * Move the results of a line to the columns.
+ */
+static void store_columns(const struct opt_conf *config,
+			  struct opt_columns *cols, size_t line,
+			  const union opt_data *result,
+			  const unsigned char *given)
 {
-	const struct opt_rule *this_rule = config->rules;
-	int i = config->n_rules;
+	int rule_i;
 
-	/* This iteration seems weird but it provides perceptible code size
-	 * savings in both gcc and clang (at least in cortexm/thumb).*/
-	while(i--) {
-		if (!_is_argument(this_rule->action)
-		    && _match_optionkey(this_rule->action_data.option, long_id,
-					short_id)
-		    ) {
-			return this_rule;
+	for (rule_i = 0; rule_i < config->n_rules; rule_i++) {
+		size_t size = optparse_column_size(config->rules + rule_i);
+
+		/* All members of the union start at its beginning. */
+		if (size != 0) {
+			memcpy((char *)cols->values[rule_i] + line * size,
+			       result + rule_i, size);
 		}
-		this_rule++;
-	}
 
-	return NULL;
+		if (given[rule_i / 8] & (1u << rule_i % 8)) {
+			cols->given[rule_i][line / 8] |=
+					(unsigned char)(1u << line % 8);
+		}
+	}
 }
 
 /**
- * Find the positional argument handler for the arg_n-th position (arg_n counts
- * from zero).
- *
- * If repeat_last is true, if arg_n is greater than or equal to the number of
- * available handler, the last one (if any) is returned.
- *
- * @returns     pointer to the matching rule, or NULL if none is found.
+ * Parse lines [begin, end) of a batch.
  */
-static const struct opt_rule *find_arg_rule(const struct opt_conf *config,
-					    int arg_n)
+static void parse_lines(struct opt_batch *batch, size_t begin, size_t end)
 {
-	int rule_i;
-	int last_handler;
-	int handlers_found = 0;
-	bool repeat_last = !!(config->tune & OPTPARSE_COLLECT_LAST_POS);
+	const struct opt_conf *config = batch->index->config;
+	const struct opt_allocator *allocator = batch->index->allocator;
+	size_t n_rules = (size_t)config->n_rules;
+	union opt_data *scratch = NULL;
+	unsigned char *given = NULL;
+	struct opt_error err = {0};
+	struct opt_context ctx = {NULL};
+	size_t i;
 
-	for (rule_i = 0; rule_i < config->n_rules; rule_i++) {
-		const struct opt_rule this_rule = config->rules[rule_i];
+	ctx.index = batch->index;
+	/* Do not print anything. */
+	ctx.error = &err;
 
-		if (_is_argument(this_rule.action)) {
-			handlers_found++;
-			last_handler = rule_i;
-			if (handlers_found > arg_n) {
-				return config->rules + rule_i;
+	if (batch->cols != NULL) {
+		scratch = allocator->alloc(allocator->user,
+					   n_rules * sizeof(*scratch)
+					   + (n_rules + 7) / 8);
+		if (scratch == NULL) {
+			for (i = begin; i < end; i++) {
+				batch->status[i] = -OPTPARSE_NOMEM;
 			}
+			return;
 		}
+		ctx.given = given = (unsigned char *)(scratch + n_rules);
 	}
 
-	return (repeat_last && handlers_found)? config->rules + last_handler
-						: NULL;
+	for (i = begin; i < end; i++) {
+		union opt_data *result = (scratch != NULL)
+					 ? scratch : batch->results + i * n_rules;
+
+		batch->status[i] = optparse_cmd_ctx(config, &ctx, result,
+						    batch->argc[i],
+						    batch->argv[i]);
+		if (scratch != NULL && batch->status[i] >= OPTPARSE_OK) {
+			store_columns(config, batch->cols, i, scratch, given);
+		}
+	}
+
+	if (scratch != NULL) {
+		allocator->free(allocator->user, scratch);
+	}
 }
 
+#ifdef OPTPARSE_THREADS
+
+#ifdef OPTPARSE_THREAD_CREATE
+/* A replacement for pthread_create(), e.g. to test start failures. */
+int OPTPARSE_THREAD_CREATE(pthread_t *thread, const pthread_attr_t *attr,
+			   void *(*start)(void *), void *arg);
+#else
+#define OPTPARSE_THREAD_CREATE pthread_create
+#endif
+
+/** Number of lines that a worker takes from its share at a time. */
+#define BATCH_CHUNK 32
+
+/** Shares start at a multiple of 8 lines, so that no two workers write to
+ * the same byte of a column bitmap. */
+#define ALIGN_LINE(n) ((n) & ~(size_t)7)
+
 /**
- * Get the memory location where the parse result should be stored.
+ * A thread of optparse_cmd_batch(), with its share of the lines.
  */
-static union opt_data *get_destination(const struct opt_conf *config,
-					const struct opt_rule *rule,
-					union opt_data *result_base)
+struct batch_worker {
+	struct opt_batch *batch;
+	struct batch_worker *workers;
+	int n_workers;
+	/** Protects next and end. */
+	pthread_mutex_t lock;
+	size_t next, end;
+	pthread_t thread;
+};
+
+/**
+ * Take up to BATCH_CHUNK lines from the share of a worker.
+ *
+ * @return  false if the share was empty.
+ */
+static bool take_chunk(struct batch_worker *w, size_t *begin, size_t *end)
 {
-	return result_base + (rule - config->rules);
+	bool found;
+
+	pthread_mutex_lock(&w->lock);
+	found = w->next < w->end;
+	if (found) {
+		*begin = w->next;
+		*end = (w->end - w->next > BATCH_CHUNK) ? w->next + BATCH_CHUNK
+							: w->end;
+		w->next = *end;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return found;
 }
 
 /**
- * Copy over the default values from the rules array to the result array.
- *
- * For custom actions, the callback will be called with value = NULL.
+ * Move the upper half of the share of some other worker to w.
  *
- * This procedure also counts the number of required positional arguments and
- * returns it in n_required (which must NOT be null).
- *
- * On error, n_required may not be accurate.
- *
- * This procedure ensures guarantees that no result item will have a wild
- * pointer in d_str (i.e, it will point to an allocated block or be NULL.)
+ * @return  false if all other workers are out of lines.
  */
-static int assign_default(const struct opt_conf *config,
-			  union opt_data *result, int *n_required)
+static bool steal_lines(struct batch_worker *w)
 {
-	int rule_i;
-	int error = 0;
-	int positional_idx = 0;
-	int _required = 0;
+	int i;
 
-	for (rule_i = 0; !error && rule_i < config->n_rules; rule_i++) {
-		enum OPTPARSE_ACTIONS action;
-		const struct opt_rule *this_rule = config->rules + rule_i;
-		const char *msg = NULL;
+	for (i = 1; i < w->n_workers; i++) {
+		struct batch_worker *victim = w->workers
+			+ (w - w->workers + i) % w->n_workers;
+		size_t begin = 0, end = 0;
 
-		if (!_is_optional(this_rule->action)) {
-			_required++;
+		pthread_mutex_lock(&victim->lock);
+		if (victim->end - victim->next >= 16) {
+			begin = victim->next
+				+ ALIGN_LINE((victim->end - victim->next) / 2);
+			end = victim->end;
+			victim->end = begin;
 		}
+		pthread_mutex_unlock(&victim->lock);
 
-		if (_is_argument(this_rule->action)) {
-			positional_idx++;
+		if (begin < end) {
+			pthread_mutex_lock(&w->lock);
+			w->next = begin;
+			w->end = end;
+			pthread_mutex_unlock(&w->lock);
+			return true;
 		}
+	}
 
-		action = real_action(this_rule);
+	return false;
+}
 
-		if (action == OPTPARSE_STR
-		    && this_rule->default_value.d_str != NULL) {
-			result[rule_i].d_str = my_strdup(this_rule->default_value.d_str);
-			if (result[rule_i].d_str == NULL) {
-				P_DEBUG("initialization failed: out of memory\n");
-				error = -OPTPARSE_NOMEM;
-			}
-		} else if (action != OPTPARSE_CUSTOM_ACTION) {
-			result[rule_i] = this_rule->default_value;
-		} else {
-			error = do_user_callback(this_rule, result + rule_i,
-						 positional_idx, NULL, &msg);
-			safe_fputs(msg, HELP_STREAM);
-			if (error) {
-				P_DEBUG("User cb at index %d failed in init with code %d.\n",
-						rule_i, error);
-			}
-		}
-	}
+static void *batch_thread(void *arg)
+{
+	struct batch_worker *w = arg;
+	size_t begin, end;
 
-	/* If we exited early, ensure that we do not leave any wild pointer.
-	 * We will have to free them later. */
-	for (; rule_i < config->n_rules; rule_i++) {
-		if (real_action(config->rules + rule_i) == OPTPARSE_STR) {
-			result[rule_i].d_str = NULL;
+	do {
+		while (take_chunk(w, &begin, &end)) {
+			parse_lines(w->batch, begin, end);
 		}
-	}
+	} while (steal_lines(w));
 
-	*n_required = _required;
+	return NULL;
+}
 
-	return error;
+/**
+ * Number of workers to use when the caller does not say.
+ */
+static int default_workers(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (n > 0 && n < INT_MAX) ? (int)n : 1;
+#else
+	return 1;
+#endif
 }
 
+#endif /* OPTPARSE_THREADS */
 
-void optparse_free_strings(const struct opt_conf *config, union opt_data *result)
+/**
+ * Parse all lines of a batch, with n_workers threads if possible.
+ */
+static int run_batch(struct opt_batch *batch, size_t n_lines, int n_workers)
 {
-	const struct opt_rule *this_rule = config->rules;
-	int i = config->n_rules;
+	size_t line;
+	int ret = OPTPARSE_OK;
+#ifdef OPTPARSE_THREADS
+	const struct opt_allocator *allocator = batch->index->allocator;
+	struct batch_worker *workers = NULL;
+	int i, n_started;
 
-	/* This iteration seems weird but it provides perceptible code size savings
-	 * in both gcc and clang (at least in cortexm/thumb).*/
-	while(i--) {
-		if (real_action(this_rule) == OPTPARSE_STR) {
-			free(result->d_str);
-			result->d_str = NULL;
+	if (n_workers <= 0) {
+		n_workers = default_workers();
+	}
+	if ((size_t)n_workers > n_lines / BATCH_CHUNK) {
+		n_workers = (int)(n_lines / BATCH_CHUNK);
+	}
+
+	if (n_workers > 1) {
+		workers = allocator->alloc(allocator->user,
+					   (size_t)n_workers * sizeof(*workers));
+	}
+
+	if (workers != NULL) {
+		for (i = 0; i < n_workers; i++) {
+			workers[i].batch = batch;
+			workers[i].workers = workers;
+			workers[i].n_workers = n_workers;
+			pthread_mutex_init(&workers[i].lock, NULL);
+			workers[i].next = ALIGN_LINE(n_lines * (size_t)i
+						     / (size_t)n_workers);
+			workers[i].end = (i + 1 < n_workers)
+					 ? ALIGN_LINE(n_lines * (size_t)(i + 1)
+						      / (size_t)n_workers)
+					 : n_lines;
 		}
-		result++;
-		this_rule++;
+
+		/* If a thread cannot be started, the others steal its share. */
+		for (n_started = 1; n_started < n_workers; n_started++) {
+			if (OPTPARSE_THREAD_CREATE(&workers[n_started].thread,
+						   NULL, batch_thread,
+						   workers + n_started)) {
+				break;
+			}
+		}
+
+		batch_thread(workers);
+
+		for (i = 1; i < n_started; i++) {
+			pthread_join(workers[i].thread, NULL);
+		}
+		/* Shares too small to be stolen are left in the workers that
+		 * were not started. */
+		for (i = n_started; i < n_workers; i++) {
+			size_t begin, end;
+
+			while (take_chunk(workers + i, &begin, &end)) {
+				parse_lines(batch, begin, end);
+			}
+		}
+		for (i = 0; i < n_workers; i++) {
+			pthread_mutex_destroy(&workers[i].lock);
+		}
+		allocator->free(allocator->user, workers);
+	} else {
+		parse_lines(batch, 0, n_lines);
 	}
+#else /* OPTPARSE_THREADS */
+	(void)n_workers;
+	parse_lines(batch, 0, n_lines);
+#endif /* OPTPARSE_THREADS */
+
+	for (line = 0; line < n_lines; line++) {
+		if (batch->status[line] == -OPTPARSE_NOMEM) {
+			return -OPTPARSE_NOMEM;
+		}
+		if (batch->status[line] < OPTPARSE_OK) {
+			ret = -OPTPARSE_BADSYNTAX;
+		}
+	}
+
+	return ret;
 }
 
-int optparse_cmd(const struct opt_conf *config,
-				 union opt_data *result,
-				 int argc, const char * const argv[])
+int optparse_cmd_batch(const struct opt_index *index, size_t n_lines,
+		       const int argc[], const char * const *argv[],
+		       union opt_data *results, int status[], int n_workers)
 {
-	int error = 0, i, no_more_options = 0;
-	/* Index of the next positional argument */
-	int positional_idx = 0;
-	int n_required;
-	/* Used for handling combined switches like -axf (equivalent to -a -x -f)
-	 * Instead of advancing argv, we keep reading from the string*/
-	const char *pending_opt = NULL;
+	struct opt_batch batch = {
+		.index = index, .argc = argc, .argv = argv,
+		.results = results, .status = status
+	};
 
-	/* TODO: remove assert, return badconfig */
-	if (sanity_check(config)) {
-		return -OPTPARSE_BADCONFIG;
-	}
+	return run_batch(&batch, n_lines, n_workers);
+}
 
-	i = (config->tune & OPTPARSE_IGNORE_ARGV0) ? 1 : 0;
+size_t optparse_column_size(const struct opt_rule *rule)
+{
+	enum OPTPARSE_ACTIONS action = real_action(rule);
 
-	error = assign_default(config, result, &n_required);
-	if (error) {
-		P_ERR("Error initializing default values.\n");
+	switch (action) {
+		case OPTPARSE_IGNORE:
+		case OPTPARSE_IGNORE_SWITCH:
+		case OPTPARSE_DO_HELP:
+			return 0;
+		case OPTPARSE_SET_BOOL:
+		case OPTPARSE_UNSET_BOOL:
+			return sizeof(bool);
+		case OPTPARSE_INT:
+		case OPTPARSE_UINT:
+		case OPTPARSE_COUNT:
+			return sizeof(int);
+		case OPTPARSE_FLOAT:
+			return sizeof(float);
+		case OPTPARSE_DOUBLE:
+			return sizeof(double);
+		case OPTPARSE_INT64:
+		case OPTPARSE_UINT64:
+		case OPTPARSE_SIZE:
+		case OPTPARSE_DURATION:
+			return sizeof(int64_t);
+		case OPTPARSE_STR:
+		case OPTPARSE_STR_NOCOPY:
+			return sizeof(char *);
+		case OPTPARSE_VIEW:
+			return sizeof(struct opt_view);
+		default:
+			return _is_array(action) ? sizeof(struct opt_array)
+						 : sizeof(union opt_data);
 	}
+}
 
-	while (error >= OPTPARSE_OK && i < argc) {
-		const char *key, *value, *msg = NULL;
-		const struct opt_rule *curr_rule = NULL;
-		int positional_idx_delta = 0;
+/** Round a size up so that the next column is suitably aligned. */
+#define COLUMN_ALIGN(n) (((n) + sizeof(union opt_data) - 1) \
+			 / sizeof(union opt_data) * sizeof(union opt_data))
 
-		if (!no_more_options
-		    && ((pending_opt != NULL)
-			|| str_notempty(key = strip_dash(argv[i])))) {
+int optparse_columns_init(const struct opt_index *index, size_t n_lines,
+			  struct opt_columns *cols)
+{
+	const struct opt_conf *config = index->config;
+	const struct opt_allocator *allocator = index->allocator;
+	size_t n_rules = (size_t)config->n_rules;
+	size_t bitmap_size = (n_lines + 7) / 8;
+	size_t total, i;
+	char *block;
 
-			bool is_long;
+	/* Pointer arrays first, then the columns, then the bitmaps. */
+	total = COLUMN_ALIGN(n_rules * (sizeof(void *) + sizeof(char *)));
+	for (i = 0; i < n_rules; i++) {
+		total += COLUMN_ALIGN(optparse_column_size(config->rules + i)
+				      * n_lines);
+	}
+	total += n_rules * bitmap_size;
 
-			if (pending_opt == NULL) {
-				const char *tmp_key;
-				is_long = (tmp_key = strip_dash(key)) != NULL;
+	block = allocator->alloc(allocator->user, total);
+	if (block == NULL) {
+		return -OPTPARSE_NOMEM;
+	}
+	memset(block, 0, total);
 
-				if (is_long) {
-					key = tmp_key;
-				}
+	cols->n_lines = n_lines;
+	cols->allocator = allocator;
+	cols->values = (void **)block;
+	cols->given = (unsigned char **)(cols->values + n_rules);
+	block += COLUMN_ALIGN(n_rules * (sizeof(void *) + sizeof(char *)));
 
-				if (is_long && tmp_key[0] == TERM) { /* we read a "--" */
-					no_more_options = 1;
-					goto parse_loop_end;
-				}
-			} else { /* pending_opt != NULL, we have combined switches */
-				is_long = false;
-				key = pending_opt;
-				pending_opt = NULL; /* We reset this because we need to check again
-						       if the current option is a switch*/
-			}
-
-			curr_rule = find_opt_rule(
-				config, is_long ? key : NULL,
-						  (!is_long) ? key[0] : 0);
-
-			if (curr_rule != NULL) {
-				if (curr_rule->action == OPTPARSE_DO_HELP) {
-					do_help(config);
-					error = -OPTPARSE_REQHELP; /* BYE! */
-				} else if (NEEDS_VALUE(curr_rule)) {
-					if (!is_long && key[1] != TERM) {
-						/* This allows one to write the option value like -d12.6 */
-						value = key + 1;
-					} else if (i < (argc - 1)) {
-						/* "i" is only incremented here and at the end of the loop */
-						value = argv[++i];
-					} else {
-						msg = "Option needs value";
-						error = -OPTPARSE_BADSYNTAX; /* BYE! */
-					}
-				} else { /* Handle switches (no arguments) */
-					value = NULL;
-					if (!is_long && key[1] != TERM) {
-						pending_opt = key + 1;
-					}
-				}
-			} else {
-				msg = "Unknown option";
-				error = -OPTPARSE_BADSYNTAX;
-			}
-		} else {
-			curr_rule = find_arg_rule(config, positional_idx);
-			value = argv[i];
-			positional_idx_delta = 1;
+	for (i = 0; i < n_rules; i++) {
+		size_t size = optparse_column_size(config->rules + i) * n_lines;
 
-			if (positional_idx > OPTPARSE_MAX_POSITIONAL) {
-				msg = "Max number of arguments exceeded";
-				error = -OPTPARSE_BADSYNTAX;
-			}
+		cols->values[i] = (size != 0) ? block : NULL;
+		block += COLUMN_ALIGN(size);
+	}
 
-			if (curr_rule == NULL) {
-				msg = "Too many arguments";
-				error = -OPTPARSE_BADSYNTAX; /* BYE! */
-			}
-		}
+	for (i = 0; i < n_rules; i++) {
+		cols->given[i] = (unsigned char *)block;
+		block += bitmap_size;
+	}
 
-		if (error >= OPTPARSE_OK && curr_rule != NULL) {
-			error = do_action(curr_rule,
-					  get_destination(config, curr_rule, result),
-					  positional_idx, value, &msg); /* BYE? */
-		}
+	return OPTPARSE_OK;
+}
 
-		positional_idx += positional_idx_delta;
+void optparse_columns_free(const struct opt_index *index,
+			   struct opt_columns *cols)
+{
+	const struct opt_conf *config = index->config;
+	const struct opt_allocator *allocator = get_allocator(config, NULL);
+	int rule_i;
 
-		if (msg) {
-			P_ERR("%s: %s\n", msg, argv[i]);
-		}
+	for (rule_i = 0; rule_i < config->n_rules; rule_i++) {
+		enum OPTPARSE_ACTIONS action = real_action(config->rules
+							   + rule_i);
+		size_t line;
 
-parse_loop_end:
-		if (pending_opt == NULL) {
-			i++; /* "i" is only incremented here and above */
+		for (line = 0; line < cols->n_lines; line++) {
+			if (action == OPTPARSE_STR) {
+				allocator->free(allocator->user,
+					((char **)cols->values[rule_i])[line]);
+			} else if (_is_array(action)) {
+				allocator->free(allocator->user,
+					((struct opt_array *)
+					 cols->values[rule_i])[line].items.any);
+			}
 		}
 	}
 
-	if (error >= OPTPARSE_OK && n_required > positional_idx) {
-		P_ERR("%d argument required but only %d given\n", n_required,
-		      positional_idx);
-		error = -OPTPARSE_BADSYNTAX;
-	}
+	cols->allocator->free(cols->allocator->user, cols->values);
+	cols->values = NULL;
+	cols->given = NULL;
+	cols->n_lines = 0;
+}
 
-	if (error < OPTPARSE_OK) {
-		optparse_free_strings(config, result);
-	}
+int optparse_cmd_batch_columns(const struct opt_index *index, size_t n_lines,
+			       const int argc[], const char * const *argv[],
+			       struct opt_columns *cols, int status[],
+			       int n_workers)
+{
+	struct opt_batch batch = {
+		.index = index, .argc = argc, .argv = argv,
+		.cols = cols, .status = status
+	};
 
-	return error >= OPTPARSE_OK? positional_idx : error;
+	return run_batch(&batch, n_lines, n_workers);
 }
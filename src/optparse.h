@@ -41,6 +41,10 @@
 #include <limits.h>
 #include <stdbool.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * Used to indicate that an option has no short (i.e. single character) variant.
  */
@@ -54,8 +58,8 @@
  */
 enum OPTPARSE_RESULT {
 	OPTPARSE_OK,            /**< Parsing suceeded */
-	OPTPARSE_NOMEM,         /**< Not enough memory. Only OPTPARSE_STR or a
-				     custom parser may cause this error. */
+	OPTPARSE_NOMEM,         /**< Not enough memory, or not enough room in
+				     a caller supplied buffer. */
 	OPTPARSE_BADSYNTAX,     /**< Command line is wrongly formed */
 	OPTPARSE_BADCONFIG,     /**< The parser configuration is invalid. */
 	OPTPARSE_REQHELP        /**< The help option was requested. */
@@ -63,6 +67,10 @@ enum OPTPARSE_RESULT {
 
 /**
  * Built-in actions for options.
+ *
+ * The values are part of the binary interface of the shared library: adding
+ * an action in the middle renumbers the ones after it, so the SOVERSION in
+ * the makefile must be bumped (this happened in 1.0).
  */
 enum OPTPARSE_ACTIONS {
 	/** Ignore a key and its value. Takes 1 argument. */
@@ -77,15 +85,35 @@ enum OPTPARSE_ACTIONS {
 	// TODO: figure out if this is needed
 	//OPTPARSE_CUSTOM_ACTION_FAT, /**< */
 
-	/** Parse the value as an unsigned int and store it in opt_data::d_uint */
+	/** Parse the value as an unsigned int and store it in opt_data::d_uint.
+	 *  See optparse_conv_uint(). */
 	OPTPARSE_UINT,
-	/** Parse the value as an int and store it in opt_data::d_int */
+	/** Parse the value as an int and store it in opt_data::d_int.
+	 *  See optparse_conv_int(). */
 	OPTPARSE_INT,
-	/** Parse the value as float and store it in opt_data::d_float */
+	/** Parse the value as a 64 bit unsigned integer and store it in
+	 *  opt_data::d_uint64. See optparse_conv_uint(). */
+	OPTPARSE_UINT64,
+	/** Parse the value as a 64 bit signed integer and store it in
+	 *  opt_data::d_int64. See optparse_conv_int(). */
+	OPTPARSE_INT64,
+	/** Parse the value as float and store it in opt_data::d_float.
+	 *  See optparse_conv_float(). */
 	OPTPARSE_FLOAT,
+	/** Parse the value as double and store it in opt_data::d_double.
+	 *  See optparse_conv_double(). */
+	OPTPARSE_DOUBLE,
+	/** Parse a byte count with an optional unit suffix ("64Ki", "1.5G")
+	 *  and store it in opt_data::d_uint64. See optparse_conv_size(). */
+	OPTPARSE_SIZE,
+	/** Parse a time span with unit suffixes ("250ms", "1h30m") and store
+	 *  it in opt_data::d_int64, in nanoseconds.
+	 *  See optparse_conv_duration(). */
+	OPTPARSE_DURATION,
 
 	/** Make a copy of the value string with strdup() and place it
-	 *  in data::d_str. The string must be deallocated with free().
+	 *  in data::d_str. The string must be deallocated with free(),
+	 *  unless the parse was given an arena (see opt_context).
 	 */
 	OPTPARSE_STR,
 
@@ -96,6 +124,41 @@ enum OPTPARSE_ACTIONS {
 	 */
 	OPTPARSE_STR_NOCOPY,
 
+	/** Like OPTPARSE_STR_NOCOPY, but store the pointer and the length of
+	 *  the value in opt_data::d_view, so that it is measured only once.
+	 */
+	OPTPARSE_VIEW,
+
+	/** Collect the values of a repeated positional argument into an array
+	 *  of int64_t in opt_data::d_array.
+	 *
+	 * This is only valid as the action of the last positional argument,
+	 * which then takes all the remaining arguments, as if
+	 * OPTPARSE_COLLECT_LAST_POS was set. The array is allocated once per
+	 * parse and must be released with optparse_free_strings(), unless the
+	 * parse was given an arena.
+	 */
+	OPTPARSE_COLLECT_INT64,
+	/** Like OPTPARSE_COLLECT_INT64, but with an array of double. */
+	OPTPARSE_COLLECT_DOUBLE,
+	/** Like OPTPARSE_COLLECT_INT64, but with an array of pointers to the
+	 *  argument strings. The strings themselves are not copied. */
+	OPTPARSE_COLLECT_STR,
+
+	/** Append the value of an option to an array of int64_t in
+	 *  opt_data::d_array each time the option is given (e.g. -n 1 -n 2).
+	 *
+	 * The array grows geometrically, so appending takes amortized
+	 * constant time. It is released like the arrays of the collect
+	 * actions: with optparse_free_strings() or together with the arena.
+	 */
+	OPTPARSE_APPEND_INT64,
+	/** Like OPTPARSE_APPEND_INT64, but with an array of double. */
+	OPTPARSE_APPEND_DOUBLE,
+	/** Like OPTPARSE_APPEND_INT64, but with an array of pointers to the
+	 *  argument strings (e.g. -I a -I b). The strings are not copied. */
+	OPTPARSE_APPEND_STR,
+
 	/** Marker for the end of options that need a value.*/
 	_OPTPARSE_MAX_NEEDS_VALUE_END,
 
@@ -114,7 +177,8 @@ enum OPTPARSE_ACTIONS {
        /** Print the following strings, except if they are NULL:
 	* - opt_conf::helpstr
 	* - For each element of opt_conf::opt_rule:
-	*  - short_id (tab) long_id (tab) desc
+	*  - "-short_id, --long_id" (or the name of an argument) and desc, in
+	*    two aligned columns. Missing ids are left out.
 	*
 	* In addition it causes the parser to exit with code OPTPARSE_REQHELP.
 	*/
@@ -145,13 +209,39 @@ enum OPTPARSE_POSITIONAL_ACTIONS {
 //    OPTPARSE_POS_CUSTOM_ACTION_FAT = OPTPARSE_CUSTOM_ACTION_FAT,
 	OPTPARSE_POS_UINT = OPTPARSE_UINT,
 	OPTPARSE_POS_INT = OPTPARSE_INT,
+	OPTPARSE_POS_UINT64 = OPTPARSE_UINT64,
+	OPTPARSE_POS_INT64 = OPTPARSE_INT64,
+	OPTPARSE_POS_SIZE = OPTPARSE_SIZE,
+	OPTPARSE_POS_DURATION = OPTPARSE_DURATION,
 	OPTPARSE_POS_FLOAT = OPTPARSE_FLOAT,
+	OPTPARSE_POS_DOUBLE = OPTPARSE_DOUBLE,
 	OPTPARSE_POS_STR = OPTPARSE_STR,
 	OPTPARSE_POS_STR_NOCOPY = OPTPARSE_STR_NOCOPY,
+	OPTPARSE_POS_VIEW = OPTPARSE_VIEW,
+	OPTPARSE_POS_COLLECT_INT64 = OPTPARSE_COLLECT_INT64,
+	OPTPARSE_POS_COLLECT_DOUBLE = OPTPARSE_COLLECT_DOUBLE,
+	OPTPARSE_POS_COLLECT_STR = OPTPARSE_COLLECT_STR,
 };
 
+#ifdef OPTPARSE_WIDE_POSITIONAL
+/**
+ * Type used to number positional arguments.
+ *
+ * By default this is an unsigned char, which limits the number of positional
+ * arguments to OPTPARSE_MAX_POSITIONAL + 1 (values taken by an
+ * OPTPARSE_COLLECT_* rule do not count). Define OPTPARSE_WIDE_POSITIONAL
+ * when compiling both the library and the program to lift that limit. The
+ * only limit then is the range of argc.
+ */
+typedef size_t optparse_pos;
+
 /** Maximum number of positional arguments supported. */
+#define OPTPARSE_MAX_POSITIONAL INT_MAX
+#else /* OPTPARSE_WIDE_POSITIONAL */
+typedef unsigned char optparse_pos;
+
 #define OPTPARSE_MAX_POSITIONAL UCHAR_MAX
+#endif /* OPTPARSE_WIDE_POSITIONAL */
 
 /**
  * Identify a positional argument.
@@ -161,7 +251,7 @@ struct opt_positionalkey {
 	 * Note that options do not contribute to this count. Whether argv[0] is
 	 * counted depends on the status of OPTPARSE_IGNORE_ARGV0.
 	 */
-	unsigned char position;
+	optparse_pos position;
 
 	/** User-supplied name of this arguments (from opt_rule_t::name) .*/
 	const char *name;
@@ -178,21 +268,56 @@ union opt_key {
 	const struct opt_optionkey *option;
 };
 
+/**
+ * Reference to a string that is not copied, with its length.
+ */
+struct opt_view {
+	/** Start of the string. It is NUL terminated. */
+	const char *ptr;
+	/** Length of the string, not counting the terminator. */
+	size_t len;
+};
+
+/**
+ * Array of values, used by the OPTPARSE_COLLECT_* and OPTPARSE_APPEND_*
+ * actions.
+ */
+struct opt_array {
+	/** Pointer to the first element. The member used depends on the
+	 *  action. NULL if there are no elements. */
+	union {
+		int64_t *i64;
+		double *dbl;
+		const char **str;
+		void *any;
+	} items;
+	/** Number of elements. */
+	size_t count;
+};
+
 /**
  * Value type for options and arguments.
  */
 union opt_data {
 	int d_int;
 	unsigned int d_uint;
+	int64_t d_int64;
+	uint64_t d_uint64;
 	bool d_bool;
 	float d_float;
+	double d_double;
 	/** Pointer to a string allocated by optparse.
-	 *  This string must be free()d by the user
+	 *  This string must be free()d by the user, unless it was copied
+	 *  into an arena.
 	 */
 	char *d_str;
 	/** Pointer to a string, constant variant.
 	 * This will just point to an argv[] element.*/
 	const char *d_cstr;
+	/** String and length, used by OPTPARSE_VIEW. */
+	struct opt_view d_view;
+	/** Values of a collected argument. */
+	struct opt_array d_array;
 	/** Generic callback data for custom parsers. */
 	void *data;
 
@@ -273,6 +398,7 @@ struct opt_rule {
 enum OPTPARSE_TUNABLES {
 	OPTPARSE_IGNORE_ARGV0_b,
 	OPTPARSE_COLLECT_LAST_POS_b,
+	OPTPARSE_CHECKED_b,
 };
 
 /** Indicates if argv[0] should be skipped */
@@ -282,8 +408,53 @@ enum OPTPARSE_TUNABLES {
     extra positional arguments (i.e. it "collects" them all) */
 #define OPTPARSE_COLLECT_LAST_POS (1 << OPTPARSE_COLLECT_LAST_POS_b)
 
+/** The configuration was validated when the program was built (for example,
+    by optparse.hpp) and is not checked again by each parse. */
+#define OPTPARSE_CHECKED (1 << OPTPARSE_CHECKED_b)
+
 typedef uint16_t optparse_tune; /**< Option bitfield */
 
+/**
+ * Memory allocator used by the parser.
+ *
+ * By default optparse uses malloc() and free(). If the library is compiled
+ * with OPTPARSE_NO_MALLOC, the default allocator always fails, so that
+ * programs without a heap do not need to link malloc().
+ */
+struct opt_allocator {
+	/** Allocate size bytes, suitably aligned for any type. Return NULL on
+	 * failure. */
+	void *(*alloc)(void *user, size_t size);
+	/** Release a block returned by alloc. Must accept NULL. */
+	void (*free)(void *user, void *ptr);
+	void *user;     /**< User context, passed to alloc and free. */
+};
+
+/**
+ * Destination of the help text.
+ *
+ * The help is rendered in memory and handed to write, normally in a single
+ * call.
+ */
+struct opt_sink {
+	/** Write len bytes of text. */
+	void (*write)(void *user, const char *text, size_t len);
+	void *user;     /**< User context, passed to write. */
+};
+
+/**
+ * Rendered help text of a configuration.
+ *
+ * Zero-initialize it. The text is rendered the first time it is needed and
+ * kept until optparse_help_cache_free() is called. Filling it is not thread
+ * safe: if several threads may print the help, call optparse_help_text()
+ * once beforehand.
+ */
+struct opt_help_cache {
+	char *text;     /**< Rendered text, or NULL if not rendered yet. */
+	size_t len;     /**< Length of text, without the terminator. */
+};
+
 /**
  * Configuration for the command line parser.
  */
@@ -297,8 +468,79 @@ struct opt_conf {
 	const struct opt_rule *rules;
 	int n_rules;              /**< Number of elements in rules. */
 	optparse_tune tune;       /**< Option bitfield. */
+	/** Allocator for all memory related to this configuration, or NULL
+	 * for the default one. */
+	const struct opt_allocator *allocator;
+	/** Where the help option writes the help, or NULL for stdout. */
+	const struct opt_sink *help_sink;
+	/** Cache for the help text, or NULL to render it each time. */
+	struct opt_help_cache *help_cache;
+	/** Help text rendered in advance (see OPTPARSE_HELP_TEXT), or NULL.
+	 *  If set, it is written as is and help_cache is not used. */
+	const char *help_text;
+	/** Option matcher generated by tools/matchgen.c (see
+	 *  OPTPARSE_MATCHER), or NULL. It receives either a long id or a short
+	 *  id, like the generic lookup, and returns the index of the rule or -1.
+	 *  If set, it is used instead of scanning the rules or the index.
+	 *  It is still called through this pointer, once per option; only
+	 *  the lookup is generated, not the parser itself. */
+	int (*matcher)(const char *long_id, char short_id);
+	/** Actions generated by tools/matchgen.c (see OPTPARSE_APPLY), or
+	 *  NULL. It receives the index of a rule, the value (NULL for
+	 *  switches) and the result of the rule, and runs the action of that
+	 *  rule. It returns an OPTPARSE_RESULT code as a custom action does, or
+	 *  OPTPARSE_DEFAULT_ACTION if the rule must be handled by the
+	 *  library. Like matcher, it is called through the pointer for each
+	 *  option or argument. */
+	int (*apply)(int rule, const char *value, union opt_data *dest,
+		     const char **msg);
 };
 
+/**
+ * Returned by opt_conf::apply for the rules it does not handle.
+ */
+#define OPTPARSE_DEFAULT_ACTION 1
+
+/**
+ * Refer to a help text generated at build time by tools/helpgen.c.
+ *
+ * Use it to initialize opt_conf::help_text in the header that defines the
+ * configuration. The generators include that header before the text exists,
+ * and define OPTPARSE_HELPGEN or OPTPARSE_MATCHGEN so that the reference
+ * becomes NULL. Define OPTPARSE_NO_GENERATED to get the same in a program
+ * that is built without the generated code.
+ */
+#if defined(OPTPARSE_HELPGEN) || defined(OPTPARSE_MATCHGEN) \
+	|| defined(OPTPARSE_NO_GENERATED)
+#define OPTPARSE_HELP_TEXT(name) NULL
+#else
+#define OPTPARSE_HELP_TEXT(name) (name)
+#endif
+
+/**
+ * Refer to an option matcher generated at build time by tools/matchgen.c.
+ *
+ * Like OPTPARSE_HELP_TEXT, but for opt_conf::matcher.
+ */
+#if defined(OPTPARSE_HELPGEN) || defined(OPTPARSE_MATCHGEN) \
+	|| defined(OPTPARSE_NO_GENERATED)
+#define OPTPARSE_MATCHER(name) NULL
+#else
+#define OPTPARSE_MATCHER(name) (name)
+#endif
+
+/**
+ * Refer to the actions generated by tools/matchgen.c, for opt_conf::apply.
+ *
+ * Like OPTPARSE_HELP_TEXT.
+ */
+#if defined(OPTPARSE_HELPGEN) || defined(OPTPARSE_MATCHGEN) \
+	|| defined(OPTPARSE_NO_GENERATED)
+#define OPTPARSE_APPLY(name) NULL
+#else
+#define OPTPARSE_APPLY(name) (name)
+#endif
+
 /**
  * Main interface to the option parser.
  *
@@ -332,16 +574,669 @@ int optparse_cmd(const struct opt_conf *config,
 		 int argc, const char * const argv[]);
 
 /**
- * Free all strings allocated by OPTPARSE_STR and OPTPARSE_POS_STR.
+ * Free all strings allocated by OPTPARSE_STR and OPTPARSE_POS_STR, and the
+ * arrays allocated by the OPTPARSE_COLLECT_* and OPTPARSE_APPEND_* actions.
  *
  * Note that on a parsing error all strings are automatically deallocated.
  *
- * This procedure will set all d_str fields to NULL, so it is safe to call
- * it more than once.
+ * This procedure will set all d_str fields to NULL (and all arrays to
+ * empty), so it is safe to call it more than once.
  */
 void optparse_free_strings(const struct opt_conf *config,
 			   union opt_data *result);
 
+struct opt_context;
+
+/**
+ * Like optparse_free_strings(), for strings allocated during a call to
+ * optparse_cmd_ctx() with a context that overrides the allocator.
+ */
+void optparse_free_strings_ctx(const struct opt_conf *config,
+			       const struct opt_context *ctx,
+			       union opt_data *result);
+
+/**
+ * Precompiled lookup tables for a parser configuration.
+ *
+ * optparse_cmd() scans the rules array for every option and positional
+ * argument it finds. Programs with many rules, or that parse many command
+ * lines, can build this index once with optparse_compile() and use
+ * optparse_cmd_compiled() instead, so that each lookup takes constant time.
+ *
+ * The index is not modified by the parser, so it can be shared between
+ * calls. The fields should be considered private.
+ */
+struct opt_index {
+	const struct opt_conf *config; /**< Configuration being indexed. */
+	/** For each short id, the index of its rule plus one (0 = none). */
+	int short_ids[UCHAR_MAX + 1];
+	/** Open addressing hash table of long ids. Elements hold the index of
+	 * the rule plus one (0 = empty bucket). */
+	int *long_ids;
+	unsigned int long_mask;   /**< Number of buckets minus one. */
+	/** Allocator that was used for the tables. */
+	const struct opt_allocator *allocator;
+	/** Index plus one of the rule for each position. */
+	int *pos_rules;
+	int n_pos;                /**< Number of positional argument rules. */
+	/** Index plus one of the rule that takes positions past n_pos, or 0
+	 * if extra arguments are not collected. */
+	int last_pos;
+};
+
+/**
+ * Build the lookup tables for a configuration.
+ *
+ * The configuration is checked once here, and not on every call to
+ * optparse_cmd_compiled(). The configuration must outlive the index.
+ *
+ * @return  OPTPARSE_OK, -OPTPARSE_BADCONFIG if the configuration is invalid or
+ *          -OPTPARSE_NOMEM if the table could not be allocated.
+ */
+int optparse_compile(const struct opt_conf *config, struct opt_index *index);
+
+/**
+ * Release the memory held by an index built with optparse_compile().
+ */
+void optparse_index_free(struct opt_index *index);
+
+/**
+ * Like optparse_cmd(), but use a precompiled index.
+ */
+int optparse_cmd_compiled(const struct opt_index *index,
+			  union opt_data *result,
+			  int argc, const char * const argv[]);
+
+/**
+ * Parse many command lines with the same configuration.
+ *
+ * Line i is parsed as optparse_cmd_compiled() would parse argc[i] and
+ * argv[i], into results + i * n_rules (n_rules being that of the indexed
+ * configuration), and the return value is stored in status[i]. Errors are
+ * not printed and the help is never shown.
+ *
+ * If the library is built with OPTPARSE_THREADS, the lines are split among
+ * n_workers threads (the calling thread being one of them). Each worker takes
+ * lines from its own share, and steals half of the remaining share of
+ * another worker when it runs out. Otherwise, or if n_workers is 1, the lines
+ * are parsed in the calling thread. If some threads cannot be started, their
+ * lines are parsed by the others.
+ *
+ * The allocator of the configuration must be thread safe. Strings in each
+ * result must be released with optparse_free_strings().
+ *
+ * @param   index       Precompiled configuration.
+ * @param   n_lines     Number of command lines.
+ * @param   argc        Number of arguments of each line.
+ * @param   argv        Arguments of each line.
+ * @param   results     Array of n_lines * n_rules elements.
+ * @param   status      Output: result of each line.
+ * @param   n_workers   Number of threads, or 0 for one per online CPU.
+ *
+ * @return  OPTPARSE_OK if all lines were parsed successfully,
+ *          -OPTPARSE_NOMEM if some line ran out of memory, otherwise
+ *          -OPTPARSE_BADSYNTAX.
+ */
+int optparse_cmd_batch(const struct opt_index *index, size_t n_lines,
+		       const int argc[], const char * const *argv[],
+		       union opt_data *results, int status[], int n_workers);
+
+/**
+ * Results of a batch, stored by rule instead of by line.
+ *
+ * Each rule has a column with the values of all lines, one after the
+ * other. The type of the elements is that of the opt_data member used by the
+ * action (bool for OPTPARSE_SET_BOOL, int for OPTPARSE_INT, struct opt_view
+ * for OPTPARSE_VIEW, etc.), and optparse_column_size() gives its size.
+ * Custom actions store the whole union opt_data. Rules that produce no
+ * value (ignored options and help) have no column.
+ *
+ * Lines that fail to parse are left as zeros.
+ *
+ * Allocate it with optparse_columns_init().
+ */
+struct opt_columns {
+	size_t n_lines;      /**< Number of lines. */
+	/** Column of each rule, or NULL. */
+	void **values;
+	/** For each rule, a bitmap of n_lines bits: bit i % 8 of byte i / 8 is
+	 *  set if the rule was given in line i. */
+	unsigned char **given;
+	/** Allocator used for the columns. */
+	const struct opt_allocator *allocator;
+};
+
+/**
+ * Size of the elements of the column of a rule, or 0 if it has none.
+ */
+size_t optparse_column_size(const struct opt_rule *rule);
+
+/**
+ * Allocate zeroed columns for n_lines lines of an indexed configuration.
+ *
+ * All columns and bitmaps are allocated in one block.
+ *
+ * @return  OPTPARSE_OK or -OPTPARSE_NOMEM.
+ */
+int optparse_columns_init(const struct opt_index *index, size_t n_lines,
+			  struct opt_columns *cols);
+
+/**
+ * Release the columns and the strings and arrays in them.
+ */
+void optparse_columns_free(const struct opt_index *index,
+			   struct opt_columns *cols);
+
+/**
+ * Like optparse_cmd_batch(), but store the results in columns.
+ *
+ * Scanning a single option across all lines then reads contiguous memory,
+ * and boolean and integer options take 1 or 4 bytes per line instead of
+ * sizeof(union opt_data).
+ *
+ * @param   cols    Columns allocated by optparse_columns_init() for at least
+ *                  n_lines lines.
+ */
+int optparse_cmd_batch_columns(const struct opt_index *index, size_t n_lines,
+			       const int argc[], const char * const *argv[],
+			       struct opt_columns *cols, int status[],
+			       int n_workers);
+
+/**
+ * Memory arena for strings copied by the parser.
+ *
+ * When a parse is given an arena, OPTPARSE_STR values (and defaults) are
+ * copied into it instead of being allocated one by one with malloc(), and
+ * they are all released together with optparse_arena_release().
+ *
+ * The arena can start empty (zero-initialized) or with a caller supplied
+ * buffer in buf and size. When it runs out of space, a new block is allocated;
+ * the blocks grow geometrically. The fields should otherwise be considered
+ * private.
+ *
+ * Strings in an arena must NOT be released with optparse_free_strings().
+ */
+struct opt_arena {
+	char *buf;      /**< Current block. */
+	size_t size;    /**< Size of the current block. */
+	size_t used;    /**< Bytes of the current block already in use. */
+	/** Blocks allocated by the arena, newest (i.e. the current one) first. */
+	struct opt_arena_block *blocks;
+	/** Allocator for the blocks. If NULL, the one of the first parse
+	 * that needs a block is used. */
+	const struct opt_allocator *allocator;
+};
+
+/**
+ * Make all the memory in an arena available again.
+ *
+ * All strings that were allocated in it become invalid. The biggest block
+ * allocated by the arena is kept, so an arena that is reused for many parses
+ * stops allocating memory.
+ */
+void optparse_arena_reset(struct opt_arena *arena);
+
+/**
+ * Free all blocks allocated by an arena.
+ *
+ * The arena is left empty and can be reused.
+ */
+void optparse_arena_release(struct opt_arena *arena);
+
+struct opt_loaded_file;
+
+/**
+ * Response files loaded during a parse.
+ *
+ * If opt_context::files is set, an argument of the form "@path" is replaced
+ * by the arguments contained in the file at path. The file is split like a
+ * command line (see optparse_tokenize_inplace()), with newlines counting as
+ * blanks, and may itself contain "@path" arguments.
+ *
+ * Files are memory mapped where possible and the arguments are parsed in
+ * place, so results like OPTPARSE_STR_NOCOPY point into the loaded files.
+ * They stay loaded until optparse_release_files() is called, even if the
+ * parse fails.
+ *
+ * "@path" after "--" or as the value of an option is not expanded.
+ *
+ * Zero-initialize it and set only the fields that are needed.
+ */
+struct opt_response_files {
+	/** Maximum nesting of response files, or 0 for the default (8). */
+	int max_depth;
+	/** Loaded files. Private. */
+	struct opt_loaded_file *loaded;
+	/** Allocator for the file records, or NULL to use the one of the first
+	 *  parse. */
+	const struct opt_allocator *allocator;
+};
+
+/**
+ * Unload all files loaded into files.
+ *
+ * Results that point into the files become invalid. The structure can be
+ * reused.
+ */
+void optparse_release_files(struct opt_response_files *files);
+
+#ifndef OPTPARSE_NO_HELP_FORMAT
+/**
+ * Render the help text of a configuration into a buffer.
+ *
+ * This is the text printed by the help option (see OPTPARSE_DO_HELP), with
+ * the descriptions aligned in a column. Like snprintf(), at most
+ * size - 1 characters are written, followed by a terminator, and the full
+ * length is returned, so buf can be NULL (with size 0) to measure it.
+ *
+ * @return  Length of the help text, without the terminator.
+ */
+size_t optparse_help_render(const struct opt_conf *config, char *buf,
+			    size_t size);
+
+/**
+ * Get the help text of a configuration.
+ *
+ * This is opt_conf::help_text if it is set. Otherwise the text is rendered
+ * into opt_conf::help_cache, using the configuration's allocator, the first
+ * time this is called.
+ *
+ * @param   len     If not NULL, receives the length of the text.
+ *
+ * @return  The help text, or NULL if the configuration has no cache or the
+ *          text could not be allocated.
+ */
+const char *optparse_help_text(const struct opt_conf *config, size_t *len);
+
+/**
+ * Free the text stored in opt_conf::help_cache, if any.
+ */
+void optparse_help_cache_free(const struct opt_conf *config);
+#endif /* OPTPARSE_NO_HELP_FORMAT */
+
+/**
+ * Write the help text to opt_conf::help_sink (or stdout).
+ *
+ * This is what the help option does. The text is opt_conf::help_text or
+ * comes from the cache if there is one, and otherwise is rendered into a
+ * temporary buffer. Either way it is written in one call. Only if the buffer
+ * cannot be allocated is the text rendered in small pieces.
+ *
+ * If the library is built with OPTPARSE_NO_HELP_FORMAT, the formatting code
+ * is left out and only opt_conf::help_text is written.
+ */
+void optparse_help(const struct opt_conf *config);
+
+#if defined(__unix__) || defined(__APPLE__)
+/**
+ * Sink function that writes to a file descriptor.
+ *
+ * Use it as opt_sink::write, with user pointing to an int holding the file
+ * descriptor. Short writes are retried.
+ */
+void optparse_fd_write(void *user, const char *text, size_t len);
+#endif
+
+/**
+ * Description of a parse error.
+ *
+ * If opt_context::error is set, errors are stored here instead of being
+ * printed to stderr, and the help option does not print the help. Nothing is
+ * written to any stream, so parses running in different threads do not
+ * interfere as long as each one has its own context.
+ *
+ * Zero-initialize it and set only the buffer, if needed.
+ */
+struct opt_error {
+	/** OPTPARSE_OK, or the error code returned by the parser. */
+	int code;
+	/** Index of the token that caused the error. Errors found at the end of
+	 *  the input (like missing arguments) have the number of tokens, and
+	 *  errors found before the first token have -1. */
+	int token;
+	/** Error message: a static string, the message of a custom action or
+	 *  NULL. */
+	const char *msg;
+	/** Buffer for the full message, including the token (or the name of the
+	 *  missing argument), or NULL. It is truncated to fit. */
+	char *buf;
+	size_t buf_size;   /**< Size of buf. */
+};
+
+/**
+ * Counters describing the work done by the parser.
+ *
+ * They are only updated if the library is built with OPTPARSE_STATS, and are
+ * added to rather than reset, so one structure can accumulate many parses.
+ * Parses in different threads need separate structures. Batch parses do not
+ * update them.
+ */
+struct opt_stats {
+	/** Tokens processed, including those of response files. */
+	unsigned long tokens;
+	/** Option lookups. */
+	unsigned long opt_lookups;
+	/** String comparisons made by the lookups. */
+	unsigned long str_compares;
+	/** Positional argument lookups. */
+	unsigned long pos_lookups;
+	/** Actions run, by action (for arguments, the positional action). */
+	unsigned long actions[_OPTPARSE_POSITIONAL_START];
+	/** Bytes allocated for OPTPARSE_STR copies, including defaults. */
+	size_t str_bytes;
+	/** Calls to custom actions, including those for default values. */
+	unsigned long callbacks;
+	/** Time spent in custom actions, in units of OPTPARSE_STATS_CLOCK()
+	 *  (the time stamp counter on x86, clock() elsewhere). */
+	uint64_t callback_ticks;
+};
+
+/**
+ * Optional settings for a single call to the parser.
+ *
+ * Zero-initialize it and set only the fields that are needed.
+ */
+struct opt_context {
+	/** Precompiled index (see optparse_compile()), or NULL. */
+	const struct opt_index *index;
+	/** Arena for OPTPARSE_STR copies, or NULL to allocate each one. */
+	struct opt_arena *arena;
+	/** Allocator for this call, or NULL to use opt_conf::allocator. */
+	const struct opt_allocator *allocator;
+	/** Where to load response files, or NULL to take "@path" literally. */
+	struct opt_response_files *files;
+	/** Where to store errors, or NULL to print them to stderr. */
+	struct opt_error *error;
+	/** Where to count the work done, or NULL. See opt_stats. */
+	struct opt_stats *stats;
+	/** Bitmap of (n_rules + 7) / 8 bytes, or NULL. If set, it is cleared
+	 *  and bit i % 8 of byte i / 8 is set if rule i is given in the command
+	 *  line. This tells values given by the user apart from defaults. */
+	unsigned char *given;
+};
+
+/**
+ * Like optparse_cmd(), with extra per-call settings.
+ *
+ * If the parse fails, strings copied to the arena during this call are
+ * discarded (unless the arena had to allocate a new block).
+ */
+int optparse_cmd_ctx(const struct opt_conf *config,
+		     struct opt_context *ctx,
+		     union opt_data *result,
+		     int argc, const char * const argv[]);
+
+/**
+ * State of an incremental parse.
+ *
+ * See optparse_begin(). The fields should be considered private.
+ */
+struct opt_state {
+	const struct opt_conf *config;
+	struct opt_context ctx;
+	union opt_data *result;
+	const struct opt_allocator *allocator;
+	/** Option that is waiting for its value in the next token. */
+	const struct opt_rule *waiting;
+	/** Token that named the waiting option. */
+	const char *waiting_token;
+	/** Arena position at the start, to roll back on error. */
+	size_t arena_mark;
+	struct opt_arena_block *arena_block;
+	/** Index of the next positional argument. */
+	int positional_idx;
+	int n_required;
+	/** Nesting level of response files. */
+	int depth;
+	/** OPTPARSE_OK, or the error that stopped the parse. */
+	int error;
+	bool no_more_options;
+	/** The next token is argv[0] and must be ignored. */
+	bool skip_first;
+	/** Arguments for optparse_next(). */
+	const char * const *argv;
+	int argc;
+	/** Number of tokens read (the index of the next one in argv). */
+	int argi;
+	/** Rest of a group of switches, for optparse_next(). */
+	const char *pending;
+};
+
+/**
+ * Start an incremental parse.
+ *
+ * Instead of passing a complete argument vector to optparse_cmd(), the
+ * tokens can be given one at a time with optparse_feed(), for example as
+ * they arrive from a socket, and the parse is finished with optparse_end().
+ * The result is the same as that of optparse_cmd_ctx() with the same tokens,
+ * but a bad token is reported as soon as it is fed.
+ *
+ * The default values are assigned to result here.
+ *
+ * @param   state   State to initialize.
+ * @param   config  Parser configuration.
+ * @param   ctx     Extra settings, or NULL. It is copied.
+ * @param   result  Array of config->n_rules elements.
+ *
+ * @return  OPTPARSE_OK, or a negative error code from OPTPARSE_RESULT.
+ */
+int optparse_begin(struct opt_state *state, const struct opt_conf *config,
+		   const struct opt_context *ctx, union opt_data *result);
+
+/**
+ * Parse one token.
+ *
+ * The token must remain valid as long as the result is used, since
+ * OPTPARSE_STR_NOCOPY and similar actions keep pointers to it.
+ *
+ * After an error, all memory allocated by the parse is already released and
+ * further calls return the same error, so the state can simply be dropped.
+ *
+ * @return  OPTPARSE_OK, or a negative error code from OPTPARSE_RESULT.
+ */
+int optparse_feed(struct opt_state *state, const char *token);
+
+/**
+ * Finish an incremental parse.
+ *
+ * This checks for a missing option value and for missing positional
+ * arguments.
+ *
+ * @return  Same as optparse_cmd().
+ */
+int optparse_end(struct opt_state *state);
+
+/**
+ * An option or argument found by optparse_next().
+ */
+struct opt_event {
+	/** Rule that matched. Its index is rule - config->rules. */
+	const struct opt_rule *rule;
+	/** Value given in the command line, or NULL for a switch. */
+	const char *value;
+	/** Number of the positional argument, or -1 for an option. */
+	int position;
+	/** Index in argv of the last token used (the value, if it was given
+	 *  as a separate token). */
+	int argi;
+};
+
+/**
+ * Start iterating over a command line.
+ *
+ * This is an alternative to optparse_cmd() for programs that store the
+ * options in their own structures. Each call to optparse_next() returns the
+ * next option or argument, with its value as a string. No result array is
+ * used: default values are not assigned, actions (including custom ones) are
+ * not run and nothing is allocated, so the cost depends only on what is
+ * given in argv and not on the number of rules.
+ *
+ * The values can be converted with optparse_conv_int() and friends.
+ * Response files are not expanded.
+ *
+ * @param   state   State to initialize.
+ * @param   config  Parser configuration.
+ * @param   ctx     Extra settings (only the index, the error context and the
+ *                  statistics are used), or NULL.
+ * @param   argc    Number of elements of argv.
+ * @param   argv    Arguments. They must outlive the events.
+ *
+ * @return  OPTPARSE_OK or -OPTPARSE_BADCONFIG.
+ */
+int optparse_iter_begin(struct opt_state *state, const struct opt_conf *config,
+			const struct opt_context *ctx,
+			int argc, const char * const argv[]);
+
+/**
+ * Get the next option or argument.
+ *
+ * Errors are detected as in optparse_cmd(). Missing values and missing
+ * positional arguments are reported by the call that reaches the end of argv.
+ * As with optparse_cmd(), a help option prints the help and returns
+ * -OPTPARSE_REQHELP.
+ *
+ * @param   state   State initialized with optparse_iter_begin().
+ * @param   event   Output. Only valid if 1 is returned.
+ *
+ * @return  1 if an event was returned, 0 at the end of argv, or a negative
+ *          error code from OPTPARSE_RESULT.
+ */
+int optparse_next(struct opt_state *state, struct opt_event *event);
+
+/**
+ * Split a command line into arguments, in place.
+ *
+ * Arguments are separated by blanks. Within an argument, single quotes
+ * preserve everything up to the closing quote, double quotes preserve
+ * everything except \" and \\, and outside quotes a backslash preserves the
+ * next character. As in a POSIX shell, quotes can be used anywhere within an
+ * argument and "" is an empty argument.
+ *
+ * The quotes and escapes are removed by rewriting line, and argv is filled
+ * with pointers into it. Nothing is allocated.
+ *
+ * @param   line        NUL terminated command line. It is modified.
+ * @param   argv        Output array.
+ * @param   max_args    Number of elements of argv.
+ *
+ * @return  The number of arguments, -OPTPARSE_NOMEM if there are more than
+ *          max_args, or -OPTPARSE_BADSYNTAX for an unterminated quote or a
+ *          trailing backslash.
+ */
+int optparse_tokenize_inplace(char *line, const char **argv, int max_args);
+
+/**
+ * Parse a command line string.
+ *
+ * This splits line as optparse_tokenize_inplace() does, but each argument
+ * is parsed as soon as it is split, so no argv array is needed and the line
+ * is traversed only once. OPTPARSE_IGNORE_ARGV0 applies to the first word.
+ *
+ * Results like OPTPARSE_STR_NOCOPY point into line, so it must outlive
+ * them.
+ *
+ * @param   config  Parser configuration.
+ * @param   ctx     Extra settings, or NULL.
+ * @param   result  Array of config->n_rules elements.
+ * @param   line    NUL terminated command line. It is modified.
+ *
+ * @return  Same as optparse_cmd().
+ */
+int optparse_cmd_line(const struct opt_conf *config,
+		      const struct opt_context *ctx,
+		      union opt_data *result, char *line);
+
+/**
+ * Convert a string to a signed integer.
+ *
+ * This is the conversion used by OPTPARSE_INT. It accepts the same syntax as
+ * strtol() with base 0 (decimal, "0x" hexadecimal or "0" octal, with an
+ * optional sign and leading blanks), but it does not depend on the locale and
+ * the whole string must be a number.
+ *
+ * It can be used by custom actions.
+ *
+ * @param   str     String to convert.
+ * @param   min     Minimum value accepted.
+ * @param   max     Maximum value accepted.
+ * @param   value   Output. Not valid on error.
+ * @param   msg     On error, it is set to an error message.
+ *
+ * @return  OPTPARSE_OK on success or -OPTPARSE_BADSYNTAX if the string is not
+ *          an integer or if it is out of range.
+ */
+int optparse_conv_int(const char *str, int64_t min, int64_t max,
+		      int64_t *value, const char **msg);
+
+/**
+ * Convert a string to an unsigned integer.
+ *
+ * Like optparse_conv_int(), but negative numbers are rejected (except for
+ * zero).
+ */
+int optparse_conv_uint(const char *str, uint64_t max, uint64_t *value,
+		       const char **msg);
+
+/**
+ * Convert a string to a double.
+ *
+ * This is the conversion used by OPTPARSE_DOUBLE. The result is correctly
+ * rounded and does not depend on the locale (the decimal separator is
+ * always '.'). The accepted syntax is that of strtod(), except for
+ * hexadecimal floats, and the whole string must be a number. Values that
+ * are too large for a double are an error; values that are too small become
+ * zero.
+ *
+ * @param   str     String to convert.
+ * @param   value   Output. Not modified on error.
+ * @param   msg     On error, it is set to an error message.
+ *
+ * @return  OPTPARSE_OK on success or -OPTPARSE_BADSYNTAX on error.
+ */
+int optparse_conv_double(const char *str, double *value, const char **msg);
+
+/**
+ * Convert a string to a float.
+ *
+ * Like optparse_conv_double(), but rounding directly to float.
+ */
+int optparse_conv_float(const char *str, float *value, const char **msg);
+
+/**
+ * Convert a byte count with an optional unit suffix.
+ *
+ * This is the conversion used by OPTPARSE_SIZE. The number is a decimal
+ * with an optional fractional part, followed by one of the decimal
+ * multipliers k (or K), M, G, T, P, E or the binary multipliers Ki, Mi, Gi,
+ * Ti, Pi, Ei, optionally followed by "B". A bare number or "B" means bytes.
+ * The result is computed exactly, with fractions of a byte truncated, so
+ * "1.5Ki" is 1536. Only the first 9 decimals are significant.
+ *
+ * @param   str     String to convert.
+ * @param   value   Output, in bytes. Not modified on error.
+ * @param   msg     On error, it is set to an error message.
+ *
+ * @return  OPTPARSE_OK on success or -OPTPARSE_BADSYNTAX on error.
+ */
+int optparse_conv_size(const char *str, uint64_t *value, const char **msg);
+
+/**
+ * Convert a time span with unit suffixes to nanoseconds.
+ *
+ * This is the conversion used by OPTPARSE_DURATION. The string is an
+ * optional sign followed by one or more decimal numbers, each with one of
+ * the units ns, us, ms, s, m (minutes), h or d, as in "1h30m" or "1.5s".
+ * A single number without a unit is a number of seconds. Fractions of a
+ * nanosecond are truncated.
+ *
+ * @param   str     String to convert.
+ * @param   value   Output, in nanoseconds. Not modified on error.
+ * @param   msg     On error, it is set to an error message.
+ *
+ * @return  OPTPARSE_OK on success or -OPTPARSE_BADSYNTAX on error.
+ */
+int optparse_conv_duration(const char *str, int64_t *value, const char **msg);
+
 /**
  * @defgroup initializers  Optparse initializers
  * @{
@@ -360,9 +1255,21 @@ void optparse_free_strings(const struct opt_conf *config,
 #define _OPTPARSE_CUSTOM_ACTION_INIT    _thin_callback
 #define _OPTPARSE_UINT_INIT             d_uint
 #define _OPTPARSE_INT_INIT              d_int
+#define _OPTPARSE_UINT64_INIT           d_uint64
+#define _OPTPARSE_INT64_INIT            d_int64
+#define _OPTPARSE_SIZE_INIT             d_uint64
+#define _OPTPARSE_DURATION_INIT         d_int64
 #define _OPTPARSE_FLOAT_INIT            d_float
+#define _OPTPARSE_DOUBLE_INIT           d_double
 #define _OPTPARSE_STR_INIT              d_str
 #define _OPTPARSE_STR_NOCOPY_INIT       d_cstr
+#define _OPTPARSE_VIEW_INIT             d_view.ptr
+#define _OPTPARSE_COLLECT_INT64_INIT    data
+#define _OPTPARSE_COLLECT_DOUBLE_INIT   data
+#define _OPTPARSE_COLLECT_STR_INIT      data
+#define _OPTPARSE_APPEND_INT64_INIT     data
+#define _OPTPARSE_APPEND_DOUBLE_INIT    data
+#define _OPTPARSE_APPEND_STR_INIT       data
 #define _OPTPARSE_DO_HELP_INIT          d_int
 
 /**
@@ -406,4 +1313,8 @@ void optparse_free_strings(const struct opt_conf *config,
 
 /** @} */
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* OPTPARSE_H */
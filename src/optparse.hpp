@@ -0,0 +1,651 @@
+/**
+ * @file
+ * @author	Juan I Carrano <juan@carrano.com.ar>
+ * @copyright	Copyright (c) 2010-2019 Juan I Carrano
+ * @copyright	All rights reserved.
+ * ```
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  * Neither the name of copyright holders nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * ```
+ *
+ * @brief C++ (20) wrapper with rule tables built at compile time.
+ *
+ * Rules are bound to the members of a struct, and the table is built and
+ * checked by the compiler:
+ *
+ *     struct opts { int verbose; const char *name; };
+ *
+ *     static constexpr auto parser = optparse::make_parser<opts>(
+ *             "Example program", OPTPARSE_IGNORE_ARGV0,
+ *             optparse::option<OPTPARSE_COUNT, &opts::verbose>(
+ *                     'v', "verbose", "Verbosity level"),
+ *             optparse::help('h', "help", "Show this help"),
+ *             optparse::argument<OPTPARSE_POS_STR_NOCOPY, &opts::name>(
+ *                     "name", "Your name"));
+ *
+ *     opts o;
+ *     int status = optparse::parse<parser>(o, argc, argv);
+ *
+ * The checks of the C parser are done by the compiler, along with checks
+ * that the type of each member matches its action and that no id is
+ * repeated. Options are found through a short id table and a perfect hash of
+ * the long ids, also built by the compiler, which are given to the C parser
+ * as opt_conf::matcher.
+ */
+
+#ifndef OPTPARSE_HPP
+#define OPTPARSE_HPP
+
+#include <array>
+#include <bit>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "optparse.h"
+
+namespace optparse {
+
+/**
+ * Type of the member that stores the result of each action, and how it is
+ * read from and written to an opt_data.
+ */
+template <OPTPARSE_ACTIONS A>
+struct action_traits;
+
+#define OPTPARSE_HPP_TRAITS(action, type_, member) \
+	template <> \
+	struct action_traits<action> { \
+		using type = type_; \
+		using default_type = type_; \
+		static constexpr opt_data make(type_ v) \
+		{ \
+			return {.member = v}; \
+		} \
+		static type_ get(const opt_data &d) { return d.member; } \
+		static void put(opt_data &d, type_ v) { d.member = v; } \
+	}
+
+OPTPARSE_HPP_TRAITS(OPTPARSE_UINT, unsigned int, d_uint);
+OPTPARSE_HPP_TRAITS(OPTPARSE_INT, int, d_int);
+OPTPARSE_HPP_TRAITS(OPTPARSE_UINT64, uint64_t, d_uint64);
+OPTPARSE_HPP_TRAITS(OPTPARSE_INT64, int64_t, d_int64);
+OPTPARSE_HPP_TRAITS(OPTPARSE_FLOAT, float, d_float);
+OPTPARSE_HPP_TRAITS(OPTPARSE_DOUBLE, double, d_double);
+OPTPARSE_HPP_TRAITS(OPTPARSE_SIZE, uint64_t, d_uint64);
+OPTPARSE_HPP_TRAITS(OPTPARSE_DURATION, int64_t, d_int64);
+OPTPARSE_HPP_TRAITS(OPTPARSE_STR, char *, d_str);
+OPTPARSE_HPP_TRAITS(OPTPARSE_STR_NOCOPY, const char *, d_cstr);
+OPTPARSE_HPP_TRAITS(OPTPARSE_VIEW, opt_view, d_view);
+OPTPARSE_HPP_TRAITS(OPTPARSE_COLLECT_INT64, opt_array, d_array);
+OPTPARSE_HPP_TRAITS(OPTPARSE_COLLECT_DOUBLE, opt_array, d_array);
+OPTPARSE_HPP_TRAITS(OPTPARSE_COLLECT_STR, opt_array, d_array);
+OPTPARSE_HPP_TRAITS(OPTPARSE_APPEND_INT64, opt_array, d_array);
+OPTPARSE_HPP_TRAITS(OPTPARSE_APPEND_DOUBLE, opt_array, d_array);
+OPTPARSE_HPP_TRAITS(OPTPARSE_APPEND_STR, opt_array, d_array);
+OPTPARSE_HPP_TRAITS(OPTPARSE_SET_BOOL, bool, d_bool);
+OPTPARSE_HPP_TRAITS(OPTPARSE_UNSET_BOOL, bool, d_bool);
+OPTPARSE_HPP_TRAITS(OPTPARSE_COUNT, int, d_int);
+
+#undef OPTPARSE_HPP_TRAITS
+
+/** Custom actions store whatever they want, so the member is an opt_data. */
+template <>
+struct action_traits<OPTPARSE_CUSTOM_ACTION> {
+	using type = opt_data;
+	using default_type = decltype(opt_data::_thin_callback);
+	static constexpr opt_data make(default_type f)
+	{
+		return {._thin_callback = f};
+	}
+	static opt_data get(const opt_data &d) { return d; }
+	static void put(opt_data &d, const opt_data &v) { d = v; }
+};
+
+/** Copy a result between an opt_data and the struct, in either direction. */
+template <class S>
+using transfer_fn = void (*)(S &s, opt_data &d, bool to_struct);
+
+/** A rule bound to a member of S. */
+template <class S>
+struct field {
+	opt_rule rule;
+	transfer_fn<S> transfer;    /**< nullptr if there is no member. */
+};
+
+/** A rule without a member, like the help option. */
+struct unbound {
+	opt_rule rule;
+
+	template <class S>
+	constexpr operator field<S>() const { return {rule, nullptr}; }
+};
+
+namespace detail {
+
+template <class>
+struct member_of;
+
+template <class S, class T>
+struct member_of<T S::*> {
+	using object = S;
+	using type = T;
+};
+
+template <auto Member>
+using object_of = typename member_of<decltype(Member)>::object;
+
+template <auto Member>
+using type_of = typename member_of<decltype(Member)>::type;
+
+template <OPTPARSE_ACTIONS A, auto Member>
+void transfer(object_of<Member> &s, opt_data &d, bool to_struct)
+{
+	if (to_struct) {
+		s.*Member = action_traits<A>::get(d);
+	} else {
+		action_traits<A>::put(d, s.*Member);
+	}
+}
+
+template <OPTPARSE_ACTIONS A, auto Member>
+constexpr void check_member()
+{
+	static_assert(std::is_same_v<type_of<Member>,
+				     typename action_traits<A>::type>,
+		      "the type of the member does not match the action");
+}
+
+constexpr bool is_argument(OPTPARSE_ACTIONS action)
+{
+	return action >= _OPTPARSE_POSITIONAL_START
+	       && action < _OPTPARSE_POSITIONAL_END;
+}
+
+constexpr bool is_collect(int action)
+{
+	return action == OPTPARSE_COLLECT_INT64
+	       || action == OPTPARSE_COLLECT_DOUBLE
+	       || action == OPTPARSE_COLLECT_STR;
+}
+
+constexpr bool same_string(const char *a, const char *b)
+{
+	while (*a != '\0' && *a == *b) {
+		a++;
+		b++;
+	}
+	return *a == *b;
+}
+
+/** Hash of a long id (FNV-1a), before mixing in a seed. */
+constexpr uint32_t hash_id(const char *id)
+{
+	uint32_t h = 2166136261u;
+
+	while (*id != '\0') {
+		h = (h ^ (unsigned char)*id++) * 16777619u;
+	}
+	return h;
+}
+
+/** Mix a seed into a hash (finalizer of MurmurHash3). */
+constexpr uint32_t mix(uint32_t h, uint32_t seed)
+{
+	h ^= seed * 0x9e3779b9u;
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+/* Throwing is not allowed in a constant expression, so a failed check while
+ * building a parser stops the compilation, showing the message. */
+constexpr void require(bool ok, const char *msg)
+{
+	if (!ok) {
+		throw msg;
+	}
+}
+
+} /* namespace detail */
+
+/**
+ * Declare an option stored in Member.
+ *
+ * The type of Member must match the action (see action_traits). For
+ * OPTPARSE_CUSTOM_ACTION, Member is an opt_data and default_value is the
+ * callback.
+ */
+template <OPTPARSE_ACTIONS A, auto Member>
+consteval field<detail::object_of<Member>>
+option(char short_id, const char *long_id, const char *desc,
+       typename action_traits<A>::default_type default_value = {})
+{
+	static_assert(!detail::is_argument(A),
+		      "use argument() for positional arguments");
+	static_assert(!detail::is_collect(A),
+		      "collect actions are only valid for arguments");
+	detail::check_member<A, Member>();
+
+	return {opt_rule{.action = A,
+			 .action_data = {.option = {short_id, long_id}},
+			 .desc = desc,
+			 .default_value =
+				 action_traits<A>::make(default_value)},
+		detail::transfer<A, Member>};
+}
+
+/**
+ * Declare a positional argument stored in Member.
+ *
+ * @param   optional    Whether the argument can be omitted. Optional
+ *                      arguments must come after the mandatory ones.
+ */
+template <OPTPARSE_POSITIONAL_ACTIONS P, auto Member>
+consteval field<detail::object_of<Member>>
+argument(const char *name, const char *desc,
+	 typename action_traits<(OPTPARSE_ACTIONS)P>::default_type
+		 default_value = {},
+	 bool optional = false)
+{
+	constexpr OPTPARSE_ACTIONS A = (OPTPARSE_ACTIONS)P;
+
+	detail::check_member<A, Member>();
+
+	return {opt_rule{.action = optional ? OPTPARSE_POSITIONAL_OPT
+					    : OPTPARSE_POSITIONAL,
+			 .action_data = {.argument = {P, name}},
+			 .desc = desc,
+			 .default_value =
+				 action_traits<A>::make(default_value)},
+		detail::transfer<A, Member>};
+}
+
+/** Declare the help option. */
+consteval unbound help(char short_id, const char *long_id, const char *desc)
+{
+	return {opt_rule{.action = OPTPARSE_DO_HELP,
+			 .action_data = {.option = {short_id, long_id}},
+			 .desc = desc,
+			 .default_value = {}}};
+}
+
+/**
+ * Declare an option that is accepted and ignored.
+ *
+ * @param   takes_value     Whether it is followed by a value.
+ */
+consteval unbound ignore(char short_id, const char *long_id, const char *desc,
+			 bool takes_value = false)
+{
+	return {opt_rule{.action = takes_value ? OPTPARSE_IGNORE
+					       : OPTPARSE_IGNORE_SWITCH,
+			 .action_data = {.option = {short_id, long_id}},
+			 .desc = desc,
+			 .default_value = {}}};
+}
+
+/**
+ * Rule table and lookup tables for a struct S with N rules.
+ *
+ * Build it with make_parser(), as a constexpr object with static storage,
+ * and use it through parse(). The fields should be considered private.
+ */
+template <class S, std::size_t N>
+struct parser {
+	static_assert(N > 0 && N < INT16_MAX, "bad number of rules");
+
+	/** Number of slots of the long id table (at most half full). */
+	static constexpr std::size_t n_slots = std::bit_ceil(2 * N);
+	/** Number of buckets of the perfect hash (two ids on average). */
+	static constexpr std::size_t n_buckets = (N + 1) / 2;
+	/** Seeds tried for each bucket before giving up. */
+	static constexpr uint32_t max_seed = 1u << 16;
+	/** Largest bucket that is accepted. */
+	static constexpr std::size_t max_bucket = 16;
+
+	const char *helpstr;
+	optparse_tune tune;
+	std::array<opt_rule, N> rules;
+	std::array<transfer_fn<S>, N> transfers;
+	/** For each short id, the index of its rule plus one (0 = none). */
+	std::array<int16_t, UCHAR_MAX + 1> short_ids;
+	/** Seed of each bucket. */
+	std::array<uint32_t, n_buckets> seeds;
+	/** Index plus one of the rule in each slot (0 = empty). */
+	std::array<int16_t, n_slots> slots;
+
+	/**
+	 * Find an option, like opt_conf::matcher.
+	 */
+	constexpr int find(const char *long_id, char short_id) const
+	{
+		if (long_id == nullptr) {
+			return short_ids[(unsigned char)short_id] - 1;
+		}
+
+		uint32_t h = detail::hash_id(long_id);
+		uint32_t seed = seeds[detail::mix(h, 0) % n_buckets];
+		int rule = slots[detail::mix(h, seed) & (n_slots - 1)] - 1;
+
+		if (rule < 0) {
+			return -1;
+		}
+		const char *id = rules[rule].action_data.option.long_id;
+
+		return detail::same_string(id, long_id) ? rule : -1;
+	}
+
+	/**
+	 * Copy the results of a parse into s, or back (for free_strings()).
+	 */
+	void transfer(S &s, opt_data *results, bool to_struct) const
+	{
+		for (std::size_t i = 0; i < N; i++) {
+			if (transfers[i] != nullptr) {
+				transfers[i](s, results[i], to_struct);
+			}
+		}
+	}
+
+	/**
+	 * Do what sanity_check() does in the C parser. Repeated ids are
+	 * rejected while the lookup tables are built.
+	 */
+	constexpr void check() const
+	{
+		bool found_optional = false, found_collect = false;
+
+		for (std::size_t i = 0; i < N; i++) {
+			const opt_rule &rule = rules[i];
+
+			if (!detail::is_argument(rule.action)) {
+				continue;
+			}
+
+			bool is_optional =
+				rule.action == OPTPARSE_POSITIONAL_OPT;
+
+			detail::require(!found_optional || is_optional,
+					"mandatory after optional argument");
+			detail::require(!found_collect,
+					"collect action before last argument");
+
+			found_optional = found_optional || is_optional;
+			found_collect = detail::is_collect(
+					rule.action_data.argument.pos_action);
+		}
+	}
+
+	constexpr bool has_long_id(std::size_t i) const
+	{
+		return !detail::is_argument(rules[i].action)
+		       && rules[i].action_data.option.long_id != nullptr;
+	}
+
+	constexpr void build_short_ids()
+	{
+		for (std::size_t i = 0; i < N; i++) {
+			if (!detail::is_argument(rules[i].action)) {
+				unsigned char c = (unsigned char)
+					rules[i].action_data.option.short_id;
+
+				if (c != 0) {
+					detail::require(short_ids[c] == 0,
+							"repeated short id");
+					short_ids[c] = (int16_t)(i + 1);
+				}
+			}
+		}
+	}
+
+	/**
+	 * Build a perfect hash of the long ids ("hash and displace"): the ids
+	 * are split into buckets, and starting with the largest bucket, a seed
+	 * is found for each one that sends its ids to free slots.
+	 *
+	 * Ids that land in the same bucket with the same hash are compared
+	 * here, so repeated long ids are rejected without comparing every
+	 * pair of rules.
+	 */
+	constexpr void build_slots()
+	{
+		std::array<uint32_t, N> hashes{};
+		std::array<std::size_t, N> bucket_of{};
+		/* The ids of bucket b are members[first[b]] to
+		 * members[first[b + 1] - 1]. */
+		std::array<std::size_t, N> members{};
+		std::array<std::size_t, n_buckets + 1> first{};
+		std::array<std::size_t, n_buckets> order{}, fill{};
+
+		for (std::size_t i = 0; i < N; i++) {
+			if (!has_long_id(i)) {
+				continue;
+			}
+			hashes[i] = detail::hash_id(
+					rules[i].action_data.option.long_id);
+			bucket_of[i] = detail::mix(hashes[i], 0) % n_buckets;
+			first[bucket_of[i] + 1]++;
+		}
+		for (std::size_t b = 0; b < n_buckets; b++) {
+			first[b + 1] += first[b];
+			fill[b] = first[b];
+		}
+		for (std::size_t i = 0; i < N; i++) {
+			if (has_long_id(i)) {
+				members[fill[bucket_of[i]]++] = i;
+			}
+		}
+
+		/* Largest buckets first (counting sort on the size). */
+		std::array<std::size_t, max_bucket + 2> by_size{};
+
+		for (std::size_t b = 0; b < n_buckets; b++) {
+			std::size_t size = first[b + 1] - first[b];
+
+			detail::require(size <= max_bucket,
+					"cannot build the long id table");
+			by_size[max_bucket - size + 1]++;
+		}
+		for (std::size_t k = 0; k <= max_bucket; k++) {
+			by_size[k + 1] += by_size[k];
+		}
+		for (std::size_t b = 0; b < n_buckets; b++) {
+			std::size_t size = first[b + 1] - first[b];
+
+			order[by_size[max_bucket - size]++] = b;
+		}
+
+		for (std::size_t b : order) {
+			const std::size_t *begin = members.data() + first[b];
+			std::size_t size = first[b + 1] - first[b];
+			uint32_t seed;
+
+			if (size == 0) {
+				break;
+			}
+			check_bucket(hashes, begin, size);
+
+			for (seed = 1; seed < max_seed; seed++) {
+				if (try_seed(hashes, begin, size, seed)) {
+					break;
+				}
+			}
+			detail::require(seed < max_seed,
+					"cannot build the long id table");
+			seeds[b] = seed;
+		}
+	}
+
+	/** Reject the repeated long ids in a bucket. */
+	constexpr void check_bucket(const std::array<uint32_t, N> &hashes,
+				    const std::size_t *bucket,
+				    std::size_t size) const
+	{
+		for (std::size_t j = 0; j < size; j++) {
+			for (std::size_t k = 0; k < j; k++) {
+				const char *a, *b;
+
+				if (hashes[bucket[j]] != hashes[bucket[k]]) {
+					continue;
+				}
+				a = rules[bucket[j]].action_data.option.long_id;
+				b = rules[bucket[k]].action_data.option.long_id;
+				detail::require(!detail::same_string(a, b),
+						"repeated long id");
+			}
+		}
+	}
+
+	/**
+	 * Place the size ids in bucket with seed, if all of them go to free
+	 * slots (and to different ones).
+	 */
+	constexpr bool try_seed(const std::array<uint32_t, N> &hashes,
+				const std::size_t *bucket, std::size_t size,
+				uint32_t seed)
+	{
+		std::array<std::size_t, max_bucket> placed{};
+
+		for (std::size_t j = 0; j < size; j++) {
+			std::size_t slot = detail::mix(hashes[bucket[j]], seed)
+					   & (n_slots - 1);
+
+			if (slots[slot] != 0) {
+				return false;
+			}
+			for (std::size_t k = 0; k < j; k++) {
+				if (placed[k] == slot) {
+					return false;
+				}
+			}
+			placed[j] = slot;
+		}
+
+		for (std::size_t j = 0; j < size; j++) {
+			slots[placed[j]] = (int16_t)(bucket[j] + 1);
+		}
+		return true;
+	}
+};
+
+/**
+ * Build and check a parser for the struct S.
+ *
+ * Each rule is a field of S (see option() and argument()) or an unbound
+ * rule (see help() and ignore()). An invalid table stops the compilation.
+ */
+template <class S, class... F>
+consteval parser<S, sizeof...(F)> make_parser(const char *helpstr,
+					      optparse_tune tune, F... rules)
+{
+	parser<S, sizeof...(F)> p{};
+	std::array<field<S>, sizeof...(F)> fields{field<S>(rules)...};
+
+	p.helpstr = helpstr;
+	p.tune = tune;
+	for (std::size_t i = 0; i < fields.size(); i++) {
+		p.rules[i] = fields[i].rule;
+		p.transfers[i] = fields[i].transfer;
+	}
+
+	p.check();
+	p.build_short_ids();
+	p.build_slots();
+
+	return p;
+}
+
+/** Matcher of a parser, for opt_conf::matcher. */
+template <const auto &P>
+int match(const char *long_id, char short_id)
+{
+	return P.find(long_id, short_id);
+}
+
+/** Configuration of a parser, to use the C API directly. */
+template <const auto &P>
+inline constexpr opt_conf conf = {
+	.helpstr = P.helpstr,
+	.rules = P.rules.data(),
+	.n_rules = (int)P.rules.size(),
+	.tune = (optparse_tune)(P.tune | OPTPARSE_CHECKED),
+	.allocator = nullptr,
+	.help_sink = nullptr,
+	.help_cache = nullptr,
+	.help_text = nullptr,
+	.matcher = match<P>,
+	.apply = nullptr,
+};
+
+/**
+ * Parse a command line into s.
+ *
+ * Members of options that are not given get their default value.
+ *
+ * @return  The same as optparse_cmd_ctx(). On error, s is not modified.
+ */
+template <const auto &P, class S>
+int parse(S &s, int argc, const char * const argv[],
+	  opt_context *ctx = nullptr)
+{
+	opt_data results[P.rules.size()];
+	int status = optparse_cmd_ctx(&conf<P>, ctx, results, argc, argv);
+
+	if (status >= OPTPARSE_OK) {
+		P.transfer(s, results, true);
+	}
+
+	return status;
+}
+
+template <const auto &P, class S>
+int parse(S &s, int argc, char *argv[], opt_context *ctx = nullptr)
+{
+	return parse<P>(s, argc, const_cast<const char * const *>(argv), ctx);
+}
+
+/**
+ * Release the strings and arrays stored in s by parse(), and set them to
+ * NULL.
+ *
+ * @param   ctx     The context given to parse(), if any.
+ */
+template <const auto &P, class S>
+void free_strings(S &s, const opt_context *ctx = nullptr)
+{
+	opt_data results[P.rules.size()] = {};
+
+	P.transfer(s, results, false);
+	optparse_free_strings_ctx(&conf<P>, ctx, results);
+	P.transfer(s, results, true);
+}
+
+} /* namespace optparse */
+
+#endif /* OPTPARSE_HPP */
@@ -0,0 +1,99 @@
+/**
+ * @file
+ * @author  Juan I Carrano <juan@carrano.com.ar.
+ *
+ * Check the C++ wrapper: the tables are built at compile time and the
+ * results are stored in a struct.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "optparse.hpp"
+
+struct opts {
+	int verbose;
+	bool flag;
+	int64_t count;
+	double ratio;
+	char *name;
+	opt_array includes;
+	const char *input;
+	const char *output;
+};
+
+static constexpr auto parser = optparse::make_parser<opts>(
+	"C++ example", OPTPARSE_IGNORE_ARGV0,
+	optparse::option<OPTPARSE_COUNT, &opts::verbose>(
+		'v', "verbose", "Verbosity level"),
+	optparse::option<OPTPARSE_SET_BOOL, &opts::flag>(
+		's', nullptr, "Set a flag"),
+	optparse::option<OPTPARSE_INT64, &opts::count>(
+		'n', "count", "How many", 10),
+	optparse::option<OPTPARSE_DOUBLE, &opts::ratio>(
+		OPTPARSE_NO_SHORT, "ratio", "A ratio", 0.5),
+	optparse::option<OPTPARSE_STR, &opts::name>(
+		OPTPARSE_NO_SHORT, "name", "A name (copied)"),
+	optparse::option<OPTPARSE_APPEND_STR, &opts::includes>(
+		'I', "include", "Add a directory"),
+	optparse::ignore('x', "extra", "Ignored", true),
+	optparse::help('h', "help", "Show this help"),
+	optparse::argument<OPTPARSE_POS_STR_NOCOPY, &opts::input>(
+		"input", "Input file"),
+	optparse::argument<OPTPARSE_POS_STR_NOCOPY, &opts::output>(
+		"output", "Output file", "out.txt", true));
+
+/* The lookups can be done by the compiler too. */
+static_assert(parser.find("verbose", 0) == 0);
+static_assert(parser.find("ratio", 0) == 3);
+static_assert(parser.find("help", 0) == 7);
+static_assert(parser.find("rati", 0) == -1);
+static_assert(parser.find("input", 0) == -1);
+static_assert(parser.find(nullptr, 'I') == 5);
+static_assert(parser.find(nullptr, 'q') == -1);
+
+static int failures;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::printf("%s:%d: check failed: %s\n", __FILE__, \
+				    __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+int main()
+{
+	opts o{};
+	const char *argv[] = {"prog", "-vv", "--verbose", "-s", "--count", "42",
+			      "--name", "bob", "-I", "a", "--include", "b",
+			      "-x", "whatever", "in.txt"};
+	const char *argv_bad[] = {"prog", "--bogus", "in.txt"};
+
+	CHECK(optparse::parse<parser>(o, sizeof(argv) / sizeof(*argv), argv)
+	      == 1);
+	CHECK(o.verbose == 3);
+	CHECK(o.flag);
+	CHECK(o.count == 42);
+	CHECK(o.ratio == 0.5);
+	CHECK(o.name != nullptr && std::strcmp(o.name, "bob") == 0);
+	CHECK(o.includes.count == 2
+	      && std::strcmp(o.includes.items.str[1], "b") == 0);
+	CHECK(std::strcmp(o.input, "in.txt") == 0);
+	CHECK(std::strcmp(o.output, "out.txt") == 0);
+
+	optparse::free_strings<parser>(o);
+	CHECK(o.name == nullptr);
+	CHECK(o.includes.items.any == nullptr);
+
+	o.verbose = -1;
+	CHECK(optparse::parse<parser>(o, sizeof(argv_bad) / sizeof(*argv_bad),
+				      argv_bad)
+	      == -OPTPARSE_BADSYNTAX);
+	CHECK(o.verbose == -1);
+
+	std::printf("%d failures\n", failures);
+
+	return failures != 0;
+}
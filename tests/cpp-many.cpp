@@ -0,0 +1,77 @@
+/**
+ * @file
+ * @author  Juan I Carrano <juan@carrano.com.ar.
+ *
+ * Check that the C++ wrapper builds the tables of a large parser (320
+ * options) within the limits of constant evaluation.
+ */
+
+#include <cstdio>
+
+#include "optparse.hpp"
+
+#define EACH_16(X, p) \
+	X(p##0) X(p##1) X(p##2) X(p##3) X(p##4) X(p##5) X(p##6) X(p##7) \
+	X(p##8) X(p##9) X(p##a) X(p##b) X(p##c) X(p##d) X(p##e) X(p##f)
+
+/* Options o00 to o13f. */
+#define EACH_OPTION(X) \
+	EACH_16(X, o0) EACH_16(X, o1) EACH_16(X, o2) EACH_16(X, o3) \
+	EACH_16(X, o4) EACH_16(X, o5) EACH_16(X, o6) EACH_16(X, o7) \
+	EACH_16(X, o8) EACH_16(X, o9) EACH_16(X, oa) EACH_16(X, ob) \
+	EACH_16(X, oc) EACH_16(X, od) EACH_16(X, oe) EACH_16(X, of) \
+	EACH_16(X, o10) EACH_16(X, o11) EACH_16(X, o12) EACH_16(X, o13)
+
+#define FIELD(name) int name;
+#define RULE(name) \
+	optparse::option<OPTPARSE_INT, &opts::name>( \
+		OPTPARSE_NO_SHORT, #name, "Option " #name),
+
+struct opts {
+	EACH_OPTION(FIELD)
+	const char *input;
+};
+
+static constexpr auto parser = optparse::make_parser<opts>(
+	"Many options", OPTPARSE_IGNORE_ARGV0,
+	EACH_OPTION(RULE)
+	optparse::help('h', "help", "Show this help"),
+	optparse::argument<OPTPARSE_POS_STR_NOCOPY, &opts::input>(
+		"input", "Input file"));
+
+static_assert(parser.rules.size() == 322);
+static_assert(parser.find("o00", 0) == 0);
+static_assert(parser.find("o7f", 0) == 0x7f);
+static_assert(parser.find("o13f", 0) == 0x13f);
+static_assert(parser.find("help", 0) == 0x140);
+static_assert(parser.find("o140", 0) == -1);
+static_assert(parser.find("input", 0) == -1);
+
+static int failures;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::printf("%s:%d: check failed: %s\n", __FILE__, \
+				    __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+int main()
+{
+	opts o{};
+	const char *argv[] = {"prog", "--o00", "1", "--o9c", "2",
+			      "--o13f", "3", "in.txt"};
+
+	CHECK(optparse::parse<parser>(o, sizeof(argv) / sizeof(*argv), argv)
+	      == 1);
+	CHECK(o.o00 == 1);
+	CHECK(o.o9c == 2);
+	CHECK(o.o13f == 3);
+	CHECK(o.o42 == 0);
+
+	std::printf("%d failures\n", failures);
+
+	return failures != 0;
+}
@@ -0,0 +1,44 @@
+/**
+ * @file
+ * @author  Juan I Carrano <juan@carrano.com.ar.
+ *
+ * Example of a help text and an option matcher generated at build time. The
+ * library is built with OPTPARSE_NO_HELP_FORMAT, so the help option only
+ * writes gen_example_help. Options are found by gen_example_match and most
+ * values are stored by gen_example_match_apply.
+ *
+ * Built with OPTPARSE_NO_GENERATED, it uses neither, and the help is rendered
+ * at run time instead.
+ */
+
+#include <stdio.h>
+#ifndef OPTPARSE_NO_GENERATED
+#include "gen-example-help.h"
+#include "gen-example-match.h"
+#endif
+#include "gen-example.h"
+
+int main(int argc, char *argv[])
+{
+	union opt_data results[N_RULES];
+	int parse_result;
+
+	parse_result = optparse_cmd(&cfg, results, argc,
+				    (const char * const *)argv);
+
+	if (parse_result == -OPTPARSE_REQHELP) {
+		return 0;
+	}
+	if (parse_result < OPTPARSE_OK) {
+		return 1;
+	}
+
+	printf("Verbosity level is %d\n", results[VERBOSITY].d_int);
+	printf("Name is %s\n", results[NAME].d_cstr ? results[NAME].d_cstr
+						    : "(none)");
+	printf("Coffee is %u\n", results[COFFEE].d_uint);
+	printf("Summer is %d\n", results[SUMMER].d_bool);
+	printf("Number is %d\n", results[ARG2].d_int);
+
+	return 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * @file
+ * @author  Juan I Carrano <juan@carrano.com.ar.
+ *
+ * Configuration of gen-example.c, kept in a header of its own so that
+ * tools/helpgen.c and tools/matchgen.c can generate its help text, its
+ * option matcher and its actions.
+ */
+
+#ifndef GEN_EXAMPLE_H
+#define GEN_EXAMPLE_H
+
+#include "optparse.h"
+
+enum _rules {
+	VERBOSITY,
+	SETTABLE,
+	INTTHING,
+	NAME,
+	COFFEE,
+	SUMMER,
+	HELP_OPT,
+	ARG1,
+	ARG2,
+	N_RULES
+};
+
+static const struct opt_rule rules[N_RULES] = {
+[VERBOSITY] = OPTPARSE_O(COUNT, 'v', "verbose",
+			 "Verbosity level (can be given multiple times)", 0),
+
+[SETTABLE] = OPTPARSE_O(SET_BOOL, 's', NULL, "Set a flag 's'", false),
+
+[INTTHING] = OPTPARSE_O(INT, 'c',  "cool", "Set an integer", -10),
+
+[NAME] = OPTPARSE_O(STR_NOCOPY, OPTPARSE_NO_SHORT, "name", "Choose a \"name\"",
+		    NULL),
+
+[COFFEE] = OPTPARSE_O(UINT, OPTPARSE_NO_SHORT, "caf\303\251",
+		      "Cups of coffee (an option that is not ASCII)", 0),
+
+[SUMMER] = OPTPARSE_O(SET_BOOL, OPTPARSE_NO_SHORT, "\303\251t\303\251",
+		      "Set a flag (neither ASCII)", false),
+
+[HELP_OPT] = OPTPARSE_O(DO_HELP, 'h', "help", "Show this help", 0),
+/* positionals */
+[ARG1] = OPTPARSE_P(STR_NOCOPY, "first-argument", "Just store this string",
+		    "hello!"),
+[ARG2] = OPTPARSE_P_OPT(INT, "number", "An optional number", 3),
+};
+
+static const struct opt_conf cfg = {
+	.helpstr = "Example program\nwith a help generated at build time",
+	.tune = OPTPARSE_IGNORE_ARGV0,
+	.rules = rules,
+	.n_rules = N_RULES,
+	.help_text = OPTPARSE_HELP_TEXT(gen_example_help),
+	.matcher = OPTPARSE_MATCHER(gen_example_match),
+	.apply = OPTPARSE_APPLY(gen_example_match_apply)
+};
+
+#endif /* GEN_EXAMPLE_H */
@@ -5,8 +5,16 @@
  * Unit tests for optparse.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <float.h>
 #include <string.h>
 #include <malloc.h>
+#include <unistd.h>
+#ifdef OPTPARSE_THREAD_CREATE
+#include <errno.h>
+#include <pthread.h>
+#endif
 
 #include "unity.h"
 
@@ -73,6 +81,7 @@ enum _rules {
 	COPYME,
 	HELP_OPT,
 	FLOATTHING,
+	DOUBLETHING,
 	INTTHING,
 	ARG2,
 	UINTTHING,
@@ -126,6 +135,8 @@ static const struct opt_rule rules[N_RULES] = {
 /* (-f, --q)  just to add some confusion! */
 [FLOATTHING] = OPTPARSE_O(FLOAT, 'f', "q", "Set a float", 1.0f),
 
+[DOUBLETHING] = OPTPARSE_O(DOUBLE, 'd', "double", "Set a double", 0.25),
+
 [INTTHING] = OPTPARSE_O(INT, 'c', NULL, "Set an integer (try a negative value)",
 			-10),
 
@@ -166,7 +177,7 @@ static void test_optparse_basic(void)
 				     "-vf5.5", "-qpasted", "-vv9", "--verbose",
 				     "-i", "-v", /* -v is an argument to -i */
 				     "-s", "-u", "-", "quack", "--124", "--cc",
-				     "423", "--", "-qwerty"};
+				     "423", "-d1e-3", "--", "-qwerty"};
 
 	parse_result = optparse_cmd(&cfg, results,
 				    sizeof(argv) / sizeof(*argv), argv);
@@ -189,6 +200,7 @@ static void test_optparse_basic(void)
 	TEST_ASSERT_EQUAL_STRING("pasted", results[QTHING].d_cstr);
 	TEST_ASSERT_EQUAL_STRING("free-me", results[COPYME].d_str);
 	TEST_ASSERT_EQUAL_FLOAT(5.5f, results[FLOATTHING].d_float);
+	TEST_ASSERT_TRUE(1e-3 == results[DOUBLETHING].d_double);
 	TEST_ASSERT_TRUE(results[SETTABLE].d_bool);
 	TEST_ASSERT_FALSE(results[UNSETTABLE].d_bool);
 
@@ -250,6 +262,147 @@ static void test_optparse_help(void)
 	TEST_ASSERT_EQUAL_INT(-OPTPARSE_REQHELP, parse_result);
 }
 
+/**
+ * Sink that keeps the last text written and counts the writes.
+ */
+struct capture {
+	char text[1024];
+	size_t len;
+	int writes;
+};
+
+static void capture_write(void *user, const char *text, size_t len)
+{
+	struct capture *c = user;
+
+	TEST_ASSERT_TRUE(len < sizeof(c->text));
+	memcpy(c->text, text, len);
+	c->text[len] = '\0';
+	c->len = len;
+	c->writes++;
+}
+
+static void *fail_alloc(void *user, size_t size)
+{
+	(void)user;
+	(void)size;
+
+	return NULL;
+}
+
+static void fail_free(void *user, void *ptr)
+{
+	(void)user;
+	TEST_ASSERT_NULL(ptr);
+}
+
+static const struct opt_rule rules_layout[] = {
+	OPTPARSE_O(COUNT, 'v', "verbose", "Both ids", 0),
+	OPTPARSE_O(COUNT, 's', NULL, "Only a short id", 0),
+	OPTPARSE_O(COUNT, OPTPARSE_NO_SHORT, "long", "Only a long id", 0),
+	OPTPARSE_O(COUNT, OPTPARSE_NO_SHORT, "caf\303\251", "Not ASCII", 0),
+	OPTPARSE_O(COUNT, 'n', NULL, NULL, 0),
+	OPTPARSE_P(STR_NOCOPY, "file", "Required", NULL),
+	OPTPARSE_P_OPT(STR_NOCOPY, "more", "Optional", NULL),
+};
+
+static const struct opt_conf cfg_layout = {
+	.helpstr = "Layout",
+	.rules = rules_layout,
+	.n_rules = sizeof(rules_layout) / sizeof(*rules_layout)
+};
+
+static const char help_layout[] =
+	"Layout\n"
+	"  -v, --verbose  Both ids\n"
+	"  -s             Only a short id\n"
+	"      --long     Only a long id\n"
+	"      --caf\303\251     Not ASCII\n"
+	"  -n\n"
+	"  file           Required\n"
+	"  more?          Optional\n";
+
+/**
+ * Test rendering the help into a buffer, the sink and the cache.
+ */
+static void test_help_render(void)
+{
+	union opt_data results[N_RULES];
+	static const char *argv_help[] = {"test", "-h"};
+	struct capture capture = {{0}, 0, 0};
+	const struct opt_sink sink = {.write = capture_write, .user = &capture};
+	struct opt_help_cache cache = {NULL};
+	const struct opt_allocator failing_allocator = {.alloc = fail_alloc,
+							.free = fail_free};
+	struct opt_conf cfg_sink = cfg;
+	char small[16], layout[sizeof(help_layout)], *full;
+	const char *cached;
+	size_t len;
+
+	len = optparse_help_render(&cfg, NULL, 0);
+	TEST_ASSERT_TRUE(len > sizeof(small));
+
+	/* Truncated like snprintf */
+	TEST_ASSERT_EQUAL_UINT(len, optparse_help_render(&cfg, small,
+							  sizeof(small)));
+	TEST_ASSERT_EQUAL_UINT(sizeof(small) - 1, strlen(small));
+	TEST_ASSERT_EQUAL_MEMORY("Test program\n", small, 13);
+
+	full = malloc(len + 1);
+	TEST_ASSERT_EQUAL_UINT(len, optparse_help_render(&cfg, full, len + 1));
+	TEST_ASSERT_EQUAL_UINT(len, strlen(full));
+	TEST_ASSERT_NOT_NULL(strstr(full, "\n      --key  "));
+
+	/* Columns are aligned, and missing ids leave no separators */
+	TEST_ASSERT_EQUAL_UINT(sizeof(help_layout) - 1,
+			       optparse_help_render(&cfg_layout, layout,
+						    sizeof(layout)));
+	TEST_ASSERT_EQUAL_STRING(help_layout, layout);
+
+	/* No cache */
+	TEST_ASSERT_NULL(optparse_help_text(&cfg, NULL));
+
+	cfg_sink.help_sink = &sink;
+	cfg_sink.help_cache = &cache;
+
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_REQHELP,
+			      optparse_cmd(&cfg_sink, results, 2, argv_help));
+	TEST_ASSERT_EQUAL_INT(1, capture.writes);
+	TEST_ASSERT_EQUAL_STRING(full, capture.text);
+
+	cached = cache.text;
+	TEST_ASSERT_NOT_NULL(cached);
+	TEST_ASSERT_EQUAL_UINT(len, cache.len);
+
+	/* The second time the text comes from the cache */
+	optparse_help(&cfg_sink);
+	TEST_ASSERT_EQUAL_INT(2, capture.writes);
+	TEST_ASSERT_EQUAL_PTR(cached, optparse_help_text(&cfg_sink, &len));
+	TEST_ASSERT_EQUAL_STRING(full, capture.text);
+
+	optparse_help_cache_free(&cfg_sink);
+	TEST_ASSERT_NULL(cache.text);
+
+	/* Without cache nor heap the help is written in pieces */
+	cfg_sink.help_cache = NULL;
+	cfg_sink.allocator = &failing_allocator;
+	capture.writes = 0;
+	optparse_help(&cfg_sink);
+	TEST_ASSERT_GREATER_THAN_INT(1, capture.writes);
+
+	/* A help text given in advance is written as is */
+	cfg_sink.help_text = "Pre-rendered\n";
+	capture.writes = 0;
+	optparse_help(&cfg_sink);
+	TEST_ASSERT_EQUAL_INT(1, capture.writes);
+	TEST_ASSERT_EQUAL_STRING("Pre-rendered\n", capture.text);
+	TEST_ASSERT_EQUAL_PTR(cfg_sink.help_text,
+			      optparse_help_text(&cfg_sink, &len));
+	TEST_ASSERT_EQUAL_UINT(13, len);
+
+	free(full);
+}
+
 /**
  * Test default value assignments.
  */
@@ -288,6 +441,8 @@ static void test_optparse_default(void)
 	my_TEST_ASSERT_EQUAL_STRING(KEY, d_str);
 	my_TEST_ASSERT_EQUAL_STRING(QTHING, d_cstr);
 	my_TEST_ASSERT_EQUAL_FLOAT(FLOATTHING, d_float);
+	TEST_ASSERT_TRUE(rules[DOUBLETHING].default_value.d_double
+			 == results[DOUBLETHING].d_double);
 	my_TEST_ASSERT_EQUAL_INT(SETTABLE, d_bool);
 	my_TEST_ASSERT_EQUAL_INT(UNSETTABLE, d_bool);
 
@@ -358,15 +513,327 @@ static void test_optparse_uint_err(void)
 	TEST_ASSERT_EQUAL_INT(2, parse_result);
 	optparse_free_strings(&cfg, results);
 
+	/* Negative numbers are out of range */
 	parse_result = optparse_cmd(&cfg, results, argc, argv_bad1);
-	TEST_ASSERT_EQUAL_INT(2, parse_result);
-	TEST_ASSERT_EQUAL_UINT((unsigned int)(-12), results[UINTTHING].d_uint);
-	optparse_free_strings(&cfg, results);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, parse_result);
 
 	parse_result = optparse_cmd(&cfg, results, argc, argv_bad2);
 	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, parse_result);
 }
 
+enum _rules_wide_ints {
+	OFFSET,
+	LIMIT,
+	BUFSIZE,
+	TIMEOUT,
+	TIMESTAMP,
+	N_WIDE_INT_RULES
+};
+
+static const struct opt_rule rules_wide_ints[N_WIDE_INT_RULES] = {
+[OFFSET] = OPTPARSE_O(INT64, 'o', "offset", "Signed 64 bit offset", -1),
+[LIMIT] = OPTPARSE_O(UINT64, 'l', "limit", "Unsigned 64 bit limit",
+		     UINT64_MAX),
+[BUFSIZE] = OPTPARSE_O(SIZE, 'b', "buffer-size", "Buffer size", 4096),
+[TIMEOUT] = OPTPARSE_O(DURATION, 't', "timeout", "Timeout", -1),
+[TIMESTAMP] = OPTPARSE_P(INT64, "timestamp", "Seconds since the epoch", 0)
+};
+
+static const struct opt_conf cfg_wide_ints = {
+	.helpstr = "64 bit integers",
+	.tune = OPTPARSE_IGNORE_ARGV0,
+	.rules = rules_wide_ints,
+	.n_rules = N_WIDE_INT_RULES
+};
+
+/**
+ * Test the 64 bit integer actions, for options and positionals.
+ */
+static void test_int64(void)
+{
+	union opt_data results[N_WIDE_INT_RULES];
+	int parse_result;
+	static const char *argv_good[] = {NULL, "-o", "-5000000000",
+					  "--limit", "0x100000000", "4102444800",
+					  "-b", "64Ki", "--timeout", "1.5s"};
+	static const char *argv_dfl[] = {NULL, "17"};
+	static const char *argv_bad[] = {NULL, "-l", "-1", "0"};
+	static const char *argv_big[] = {NULL, "9223372036854775808"};
+
+	parse_result = optparse_cmd(&cfg_wide_ints, results,
+			sizeof(argv_good) / sizeof(*argv_good), argv_good);
+	TEST_ASSERT_EQUAL_INT(1, parse_result);
+	TEST_ASSERT_TRUE(results[OFFSET].d_int64 == -5000000000LL);
+	TEST_ASSERT_TRUE(results[LIMIT].d_uint64 == 0x100000000ULL);
+	TEST_ASSERT_TRUE(results[TIMESTAMP].d_int64 == 4102444800LL);
+	TEST_ASSERT_TRUE(results[BUFSIZE].d_uint64 == 65536);
+	TEST_ASSERT_TRUE(results[TIMEOUT].d_int64 == 1500000000);
+
+	parse_result = optparse_cmd(&cfg_wide_ints, results,
+			sizeof(argv_dfl) / sizeof(*argv_dfl), argv_dfl);
+	TEST_ASSERT_EQUAL_INT(1, parse_result);
+	TEST_ASSERT_TRUE(results[OFFSET].d_int64 == -1);
+	TEST_ASSERT_TRUE(results[LIMIT].d_uint64 == UINT64_MAX);
+	TEST_ASSERT_TRUE(results[TIMESTAMP].d_int64 == 17);
+	TEST_ASSERT_TRUE(results[BUFSIZE].d_uint64 == 4096);
+	TEST_ASSERT_TRUE(results[TIMEOUT].d_int64 == -1);
+
+	parse_result = optparse_cmd(&cfg_wide_ints, results,
+			sizeof(argv_bad) / sizeof(*argv_bad), argv_bad);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, parse_result);
+
+	parse_result = optparse_cmd(&cfg_wide_ints, results,
+			sizeof(argv_big) / sizeof(*argv_big), argv_big);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, parse_result);
+}
+
+static const struct opt_rule rules_view[] = {
+	OPTPARSE_O(VIEW, 'd', "data", "Inline payload", "{}"),
+	OPTPARSE_O(VIEW, 'p', NULL, "Prefix", NULL),
+	OPTPARSE_P_OPT(VIEW, "blob", "Base64 blob", NULL)
+};
+
+static const struct opt_conf cfg_view = {
+	.helpstr = "String views",
+	.tune = 0,
+	.rules = rules_view,
+	.n_rules = 3
+};
+
+/**
+ * Test the string view action.
+ */
+static void test_view(void)
+{
+	union opt_data results[3];
+	int parse_result;
+	static const char *argv[] = {"--data", "{\"k\": [1, 2, 3]}", "-pfoo",
+				     "aGVsbG8="};
+
+	parse_result = optparse_cmd(&cfg_view, results, 0, argv);
+	TEST_ASSERT_EQUAL_INT(0, parse_result);
+	TEST_ASSERT_EQUAL_STRING("{}", results[0].d_view.ptr);
+	TEST_ASSERT_EQUAL_UINT(2, (unsigned int)results[0].d_view.len);
+	TEST_ASSERT_NULL(results[1].d_view.ptr);
+	TEST_ASSERT_EQUAL_UINT(0, (unsigned int)results[1].d_view.len);
+
+	parse_result = optparse_cmd(&cfg_view, results, 4, argv);
+	TEST_ASSERT_EQUAL_INT(1, parse_result);
+	TEST_ASSERT_EQUAL_PTR(argv[1], results[0].d_view.ptr);
+	TEST_ASSERT_EQUAL_UINT(strlen(argv[1]),
+			       (unsigned int)results[0].d_view.len);
+	TEST_ASSERT_EQUAL_PTR(argv[2] + 2, results[1].d_view.ptr);
+	TEST_ASSERT_EQUAL_UINT(3, (unsigned int)results[1].d_view.len);
+	TEST_ASSERT_EQUAL_PTR(argv[3], results[2].d_view.ptr);
+	TEST_ASSERT_EQUAL_UINT(8, (unsigned int)results[2].d_view.len);
+}
+
+/**
+ * Test the integer conversion functions.
+ */
+static void test_conv_int(void)
+{
+	int64_t i;
+	uint64_t u;
+	const char *msg = NULL;
+
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_int(" -0x1F", INT_MIN, INT_MAX,
+						&i, &msg));
+	TEST_ASSERT_EQUAL_INT(-31, (int)i);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_int("0755", INT_MIN, INT_MAX, &i, &msg));
+	TEST_ASSERT_EQUAL_INT(0755, (int)i);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_int("-2147483648", INT_MIN, INT_MAX,
+						&i, &msg));
+	TEST_ASSERT_EQUAL_INT(INT_MIN, (int)i);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_int("-9223372036854775808", INT64_MIN,
+						INT64_MAX, &i, &msg));
+	TEST_ASSERT_TRUE(i == INT64_MIN);
+	TEST_ASSERT_NULL(msg);
+
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_int("2147483648", INT_MIN, INT_MAX,
+						&i, &msg));
+	TEST_ASSERT_EQUAL_STRING("Integer out of range", msg);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_int("99999999999999999999999",
+						INT64_MIN, INT64_MAX, &i, &msg));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_int("5", 10, 20, &i, &msg));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_int("08", INT_MIN, INT_MAX, &i, &msg));
+	TEST_ASSERT_EQUAL_STRING("Expected integer", msg);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_int("0x", INT_MIN, INT_MAX, &i, &msg));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_int("", INT_MIN, INT_MAX, &i, &msg));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_int("-", INT_MIN, INT_MAX, &i, &msg));
+
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_uint("18446744073709551615", UINT64_MAX,
+						 &u, &msg));
+	TEST_ASSERT_TRUE(u == UINT64_MAX);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_uint("18446744073709551616", UINT64_MAX,
+						 &u, &msg));
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_uint("0xFFFFFFFF", UINT_MAX, &u, &msg));
+	TEST_ASSERT_EQUAL_UINT(UINT_MAX, (unsigned int)u);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_uint("0x100000000", UINT_MAX, &u, &msg));
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_uint("-0", UINT_MAX, &u, &msg));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_uint("-1", UINT_MAX, &u, &msg));
+}
+
+/**
+ * Test the size and duration conversion functions.
+ */
+static void test_conv_units(void)
+{
+	uint64_t u;
+	int64_t i;
+	const char *msg = NULL;
+
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_conv_size("1.5G", &u, &msg));
+	TEST_ASSERT_TRUE(u == 1500000000);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_conv_size("1.5KiB", &u, &msg));
+	TEST_ASSERT_TRUE(u == 1536);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_conv_size("512", &u, &msg));
+	TEST_ASSERT_TRUE(u == 512);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_conv_size("3B", &u, &msg));
+	TEST_ASSERT_TRUE(u == 3);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_conv_size("15Ei", &u, &msg));
+	TEST_ASSERT_TRUE(u == UINT64_C(15) << 60);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_size("0.000000001E", &u, &msg));
+	TEST_ASSERT_TRUE(u == 1000000000);
+	TEST_ASSERT_NULL(msg);
+
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_size("16Ei", &u, &msg));
+	TEST_ASSERT_EQUAL_STRING("Size out of range", msg);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_size("-1k", &u, &msg));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_size("1Q", &u, &msg));
+	TEST_ASSERT_EQUAL_STRING("Expected size (e.g. 64Ki, 1.5G)", msg);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_size("G", &u, &msg));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_size("1k ", &u, &msg));
+
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_duration("250ms", &i, &msg));
+	TEST_ASSERT_TRUE(i == 250000000);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_duration("2h", &i, &msg));
+	TEST_ASSERT_TRUE(i == INT64_C(7200000000000));
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_duration("-1h30m", &i, &msg));
+	TEST_ASSERT_TRUE(i == -INT64_C(5400000000000));
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_duration("0.5", &i, &msg));
+	TEST_ASSERT_TRUE(i == 500000000);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_duration("-9223372036854775808ns",
+						     &i, &msg));
+	TEST_ASSERT_TRUE(i == INT64_MIN);
+
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_duration("9223372036854775808ns",
+						     &i, &msg));
+	TEST_ASSERT_EQUAL_STRING("Duration out of range", msg);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_duration("106752d", &i, &msg));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_duration("1h30", &i, &msg));
+	TEST_ASSERT_EQUAL_STRING("Expected duration (e.g. 250ms, 1h30m)", msg);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_duration("5 s", &i, &msg));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_duration("", &i, &msg));
+}
+
+/**
+ * Test the real number conversion functions.
+ */
+static void test_conv_real(void)
+{
+	double d;
+	float f;
+	const char *msg = NULL;
+
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_conv_double("0.1", &d, &msg));
+	TEST_ASSERT_TRUE(d == 0.1);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_double("-1.7976931348623157e308",
+						   &d, &msg));
+	TEST_ASSERT_TRUE(d == -1.7976931348623157e308);
+	/* Halfway between 1 and the next double: rounds to even. */
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_double("1.00000000000000011102230246251565404236316680908203125",
+						   &d, &msg));
+	TEST_ASSERT_TRUE(d == 1.0);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_double("4.9406564584124654e-324",
+						   &d, &msg));
+	TEST_ASSERT_TRUE(d == 4.9406564584124654e-324);
+	/* 17 digits and large exponents (the 128 bit path). */
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_double("2.2250738585072014e-308",
+						   &d, &msg));
+	TEST_ASSERT_TRUE(d == DBL_MIN);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_double("1e-300", &d, &msg));
+	TEST_ASSERT_TRUE(d == 1e-300);
+	/* More than 19 digits, decided by the first 19. */
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_double("0.1000000000000000055511151231257827021181583404541015625",
+						   &d, &msg));
+	TEST_ASSERT_TRUE(d == 0.1);
+	/* 2^53 + 1, halfway: left to the slow path. */
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_double("9007199254740993", &d, &msg));
+	TEST_ASSERT_TRUE(d == 9007199254740992.0);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_conv_double(" .5e1", &d, &msg));
+	TEST_ASSERT_TRUE(d == 5.0);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_conv_double("-inf", &d, &msg));
+	TEST_ASSERT_TRUE(d < 0 && d * 0.5 == d);
+	TEST_ASSERT_NULL(msg);
+
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_double("1e309", &d, &msg));
+	TEST_ASSERT_EQUAL_STRING("Real number out of range", msg);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_double("1,5", &d, &msg));
+	TEST_ASSERT_EQUAL_STRING("Expected real number", msg);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_double("1e", &d, &msg));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_double(".", &d, &msg));
+
+	/* 2^24 + 1 is halfway between two floats: it must not be rounded to
+	 * double first. */
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_conv_float("16777217", &f, &msg));
+	TEST_ASSERT_TRUE(f == 16777216.0f);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_float("16777217.000000001", &f, &msg));
+	TEST_ASSERT_TRUE(f == 16777218.0f);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_conv_float("1.17549435e-38", &f, &msg));
+	TEST_ASSERT_TRUE(f == FLT_MIN);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_conv_float("1.4e-45", &f, &msg));
+	TEST_ASSERT_TRUE(f == 1.4e-45f);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_conv_float("3.5e38", &f, &msg));
+}
+
 enum _rules_bad1 {
 	ARG1p,
 	ARG1r,
@@ -471,8 +938,11 @@ static void test_init_fail(void)
 	};
 
 	union opt_data results[3];
-	int parse_result;
+	int parse_result, saved_stderr;
 	static const char *argv[] = {"-s"};
+	struct opt_error err = {0};
+	struct opt_context ctx = {.error = &err};
+	FILE *captured;
 
 	parse_result = optparse_cmd(&cfg_failm, results, 1, argv);
 	TEST_ASSERT_EQUAL_INT(-OPTPARSE_NOMEM, parse_result);
@@ -485,6 +955,21 @@ static void test_init_fail(void)
 	parse_result = optparse_cmd(&cfg_failm, results, 1, argv);
 	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, parse_result);
 
+	/* With an error context, the failure is only stored there. */
+	fflush(stderr);
+	saved_stderr = dup(STDERR_FILENO);
+	TEST_ASSERT_NOT_NULL(captured = tmpfile());
+	dup2(fileno(captured), STDERR_FILENO);
+	parse_result = optparse_cmd_ctx(&cfg_failm, &ctx, results, 1, argv);
+	fflush(stderr);
+	dup2(saved_stderr, STDERR_FILENO);
+	close(saved_stderr);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, parse_result);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, err.code);
+	TEST_ASSERT_EQUAL_INT(0, fseek(captured, 0, SEEK_END));
+	TEST_ASSERT_EQUAL_INT(0, ftell(captured));
+	fclose(captured);
+
 	rules_fail_m[1].action = 50;
 	parse_result = optparse_cmd(&cfg_failm, results, 1, argv);
 	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADCONFIG, parse_result);
@@ -575,6 +1060,779 @@ static void test_collect(void)
 	TEST_ASSERT_EQUAL_PTR(NULL, results[0].d_str);
 }
 
+enum _rules_ids {
+	IDS_VERBOSE,
+	IDS_NAME,
+	IDS_LIST,
+	N_IDS_RULES
+};
+
+static const struct opt_rule rules_ids[N_IDS_RULES] = {
+[IDS_VERBOSE] = OPTPARSE_O(COUNT, 'v', NULL, "Verbosity", 0),
+[IDS_NAME] = OPTPARSE_P(STR_NOCOPY, "set-name", "Name of the set", NULL),
+[IDS_LIST] = OPTPARSE_P(COLLECT_INT64, "ids", "Identifiers", NULL)
+};
+
+static const struct opt_conf cfg_ids = {
+	.helpstr = "Load an ID set",
+	.tune = OPTPARSE_IGNORE_ARGV0,
+	.rules = rules_ids,
+	.n_rules = N_IDS_RULES
+};
+
+static const struct opt_rule rules_reals[] = {
+	OPTPARSE_P_OPT(COLLECT_DOUBLE, "values", "Values", NULL)
+};
+
+static const struct opt_rule rules_names[] = {
+	OPTPARSE_P_OPT(COLLECT_STR, "names", "Names", NULL)
+};
+
+static const struct opt_rule rules_bad_collect1[] = {
+	OPTPARSE_P(COLLECT_STR, "names", "Names", NULL),
+	OPTPARSE_P(STR_NOCOPY, "last", "Cannot come after a collector", NULL)
+};
+
+static const struct opt_rule rules_bad_collect2[] = {
+	OPTPARSE_O(COLLECT_STR, 'n', NULL, "Options cannot collect", NULL)
+};
+
+#define N_MANY_COLLECTED 300
+
+/**
+ * Test collecting positional arguments into arrays.
+ */
+static void test_collect_array(void)
+{
+	union opt_data results[N_IDS_RULES];
+	int parse_result, i;
+	const char *argv_many[N_MANY_COLLECTED];
+	struct opt_conf cfg_tmp = {.helpstr = "Collect", .rules = rules_reals,
+				   .n_rules = 1};
+	struct opt_arena arena = {0};
+	struct opt_context ctx = {.arena = &arena};
+	static const char *argv[] = {NULL, "set1", "12", "-v", "0x10", "--",
+				     "-5000000000", "-1"};
+	static const char *argv_bad[] = {NULL, "set1", "12", "x"};
+	static const char *argv_reals[] = {"0.5", "1e3", "inf"};
+	int argc = sizeof(argv) / sizeof(*argv);
+
+	parse_result = optparse_cmd(&cfg_ids, results, argc, argv);
+	TEST_ASSERT_EQUAL_INT(5, parse_result);
+	TEST_ASSERT_EQUAL_INT(1, results[IDS_VERBOSE].d_int);
+	TEST_ASSERT_EQUAL_STRING("set1", results[IDS_NAME].d_cstr);
+	TEST_ASSERT_EQUAL_UINT(4, (unsigned int)results[IDS_LIST].d_array.count);
+	TEST_ASSERT_TRUE(results[IDS_LIST].d_array.items.i64[0] == 12);
+	TEST_ASSERT_TRUE(results[IDS_LIST].d_array.items.i64[1] == 16);
+	TEST_ASSERT_TRUE(results[IDS_LIST].d_array.items.i64[2]
+			 == -5000000000LL);
+	TEST_ASSERT_TRUE(results[IDS_LIST].d_array.items.i64[3] == -1);
+	optparse_free_strings(&cfg_ids, results);
+	TEST_ASSERT_NULL(results[IDS_LIST].d_array.items.any);
+	TEST_ASSERT_EQUAL_UINT(0, (unsigned int)results[IDS_LIST].d_array.count);
+
+	/* The collector is mandatory, so it needs at least one element */
+	parse_result = optparse_cmd(&cfg_ids, results, 2, argv);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, parse_result);
+
+	/* On error the array is released */
+	parse_result = optparse_cmd(&cfg_ids, results,
+			sizeof(argv_bad) / sizeof(*argv_bad), argv_bad);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, parse_result);
+	TEST_ASSERT_NULL(results[IDS_LIST].d_array.items.any);
+
+	parse_result = optparse_cmd_ctx(&cfg_tmp, &ctx, results, 3, argv_reals);
+	TEST_ASSERT_EQUAL_INT(3, parse_result);
+	TEST_ASSERT_EQUAL_UINT(3, (unsigned int)results[0].d_array.count);
+	TEST_ASSERT_TRUE(results[0].d_array.items.dbl[0] == 0.5);
+	TEST_ASSERT_TRUE(results[0].d_array.items.dbl[1] == 1000.0);
+	TEST_ASSERT_TRUE(results[0].d_array.items.dbl[2] > 1.7976931348623157e308);
+	TEST_ASSERT_EQUAL_UINT(0, (uintptr_t)results[0].d_array.items.dbl
+				  % sizeof(double));
+	optparse_arena_release(&arena);
+
+	parse_result = optparse_cmd(&cfg_tmp, results, 0, argv_reals);
+	TEST_ASSERT_EQUAL_INT(0, parse_result);
+	TEST_ASSERT_NULL(results[0].d_array.items.any);
+
+	cfg_tmp.rules = rules_names;
+	parse_result = optparse_cmd(&cfg_tmp, results, 3, argv_reals);
+	TEST_ASSERT_EQUAL_INT(3, parse_result);
+	TEST_ASSERT_EQUAL_PTR(argv_reals[2], results[0].d_array.items.str[2]);
+	optparse_free_strings(&cfg_tmp, results);
+
+	/* Collected values are not limited to OPTPARSE_MAX_POSITIONAL. */
+	for (i = 0; i < N_MANY_COLLECTED; i++) {
+		argv_many[i] = argv_reals[i % 3];
+	}
+	parse_result = optparse_cmd(&cfg_tmp, results, N_MANY_COLLECTED,
+				    argv_many);
+	TEST_ASSERT_EQUAL_INT(N_MANY_COLLECTED, parse_result);
+	TEST_ASSERT_EQUAL_UINT(N_MANY_COLLECTED,
+			       (unsigned int)results[0].d_array.count);
+	TEST_ASSERT_EQUAL_PTR(argv_reals[(N_MANY_COLLECTED - 1) % 3],
+		results[0].d_array.items.str[N_MANY_COLLECTED - 1]);
+	optparse_free_strings(&cfg_tmp, results);
+
+	cfg_tmp.rules = rules_bad_collect1;
+	cfg_tmp.n_rules = 2;
+	parse_result = optparse_cmd(&cfg_tmp, results, 3, argv_reals);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADCONFIG, parse_result);
+
+	cfg_tmp.rules = rules_bad_collect2;
+	cfg_tmp.n_rules = 1;
+	parse_result = optparse_cmd(&cfg_tmp, results, 3, argv_reals);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADCONFIG, parse_result);
+}
+
+enum _rules_append {
+	INCLUDES,
+	LEVELS,
+	WEIGHTS,
+	N_APPEND_RULES
+};
+
+static const struct opt_rule rules_append[N_APPEND_RULES] = {
+[INCLUDES] = OPTPARSE_O(APPEND_STR, 'I', "include", "Include path", NULL),
+[LEVELS] = OPTPARSE_O(APPEND_INT64, 'l', NULL, "Level", NULL),
+[WEIGHTS] = OPTPARSE_O(APPEND_DOUBLE, 'w', "weight", "Weight", NULL)
+};
+
+static const struct opt_conf cfg_append = {
+	.helpstr = "Repeatable options",
+	.tune = 0,
+	.rules = rules_append,
+	.n_rules = N_APPEND_RULES
+};
+
+#define N_APPENDED 100
+
+/**
+ * Test options that append to an array.
+ */
+static void test_append(void)
+{
+	union opt_data results[N_APPEND_RULES];
+	int parse_result, i;
+	const char *argv[2 * N_APPENDED + 4];
+	char levels[N_APPENDED][4];
+	struct opt_arena arena = {0};
+	struct opt_context ctx = {.arena = &arena};
+	static const char *argv_bad[] = {"-Ia", "-l", "1", "-l", "x"};
+
+	for (i = 0; i < N_APPENDED; i++) {
+		sprintf(levels[i], "%d", i);
+		argv[2 * i] = (i % 2) ? "-l" : "--include";
+		argv[2 * i + 1] = levels[i];
+	}
+	argv[2 * N_APPENDED] = "-w1.5";
+	argv[2 * N_APPENDED + 1] = "-Iz";
+	argv[2 * N_APPENDED + 2] = "--weight";
+	argv[2 * N_APPENDED + 3] = "2";
+
+	parse_result = optparse_cmd(&cfg_append, results,
+				    2 * N_APPENDED + 4, argv);
+	TEST_ASSERT_EQUAL_INT(0, parse_result);
+	TEST_ASSERT_EQUAL_UINT(N_APPENDED / 2 + 1,
+			       (unsigned int)results[INCLUDES].d_array.count);
+	TEST_ASSERT_EQUAL_UINT(N_APPENDED / 2,
+			       (unsigned int)results[LEVELS].d_array.count);
+	for (i = 0; i < N_APPENDED / 2; i++) {
+		TEST_ASSERT_EQUAL_STRING(levels[2 * i],
+				results[INCLUDES].d_array.items.str[i]);
+		TEST_ASSERT_TRUE(results[LEVELS].d_array.items.i64[i]
+				 == 2 * i + 1);
+	}
+	TEST_ASSERT_EQUAL_STRING("z",
+			results[INCLUDES].d_array.items.str[N_APPENDED / 2]);
+	TEST_ASSERT_EQUAL_UINT(2, (unsigned int)results[WEIGHTS].d_array.count);
+	TEST_ASSERT_TRUE(results[WEIGHTS].d_array.items.dbl[0] == 1.5);
+	TEST_ASSERT_TRUE(results[WEIGHTS].d_array.items.dbl[1] == 2.0);
+	optparse_free_strings(&cfg_append, results);
+	TEST_ASSERT_NULL(results[INCLUDES].d_array.items.any);
+
+	/* Options that are not given have an empty array. */
+	parse_result = optparse_cmd_ctx(&cfg_append, &ctx, results, 4, argv);
+	TEST_ASSERT_EQUAL_INT(0, parse_result);
+	TEST_ASSERT_EQUAL_UINT(1, (unsigned int)results[INCLUDES].d_array.count);
+	TEST_ASSERT_EQUAL_UINT(1, (unsigned int)results[LEVELS].d_array.count);
+	TEST_ASSERT_EQUAL_UINT(0, (unsigned int)results[WEIGHTS].d_array.count);
+	TEST_ASSERT_NULL(results[WEIGHTS].d_array.items.any);
+
+	/* A failed parse does not leave pointers into the arena. */
+	parse_result = optparse_cmd_ctx(&cfg_append, &ctx, results,
+			sizeof(argv_bad) / sizeof(*argv_bad), argv_bad);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, parse_result);
+	TEST_ASSERT_NULL(results[INCLUDES].d_array.items.any);
+	TEST_ASSERT_EQUAL_UINT(0, (unsigned int)results[INCLUDES].d_array.count);
+	TEST_ASSERT_NULL(results[LEVELS].d_array.items.any);
+	optparse_arena_release(&arena);
+
+	parse_result = optparse_cmd(&cfg_append, results,
+			sizeof(argv_bad) / sizeof(*argv_bad), argv_bad);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, parse_result);
+	TEST_ASSERT_NULL(results[INCLUDES].d_array.items.any);
+	TEST_ASSERT_NULL(results[LEVELS].d_array.items.any);
+}
+
+/**
+ * Test the incremental parser.
+ */
+static void test_feed(void)
+{
+	union opt_data results[N_RULES];
+	union opt_data ids[N_IDS_RULES];
+	struct opt_state state;
+	int i;
+	static const char *tokens[] = {NULL, "-vvs", "--key", "thekey", "x1",
+				       "-c-7", "x2"};
+	static const char *id_tokens[] = {NULL, "set", "1", "2", "3", "4", "5"};
+
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_begin(&state, &cfg, NULL, results));
+	for (i = 0; i < (int)(sizeof(tokens) / sizeof(*tokens)); i++) {
+		TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+				      optparse_feed(&state, tokens[i]));
+	}
+	TEST_ASSERT_EQUAL_INT(2, optparse_end(&state));
+	TEST_ASSERT_EQUAL_INT(2, results[VERBOSITY].d_int);
+	TEST_ASSERT_TRUE(results[SETTABLE].d_bool);
+	TEST_ASSERT_EQUAL_STRING("thekey", results[KEY].d_str);
+	TEST_ASSERT_EQUAL_INT(-7, results[INTTHING].d_int);
+	TEST_ASSERT_EQUAL_STRING("x1", results[ARG1].d_cstr);
+	optparse_free_strings(&cfg, results);
+
+	/* Errors are reported on the bad token, and stick. */
+	optparse_begin(&state, &cfg, NULL, results);
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_feed(&state, "argv0"));
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_feed(&state, "--copyme"));
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_feed(&state, "copied"));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_feed(&state, "--nope"));
+	TEST_ASSERT_NULL(results[COPYME].d_str);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_feed(&state, "x1"));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, optparse_end(&state));
+
+	/* An option at the end without its value */
+	optparse_begin(&state, &cfg, NULL, results);
+	for (i = 0; i < 4; i++) {
+		optparse_feed(&state, tokens[(i < 3) ? i : 4]);
+	}
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_feed(&state, "x2"));
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_feed(&state, "-c"));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, optparse_end(&state));
+
+	/* Collected arrays grow when the number of tokens is unknown. */
+	optparse_begin(&state, &cfg_ids, NULL, ids);
+	for (i = 0; i < (int)(sizeof(id_tokens) / sizeof(*id_tokens)); i++) {
+		optparse_feed(&state, id_tokens[i]);
+	}
+	TEST_ASSERT_EQUAL_INT(6, optparse_end(&state));
+	TEST_ASSERT_EQUAL_UINT(5, (unsigned int)ids[IDS_LIST].d_array.count);
+	TEST_ASSERT_TRUE(ids[IDS_LIST].d_array.items.i64[4] == 5);
+	optparse_free_strings(&cfg_ids, ids);
+}
+
+/**
+ * Test the in-place tokenizer and command line parsing.
+ */
+static void test_tokenize(void)
+{
+	union opt_data results[N_RULES];
+	const char *argv[8];
+	char line1[] = "  cmd -k 'a b'\t\"say \\\"hi\\\" \\n\" x\\ y ''  ";
+	char line2[] = "it's";
+	char line3[] = "a b c";
+	char line4[] = "cmd x1 --key \"the key\" x2 -c'-5'";
+	char line5[] = "cmd x1 \"x2";
+	int argc;
+
+	argc = optparse_tokenize_inplace(line1, argv, 8);
+	TEST_ASSERT_EQUAL_INT(6, argc);
+	TEST_ASSERT_EQUAL_STRING("cmd", argv[0]);
+	TEST_ASSERT_EQUAL_STRING("-k", argv[1]);
+	TEST_ASSERT_EQUAL_STRING("a b", argv[2]);
+	TEST_ASSERT_EQUAL_STRING("say \"hi\" \\n", argv[3]);
+	TEST_ASSERT_EQUAL_STRING("x y", argv[4]);
+	TEST_ASSERT_EQUAL_STRING("", argv[5]);
+	/* Tokens point into the line */
+	TEST_ASSERT_TRUE(argv[5] > line1 && argv[5] < line1 + sizeof(line1));
+
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_tokenize_inplace(line2, argv, 8));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_NOMEM,
+			      optparse_tokenize_inplace(line3, argv, 2));
+
+	TEST_ASSERT_EQUAL_INT(2, optparse_cmd_line(&cfg, NULL, results, line4));
+	TEST_ASSERT_EQUAL_STRING("the key", results[KEY].d_str);
+	TEST_ASSERT_EQUAL_STRING("x1", results[ARG1].d_cstr);
+	TEST_ASSERT_EQUAL_INT(-5, results[INTTHING].d_int);
+	optparse_free_strings(&cfg, results);
+
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_cmd_line(&cfg, NULL, results, line5));
+}
+
+/**
+ * Test the iterator API.
+ */
+static void test_next(void)
+{
+	struct opt_state state;
+	struct opt_event ev;
+	struct opt_index index;
+	struct opt_context ctx = {.index = &index};
+	static const char *argv[] = {"prog", "-vs", "--key", "k", "-c7", "x1",
+				     "abc", "--", "-5"};
+	static const char *argv_short[] = {"prog", "x1"};
+	static const char *argv_bad[] = {"prog", "-y"};
+	static const struct {
+		int rule, position, argi;
+		const char *value;
+	} expected[] = {
+		{VERBOSITY, -1, 1, NULL}, {SETTABLE, -1, 1, NULL},
+		{KEY, -1, 3, "k"}, {INTTHING, -1, 4, "7"}, {ARG1, 0, 5, "x1"},
+		{ARG2, 1, 6, "abc"}, {ARG3, 2, 8, "-5"}
+	};
+	int argc = sizeof(argv) / sizeof(*argv);
+	int i, pass;
+
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_compile(&cfg, &index));
+
+	/* The same events with and without an index. */
+	for (pass = 0; pass < 2; pass++) {
+		TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+				      optparse_iter_begin(&state, &cfg,
+							  pass ? &ctx : NULL,
+							  argc, argv));
+		for (i = 0; i < (int)(sizeof(expected) / sizeof(*expected));
+		     i++) {
+			TEST_ASSERT_EQUAL_INT(1, optparse_next(&state, &ev));
+			TEST_ASSERT_EQUAL_INT(expected[i].rule,
+					      ev.rule - cfg.rules);
+			TEST_ASSERT_EQUAL_INT(expected[i].position,
+					      ev.position);
+			TEST_ASSERT_EQUAL_INT(expected[i].argi, ev.argi);
+			if (expected[i].value == NULL) {
+				TEST_ASSERT_NULL(ev.value);
+			} else {
+				TEST_ASSERT_EQUAL_STRING(expected[i].value,
+							 ev.value);
+			}
+		}
+		TEST_ASSERT_EQUAL_INT(0, optparse_next(&state, &ev));
+		TEST_ASSERT_EQUAL_INT(0, optparse_next(&state, &ev));
+
+		/* Missing arguments are reported at the end */
+		optparse_iter_begin(&state, &cfg, pass ? &ctx : NULL, 2,
+				    argv_short);
+		TEST_ASSERT_EQUAL_INT(1, optparse_next(&state, &ev));
+		TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+				      optparse_next(&state, &ev));
+
+		optparse_iter_begin(&state, &cfg, pass ? &ctx : NULL, 2,
+				    argv_bad);
+		TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+				      optparse_next(&state, &ev));
+		TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+				      optparse_next(&state, &ev));
+	}
+
+	optparse_index_free(&index);
+}
+
+/**
+ * Test that errors are reported through the context.
+ */
+static void test_error_context(void)
+{
+	union opt_data results[N_RULES];
+	struct opt_state state;
+	struct opt_event ev;
+	char buf[40];
+	struct opt_error err = {0};
+	struct opt_context ctx = {.error = &err};
+	static const char *argv_unknown[] = {"prog", "x1", "-y"};
+	static const char *argv_missing[] = {"prog", "x1"};
+	static const char *argv_help[] = {"prog", "-h"};
+	static const char *argv_good[] = {"prog", "x1", "abc"};
+
+	/* Without a buffer, only the code, index and message are stored. */
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_cmd_ctx(&cfg, &ctx, results, 3,
+					       argv_unknown));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, err.code);
+	TEST_ASSERT_EQUAL_INT(2, err.token);
+	TEST_ASSERT_EQUAL_STRING("Unknown option", err.msg);
+
+	err.buf = buf;
+	err.buf_size = sizeof(buf);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_cmd_ctx(&cfg, &ctx, results, 3,
+					       argv_unknown));
+	TEST_ASSERT_EQUAL_STRING("Unknown option: -y", buf);
+
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_cmd_ctx(&cfg, &ctx, results, 2,
+					       argv_missing));
+	TEST_ASSERT_EQUAL_INT(2, err.token);
+	TEST_ASSERT_EQUAL_STRING("Missing argument: count-my-letters", buf);
+
+	/* The help is not printed */
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_REQHELP,
+			      optparse_cmd_ctx(&cfg, &ctx, results, 2,
+					       argv_help));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_REQHELP, err.code);
+	TEST_ASSERT_EQUAL_INT(1, err.token);
+
+	TEST_ASSERT_EQUAL_INT(2, optparse_cmd_ctx(&cfg, &ctx, results, 3,
+						  argv_good));
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, err.code);
+	TEST_ASSERT_EQUAL_STRING("", buf);
+	optparse_free_strings(&cfg, results);
+
+	/* Truncation */
+	err.buf_size = 8;
+	optparse_iter_begin(&state, &cfg, &ctx, 3, argv_unknown);
+	TEST_ASSERT_EQUAL_INT(1, optparse_next(&state, &ev));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, optparse_next(&state, &ev));
+	TEST_ASSERT_EQUAL_INT(2, err.token);
+	TEST_ASSERT_EQUAL_STRING("Unknown", buf);
+}
+
+#define N_BATCH 1000
+
+#ifdef OPTPARSE_THREAD_CREATE
+/** Number of batch threads that can still be started, or -1 for any. */
+static int threads_left = -1;
+
+int OPTPARSE_THREAD_CREATE(pthread_t *thread, const pthread_attr_t *attr,
+			   void *(*start)(void *), void *arg);
+
+int OPTPARSE_THREAD_CREATE(pthread_t *thread, const pthread_attr_t *attr,
+			   void *(*start)(void *), void *arg)
+{
+	if (threads_left == 0) {
+		return EAGAIN;
+	}
+	if (threads_left > 0) {
+		threads_left--;
+	}
+
+	return pthread_create(thread, attr, start, arg);
+}
+#endif /* OPTPARSE_THREAD_CREATE */
+
+/**
+ * Test batch parsing. Every third line is bad.
+ */
+static void test_batch(void)
+{
+	static union opt_data results[N_BATCH][N_RULES];
+	static const char *lines[N_BATCH][4];
+	static const char * const *argv[N_BATCH];
+	static int argc[N_BATCH], status[N_BATCH];
+	static char numbers[N_BATCH][8];
+	struct opt_index index;
+	int i, workers, pass;
+#ifdef OPTPARSE_THREAD_CREATE
+	/* Workers, and threads that start, in each pass: the last passes make
+	 * some of them fail to start. */
+	static const int passes[][2] = {{0, -1}, {4, -1}, {8, -1},
+					{8, 0}, {8, 3}};
+#else
+	static const int passes[][2] = {{0, -1}, {4, -1}, {8, -1}};
+#endif
+
+	for (i = 0; i < N_BATCH; i++) {
+		sprintf(numbers[i], "-c%d", i);
+		lines[i][0] = "prog";
+		lines[i][1] = numbers[i];
+		lines[i][2] = "x1";
+		lines[i][3] = (i % 3 == 2) ? "z" : "abc";
+		argv[i] = lines[i];
+		argc[i] = 4;
+	}
+
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_compile(&cfg, &index));
+
+	for (pass = 0; pass < (int)(sizeof(passes) / sizeof(*passes)); pass++) {
+		workers = passes[pass][0];
+#ifdef OPTPARSE_THREAD_CREATE
+		threads_left = passes[pass][1];
+#endif
+		memset(status, 0x55, sizeof(status));
+		TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+				      optparse_cmd_batch(&index, N_BATCH, argc,
+							 argv, results[0],
+							 status, workers));
+		for (i = 0; i < N_BATCH; i++) {
+			if (i % 3 == 2) {
+				/* count_letters rejects one letter words */
+				TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+						      status[i]);
+			} else {
+				TEST_ASSERT_EQUAL_INT(2, status[i]);
+				TEST_ASSERT_EQUAL_INT(i,
+						results[i][INTTHING].d_int);
+				optparse_free_strings(&cfg, results[i]);
+			}
+		}
+	}
+
+#ifdef OPTPARSE_THREAD_CREATE
+	threads_left = -1;
+#endif
+
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_cmd_batch(&index, 1, argc, argv,
+						 results[0], status, 1));
+	optparse_free_strings(&cfg, results[0]);
+
+	optparse_index_free(&index);
+}
+
+/**
+ * Test columnar batch output. Every third line is bad and every fifth line
+ * sets --key.
+ */
+static void test_columns(void)
+{
+	static const char *lines[N_BATCH][6];
+	static const char * const *argv[N_BATCH];
+	static int argc[N_BATCH], status[N_BATCH];
+	static char numbers[N_BATCH][8];
+	struct opt_index index;
+	struct opt_columns cols;
+	union opt_data results[N_RULES];
+	unsigned char given[(N_RULES + 7) / 8];
+	struct opt_context ctx = {NULL};
+	static const char *argv_given[] = {"prog", "-c", "3", "x1", "abc"};
+	int i, workers;
+
+	for (i = 0; i < N_BATCH; i++) {
+		int n = 0;
+
+		sprintf(numbers[i], "-c%d", i);
+		lines[i][n++] = "prog";
+		lines[i][n++] = numbers[i];
+		if (i % 5 == 0) {
+			lines[i][n++] = "--key";
+			lines[i][n++] = "k";
+		}
+		lines[i][n++] = "x1";
+		lines[i][n++] = (i % 3 == 2) ? "z" : "abc";
+		argv[i] = lines[i];
+		argc[i] = n;
+	}
+
+	TEST_ASSERT_EQUAL_UINT(sizeof(int),
+			       optparse_column_size(rules + INTTHING));
+	TEST_ASSERT_EQUAL_UINT(sizeof(bool),
+			       optparse_column_size(rules + SETTABLE));
+	TEST_ASSERT_EQUAL_UINT(0, optparse_column_size(rules + IGNORED1));
+
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_compile(&cfg, &index));
+
+	for (workers = 1; workers <= 4; workers += 3) {
+		const int *ints;
+		const bool *bools;
+		char * const *keys;
+
+		TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+				      optparse_columns_init(&index, N_BATCH,
+							    &cols));
+		TEST_ASSERT_NULL(cols.values[IGNORED1]);
+
+		TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+				      optparse_cmd_batch_columns(&index,
+						N_BATCH, argc, argv, &cols,
+						status, workers));
+		ints = cols.values[INTTHING];
+		bools = cols.values[UNSETTABLE];
+		keys = cols.values[KEY];
+
+		for (i = 0; i < N_BATCH; i++) {
+			bool ok = i % 3 != 2;
+			bool has_key = ok && i % 5 == 0;
+
+			TEST_ASSERT_EQUAL_INT(ok ? 2 : -OPTPARSE_BADSYNTAX,
+					      status[i]);
+			TEST_ASSERT_EQUAL_INT(ok ? i : 0, ints[i]);
+			TEST_ASSERT_EQUAL_INT(ok, bools[i]);
+			TEST_ASSERT_EQUAL_INT(ok, (cols.given[INTTHING][i / 8]
+						   >> i % 8) & 1);
+			TEST_ASSERT_EQUAL_INT(0, (cols.given[UNSETTABLE][i / 8]
+						  >> i % 8) & 1);
+			TEST_ASSERT_EQUAL_INT(has_key, (cols.given[KEY][i / 8]
+						       >> i % 8) & 1);
+			if (has_key) {
+				TEST_ASSERT_EQUAL_STRING("k", keys[i]);
+			} else {
+				TEST_ASSERT_NULL(keys[i]);
+			}
+		}
+
+		optparse_columns_free(&index, &cols);
+	}
+
+	optparse_index_free(&index);
+
+	/* The given bitmap also works for single parses. */
+	ctx.given = given;
+	memset(given, 0xff, sizeof(given));
+	TEST_ASSERT_EQUAL_INT(2, optparse_cmd_ctx(&cfg, &ctx, results, 5,
+						  argv_given));
+	for (i = 0; i < N_RULES; i++) {
+		TEST_ASSERT_EQUAL_INT(i == INTTHING || i == ARG1 || i == ARG2,
+				      (given[i / 8] >> i % 8) & 1);
+	}
+	optparse_free_strings(&cfg, results);
+}
+
+/**
+ * Test the statistics. They are only collected if the library is built with
+ * OPTPARSE_STATS.
+ */
+static void test_stats(void)
+{
+	union opt_data results[N_RULES];
+	struct opt_stats stats = {0};
+	struct opt_context ctx = {NULL};
+	struct opt_index index;
+	static const char *argv[] = {"prog", "-vs", "--key", "k", "x1", "abc",
+				     "--", "-5"};
+	int argc = sizeof(argv) / sizeof(*argv);
+
+	ctx.stats = &stats;
+	TEST_ASSERT_EQUAL_INT(3, optparse_cmd_ctx(&cfg, &ctx, results, argc,
+						  argv));
+	optparse_free_strings(&cfg, results);
+
+#ifdef OPTPARSE_STATS
+	TEST_ASSERT_EQUAL_UINT(8, stats.tokens);
+	/* -v, -s, --key and "--" is not looked up */
+	TEST_ASSERT_EQUAL_UINT(3, stats.opt_lookups);
+	/* --key is compared against every long option up to itself */
+	TEST_ASSERT_TRUE(stats.str_compares >= 2);
+	TEST_ASSERT_EQUAL_UINT(3, stats.pos_lookups);
+	TEST_ASSERT_EQUAL_UINT(1, stats.actions[OPTPARSE_COUNT]);
+	TEST_ASSERT_EQUAL_UINT(1, stats.actions[OPTPARSE_SET_BOOL]);
+	TEST_ASSERT_EQUAL_UINT(1, stats.actions[OPTPARSE_STR]);
+	TEST_ASSERT_EQUAL_UINT(2, stats.actions[OPTPARSE_STR_NOCOPY]);
+	TEST_ASSERT_EQUAL_UINT(1, stats.actions[OPTPARSE_CUSTOM_ACTION]);
+	/* "k" and the default of --copyme */
+	TEST_ASSERT_EQUAL_UINT(2 + sizeof("free-me"), stats.str_bytes);
+	/* Two defaults and one argument */
+	TEST_ASSERT_EQUAL_UINT(3, stats.callbacks);
+
+	/* With an index, long options take a single comparison. */
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_compile(&cfg, &index));
+	memset(&stats, 0, sizeof(stats));
+	ctx.index = &index;
+	TEST_ASSERT_EQUAL_INT(3, optparse_cmd_ctx(&cfg, &ctx, results, argc,
+						  argv));
+	optparse_free_strings(&cfg, results);
+	TEST_ASSERT_EQUAL_UINT(1, stats.str_compares);
+	optparse_index_free(&index);
+#else
+	(void)index;
+	TEST_ASSERT_EQUAL_UINT(0, stats.tokens);
+	TEST_ASSERT_EQUAL_UINT(0, stats.opt_lookups);
+#endif
+}
+
+static void write_file(const char *path, const char *text)
+{
+	FILE *f = fopen(path, "w");
+
+	TEST_ASSERT_NOT_NULL(f);
+	fputs(text, f);
+	fclose(f);
+}
+
+/** Number of options written to a pipe: more than fits in the first read. */
+#define N_PIPED 1000
+
+/**
+ * Test @file expansion.
+ */
+static void test_response_files(void)
+{
+	union opt_data results[N_RULES];
+	struct opt_response_files files = {0};
+	struct opt_context ctx = {.files = &files};
+	static const char *argv[] = {"cmd", "@resp1.tmp", "abc"};
+	static const char *argv_literal[] = {"cmd", "--", "@resp1.tmp", "abc"};
+	static const char *argv_loop[] = {"cmd", "@resp3.tmp"};
+	static const char *argv_missing[] = {"cmd", "@resp-none.tmp"};
+	static const char *argv_bad[] = {"cmd", "@resp4.tmp"};
+	char pipe_arg[32];
+	const char *argv_pipe[] = {"cmd", pipe_arg};
+	int fds[2], i;
+
+	write_file("resp1.tmp", "--key 'the key'\n@resp2.tmp \"x 1\"\n");
+	write_file("resp2.tmp", "-c -5\n\t-q qval");
+	write_file("resp3.tmp", "-v @resp3.tmp");
+	write_file("resp4.tmp", "-q 'unterminated");
+
+	TEST_ASSERT_EQUAL_INT(2, optparse_cmd_ctx(&cfg, &ctx, results, 3, argv));
+	TEST_ASSERT_EQUAL_STRING("the key", results[KEY].d_str);
+	TEST_ASSERT_EQUAL_INT(-5, results[INTTHING].d_int);
+	TEST_ASSERT_EQUAL_STRING("qval", results[QTHING].d_cstr);
+	TEST_ASSERT_EQUAL_STRING("x 1", results[ARG1].d_cstr);
+	TEST_ASSERT_EQUAL_INT(3, results[ARG2].d_uint);
+	TEST_ASSERT_NOT_NULL(files.loaded);
+	optparse_free_strings(&cfg, results);
+
+	/* Not expanded after "--", nor without a files context. */
+	TEST_ASSERT_EQUAL_INT(2, optparse_cmd_ctx(&cfg, &ctx, results, 4,
+						  argv_literal));
+	TEST_ASSERT_EQUAL_STRING("@resp1.tmp", results[ARG1].d_cstr);
+	optparse_free_strings(&cfg, results);
+
+	TEST_ASSERT_EQUAL_INT(2, optparse_cmd(&cfg, results, 3, argv));
+	TEST_ASSERT_EQUAL_STRING("@resp1.tmp", results[ARG1].d_cstr);
+	optparse_free_strings(&cfg, results);
+
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_cmd_ctx(&cfg, &ctx, results, 2, argv_loop));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_cmd_ctx(&cfg, &ctx, results, 2,
+					       argv_missing));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_cmd_ctx(&cfg, &ctx, results, 2, argv_bad));
+
+	/* Files that cannot seek, bigger than the first read. */
+	TEST_ASSERT_EQUAL_INT(0, pipe(fds));
+	for (i = 0; i < N_PIPED; i++) {
+		TEST_ASSERT_EQUAL_INT(3, write(fds[1], "-v ", 3));
+	}
+	TEST_ASSERT_EQUAL_INT(9, write(fds[1], "x1 abcde\n", 9));
+	close(fds[1]);
+	sprintf(pipe_arg, "@/dev/fd/%d", fds[0]);
+	TEST_ASSERT_EQUAL_INT(2, optparse_cmd_ctx(&cfg, &ctx, results, 2,
+						  argv_pipe));
+	close(fds[0]);
+	TEST_ASSERT_EQUAL_INT(N_PIPED, results[VERBOSITY].d_int);
+	TEST_ASSERT_EQUAL_STRING("x1", results[ARG1].d_cstr);
+	TEST_ASSERT_EQUAL_UINT(5, results[ARG2].d_uint);
+	optparse_free_strings(&cfg, results);
+
+	files.max_depth = 1;
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_cmd_ctx(&cfg, &ctx, results, 3, argv));
+
+	optparse_release_files(&files);
+	TEST_ASSERT_NULL(files.loaded);
+
+	remove("resp1.tmp");
+	remove("resp2.tmp");
+	remove("resp3.tmp");
+	remove("resp4.tmp");
+}
+
 static const struct opt_rule manyopts[1] = {
 	OPTPARSE_P_OPT(COUNT, "countme", NULL, 1000),
 };
@@ -590,9 +1848,9 @@ static void test_toomany(void)
 {
 	union opt_data results[1];
 	int parse_result;
-	static const char *argv[256] = {"hello"};
+	static const char *argv[257] = {"hello"};
 
-	for (int i=0; i < 256; i++) {
+	for (int i=0; i < 257; i++) {
 		argv[i] = argv[0];
 	}
 
@@ -609,7 +1867,12 @@ static void test_toomany(void)
 	TEST_ASSERT_EQUAL_INT(1256, results[0].d_uint);
 
 	parse_result = optparse_cmd(&cfg_many, results, 257, argv);
+#ifdef OPTPARSE_WIDE_POSITIONAL
+	TEST_ASSERT_EQUAL_INT(257, parse_result);
+	TEST_ASSERT_EQUAL_INT(1257, results[0].d_uint);
+#else
 	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, parse_result);
+#endif
 }
 
 int report_position(union opt_key key, const char *value,
@@ -619,7 +1882,7 @@ int report_position(union opt_key key, const char *value,
 	if (value == NULL) {
 		dest->d_int = -1;
 	} else {
-		dest->d_int = key.argument->position;
+		dest->d_int = (int)key.argument->position;
 	}
 
 	return -OPTPARSE_OK;
@@ -685,7 +1948,387 @@ static void test_pos(void)
 
 	parse_result = optparse_cmd(&cfg_pos, results,
 				sizeof(argv)/sizeof(*argv), argv);
+#ifdef OPTPARSE_WIDE_POSITIONAL
+	TEST_ASSERT_EQUAL_INT(257, parse_result);
+	TEST_ASSERT_EQUAL_INT(256, results[4].d_int);
+#else
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, parse_result);
+#endif
+}
+
+#ifdef OPTPARSE_WIDE_POSITIONAL
+/**
+ * Check that callbacks get the exact position past the narrow limit.
+ */
+static void test_wide_pos(void)
+{
+	union opt_data results[sizeof(testpos)/ sizeof(*testpos)];
+	struct opt_index index;
+	int parse_result;
+	const int n_args = 100000;
+	const char **argv = malloc((size_t)n_args * sizeof(*argv));
+
+	TEST_ASSERT_NOT_NULL(argv);
+	for (int i = 0; i < n_args; i++) {
+		argv[i] = "x";
+	}
+
+	parse_result = optparse_cmd(&cfg_pos, results, n_args, argv);
+	TEST_ASSERT_EQUAL_INT(n_args, parse_result);
+	TEST_ASSERT_EQUAL_INT(n_args - 1, results[4].d_int);
+
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_compile(&cfg_pos, &index));
+	parse_result = optparse_cmd_compiled(&index, results, n_args, argv);
+	TEST_ASSERT_EQUAL_INT(n_args, parse_result);
+	TEST_ASSERT_EQUAL_INT(n_args - 1, results[4].d_int);
+	optparse_index_free(&index);
+
+	free(argv);
+}
+#endif /* OPTPARSE_WIDE_POSITIONAL */
+
+/**
+ * Check that a compiled configuration gives the same results.
+ */
+static void test_compiled(void)
+{
+	struct opt_index index;
+	union opt_data results[N_RULES];
+	int parse_result;
+	static const char *argv[] = {"test", "-c", "-3", "--key", "hello",
+				     "-vf5.5", "-qpasted", "-vv9", "--verbose",
+				     "-s", "--q", "2.5", "--124", "--cc", "423",
+				     "x1", "x22"};
+	static const char *argv_bad[] = {"test", "--ke", "x1", "x2"};
+
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_compile(&cfg, &index));
+
+	parse_result = optparse_cmd_compiled(&index, results,
+					     sizeof(argv) / sizeof(*argv), argv);
+	TEST_ASSERT_EQUAL_INT(2, parse_result);
+	TEST_ASSERT_EQUAL_INT(-3, results[INTTHING].d_int);
+	TEST_ASSERT_EQUAL_UINT(423, results[UINTTHING].d_uint);
+	TEST_ASSERT_EQUAL_INT(4, results[VERBOSITY].d_int);
+	TEST_ASSERT_EQUAL_STRING("hello", results[KEY].d_str);
+	TEST_ASSERT_EQUAL_STRING("pasted", results[QTHING].d_cstr);
+	TEST_ASSERT_EQUAL_FLOAT(2.5f, results[FLOATTHING].d_float);
+	TEST_ASSERT_TRUE(results[SETTABLE].d_bool);
+	TEST_ASSERT_EQUAL_UINT(3, results[ARG2].d_uint);
+	optparse_free_strings(&cfg, results);
+
+	parse_result = optparse_cmd_compiled(&index, results,
+					     sizeof(argv_bad) / sizeof(*argv_bad),
+					     argv_bad);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, parse_result);
+
+	optparse_index_free(&index);
+
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADCONFIG,
+			      optparse_compile(&cfg_bad1, &index));
+	optparse_index_free(&index);
+}
+
+/**
+ * A matcher for cfg, like the ones made by matchgen, that only knows some of
+ * the options.
+ */
+static int partial_match(const char *long_id, char short_id)
+{
+	if (long_id == NULL) {
+		switch (short_id) {
+			case 'v': return VERBOSITY;
+			case 'c': return INTTHING;
+		}
+		return -1;
+	}
+
+	switch (strlen(long_id)) {
+		case 3:
+			return memcmp(long_id, "key", 3) ? -1 : KEY;
+	}
+
+	return -1;
+}
+
+/**
+ * Check that a generated matcher replaces the lookup of options.
+ */
+static void test_matcher(void)
+{
+	struct opt_index index;
+	union opt_data results[N_RULES];
+	struct opt_conf cfg_match = cfg;
+	static const char *argv[] = {"test", "-vv", "--key", "k", "-c7",
+				     "x1", "x22"};
+	static const char *argv_bad[] = {"test", "-s", "x1", "x22"};
+
+	cfg_match.matcher = partial_match;
+
+	TEST_ASSERT_EQUAL_INT(2, optparse_cmd(&cfg_match, results,
+					      sizeof(argv) / sizeof(*argv),
+					      argv));
+	TEST_ASSERT_EQUAL_INT(2, results[VERBOSITY].d_int);
+	TEST_ASSERT_EQUAL_INT(7, results[INTTHING].d_int);
+	TEST_ASSERT_EQUAL_STRING("k", results[KEY].d_str);
+	optparse_free_strings(&cfg_match, results);
+
+	/* The rules the matcher does not know are unknown options */
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_cmd(&cfg_match, results,
+					   sizeof(argv_bad) / sizeof(*argv_bad),
+					   argv_bad));
+
+	/* It also takes precedence over the index */
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_compile(&cfg_match, &index));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_cmd_compiled(&index, results,
+						    sizeof(argv_bad)
+						    / sizeof(*argv_bad),
+						    argv_bad));
+	optparse_index_free(&index);
+}
+
+/**
+ * Actions for cfg, like the ones made by matchgen, that only handle some of
+ * the rules. -v counts by tens, so that it is told apart from the library.
+ */
+static int partial_apply(int rule, const char *value, union opt_data *dest,
+			 const char **msg)
+{
+	int ret;
+	int64_t i_value;
+
+	switch (rule) {
+		case VERBOSITY:
+			dest->d_int += 10;
+			return OPTPARSE_OK;
+		case INTTHING:
+			ret = optparse_conv_int(value, INT_MIN, INT_MAX,
+						&i_value, msg);
+			if (ret == OPTPARSE_OK) {
+				dest->d_int = (int)i_value;
+			}
+			return ret;
+	}
+
+	return OPTPARSE_DEFAULT_ACTION;
+}
+
+/**
+ * Check that generated actions replace the built-in ones for the rules they
+ * handle.
+ */
+static void test_apply(void)
+{
+	union opt_data results[N_RULES];
+	struct opt_conf cfg_apply = cfg;
+	struct opt_index index;
+	static const char *argv[] = {"test", "-vv", "--key", "k", "-c7",
+				     "x1", "x22"};
+	static const char *argv_bad[] = {"test", "-cx", "x1", "x22"};
+
+	cfg_apply.apply = partial_apply;
+
+	TEST_ASSERT_EQUAL_INT(2, optparse_cmd(&cfg_apply, results,
+					      sizeof(argv) / sizeof(*argv),
+					      argv));
+	TEST_ASSERT_EQUAL_INT(20, results[VERBOSITY].d_int);
+	TEST_ASSERT_EQUAL_INT(7, results[INTTHING].d_int);
+	TEST_ASSERT_EQUAL_STRING("k", results[KEY].d_str);
+	/* count_letters is a custom action, left to the library */
+	TEST_ASSERT_EQUAL_UINT(3, results[ARG2].d_uint);
+	optparse_free_strings(&cfg_apply, results);
+
+	/* Together with a matcher and an index */
+	cfg_apply.matcher = partial_match;
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_compile(&cfg_apply, &index));
+	TEST_ASSERT_EQUAL_INT(2, optparse_cmd_compiled(&index, results,
+						       sizeof(argv)
+						       / sizeof(*argv),
+						       argv));
+	TEST_ASSERT_EQUAL_INT(20, results[VERBOSITY].d_int);
+	optparse_free_strings(&cfg_apply, results);
+
+	/* Errors are reported as usual */
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX,
+			      optparse_cmd_compiled(&index, results,
+						    sizeof(argv_bad)
+						    / sizeof(*argv_bad),
+						    argv_bad));
+	optparse_index_free(&index);
+}
+
+/**
+ * Check positional dispatch and collection with a compiled configuration.
+ */
+static void test_compiled_pos(void)
+{
+	struct opt_index index;
+	union opt_data results[sizeof(testpos)/ sizeof(*testpos)];
+	int parse_result;
+	static const char *argv[] = {"k", "-k", "-s", "l", "v", "w", "x"};
+
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_compile(&cfg_pos, &index));
+
+	parse_result = optparse_cmd_compiled(&index, results, 2, argv);
+	TEST_ASSERT_EQUAL_INT(1, parse_result);
+	TEST_ASSERT_EQUAL_INT(0, results[2].d_int);
+	TEST_ASSERT_EQUAL_INT(-1, results[3].d_int);
+
+	parse_result = optparse_cmd_compiled(&index, results,
+					     sizeof(argv) / sizeof(*argv), argv);
+	TEST_ASSERT_EQUAL_INT(5, parse_result);
+	TEST_ASSERT_EQUAL_UINT(10, results[0].d_uint);
+	TEST_ASSERT_EQUAL_INT(0, results[2].d_int);
+	TEST_ASSERT_EQUAL_INT(1, results[3].d_int);
+	TEST_ASSERT_EQUAL_INT(4, results[4].d_int);
+
+	optparse_index_free(&index);
+
+	/* Without OPTPARSE_COLLECT_LAST_POS extra arguments are an error. */
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK,
+			      optparse_compile(&cfg_trivia2, &index));
+	parse_result = optparse_cmd_compiled(&index, results, 1, argv + 3);
+	TEST_ASSERT_EQUAL_INT(1, parse_result);
+	parse_result = optparse_cmd_compiled(&index, results, 2, argv + 3);
 	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, parse_result);
+	optparse_index_free(&index);
+}
+
+/**
+ * Test copying strings into an arena.
+ */
+static void test_arena(void)
+{
+	union opt_data results[N_RULES];
+	char buf[8];
+	struct opt_arena arena = {.buf = buf, .size = sizeof(buf)};
+	struct opt_context ctx = {.arena = &arena};
+	int parse_result;
+	static const char *argv[] = {"test", "--key", "hello", "x1", "x22"};
+	static const char *argv_bad[] = {"test", "--key", "hello", "--bad"};
+
+	/* "free-me" (the default of --copyme) fits in the caller's buffer,
+	 * "hello" does not. */
+	parse_result = optparse_cmd_ctx(&cfg, &ctx, results,
+					sizeof(argv) / sizeof(*argv), argv);
+	TEST_ASSERT_EQUAL_INT(2, parse_result);
+	TEST_ASSERT_EQUAL_STRING("hello", results[KEY].d_str);
+	TEST_ASSERT_EQUAL_STRING("free-me", results[COPYME].d_str);
+	TEST_ASSERT_EQUAL_PTR(buf, results[COPYME].d_str);
+	TEST_ASSERT_NOT_NULL(arena.blocks);
+
+	optparse_arena_reset(&arena);
+	TEST_ASSERT_EQUAL_UINT(0, arena.used);
+
+	/* A failed parse gives the memory back. */
+	parse_result = optparse_cmd_ctx(&cfg, &ctx, results,
+					sizeof(argv_bad) / sizeof(*argv_bad),
+					argv_bad);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_BADSYNTAX, parse_result);
+	TEST_ASSERT_EQUAL_UINT(0, arena.used);
+	TEST_ASSERT_NULL(results[KEY].d_str);
+	TEST_ASSERT_NULL(results[COPYME].d_str);
+
+	optparse_arena_release(&arena);
+	TEST_ASSERT_EQUAL_PTR(NULL, arena.blocks);
+	TEST_ASSERT_EQUAL_UINT(0, arena.size);
+}
+
+struct alloc_counter {
+	int allocs;
+	int frees;
+	bool fail;
+};
+
+static void *counting_alloc(void *user, size_t size)
+{
+	struct alloc_counter *counter = user;
+
+	if (counter->fail) {
+		return NULL;
+	}
+
+	counter->allocs++;
+	return malloc(size);
+}
+
+static void counting_free(void *user, void *ptr)
+{
+	struct alloc_counter *counter = user;
+
+	if (ptr != NULL) {
+		counter->frees++;
+	}
+	free(ptr);
+}
+
+/**
+ * Test that all memory goes through the allocator hooks.
+ */
+static void test_allocator(void)
+{
+	struct alloc_counter conf_counter = {0}, call_counter = {0};
+	const struct opt_allocator conf_alloc = {.alloc = counting_alloc,
+						 .free = counting_free,
+						 .user = &conf_counter};
+	const struct opt_allocator call_alloc = {.alloc = counting_alloc,
+						 .free = counting_free,
+						 .user = &call_counter};
+	struct opt_conf cfg_alloc = cfg;
+	struct opt_context ctx = {NULL};
+	struct opt_arena arena = {NULL};
+	struct opt_index index;
+	union opt_data results[N_RULES];
+	int parse_result;
+	static const char *argv[] = {"test", "--key", "hello", "x1", "x22"};
+	static const char * const *batch_argv[] = {argv};
+	int argc = sizeof(argv) / sizeof(*argv), status;
+
+	cfg_alloc.allocator = &conf_alloc;
+
+	/* --copyme has a default and --key is given */
+	parse_result = optparse_cmd(&cfg_alloc, results, argc, argv);
+	TEST_ASSERT_EQUAL_INT(2, parse_result);
+	TEST_ASSERT_EQUAL_INT(2, conf_counter.allocs);
+	optparse_free_strings(&cfg_alloc, results);
+	TEST_ASSERT_EQUAL_INT(2, conf_counter.frees);
+
+	TEST_ASSERT_EQUAL_INT(OPTPARSE_OK, optparse_compile(&cfg_alloc, &index));
+
+	/* Batches tell running out of memory apart from bad lines. */
+	conf_counter.fail = true;
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_NOMEM,
+			      optparse_cmd_batch(&index, 1, &argc, batch_argv,
+						 results, &status, 1));
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_NOMEM, status);
+	conf_counter.fail = false;
+
+	optparse_index_free(&index);
+	TEST_ASSERT_EQUAL_INT(conf_counter.allocs, conf_counter.frees);
+
+	/* The context overrides the configuration. */
+	ctx.allocator = &call_alloc;
+	parse_result = optparse_cmd_ctx(&cfg_alloc, &ctx, results, argc, argv);
+	TEST_ASSERT_EQUAL_INT(2, parse_result);
+	TEST_ASSERT_EQUAL_INT(2, call_counter.allocs);
+	optparse_free_strings_ctx(&cfg_alloc, &ctx, results);
+	TEST_ASSERT_EQUAL_INT(2, call_counter.frees);
+
+	/* Arena blocks too, and only once. */
+	ctx.arena = &arena;
+	parse_result = optparse_cmd_ctx(&cfg_alloc, &ctx, results, argc, argv);
+	TEST_ASSERT_EQUAL_INT(2, parse_result);
+	TEST_ASSERT_EQUAL_INT(3, call_counter.allocs);
+	optparse_arena_release(&arena);
+	TEST_ASSERT_EQUAL_INT(3, call_counter.frees);
+
+	call_counter.fail = true;
+	ctx.arena = NULL;
+	parse_result = optparse_cmd_ctx(&cfg_alloc, &ctx, results, argc, argv);
+	TEST_ASSERT_EQUAL_INT(-OPTPARSE_NOMEM, parse_result);
+	TEST_ASSERT_EQUAL_INT(3, call_counter.allocs);
+	TEST_ASSERT_EQUAL_INT(conf_counter.allocs, conf_counter.frees);
 }
 
 int main(void) {
@@ -695,14 +2338,39 @@ int main(void) {
 	RUN_TEST(test_optparse_basic);
 	RUN_TEST(test_optparse_default);
 	RUN_TEST(test_optparse_help);
+	RUN_TEST(test_help_render);
 	RUN_TEST(test_optparse_int_err);
 	RUN_TEST(test_optparse_uint_err);
+	RUN_TEST(test_int64);
+	RUN_TEST(test_view);
+	RUN_TEST(test_conv_int);
+	RUN_TEST(test_conv_real);
+	RUN_TEST(test_conv_units);
 	RUN_TEST(test_optparse_float_err);
 	RUN_TEST(test_optparse_invalid_positional);
 	RUN_TEST(test_optparse_one_arg);
 	RUN_TEST(test_init_fail);
 	RUN_TEST(test_collect);
+	RUN_TEST(test_collect_array);
+	RUN_TEST(test_append);
+	RUN_TEST(test_feed);
+	RUN_TEST(test_tokenize);
+	RUN_TEST(test_response_files);
+	RUN_TEST(test_next);
+	RUN_TEST(test_error_context);
+	RUN_TEST(test_batch);
+	RUN_TEST(test_columns);
+	RUN_TEST(test_stats);
 	RUN_TEST(test_toomany);
 	RUN_TEST(test_pos);
+	RUN_TEST(test_compiled);
+	RUN_TEST(test_matcher);
+	RUN_TEST(test_apply);
+	RUN_TEST(test_compiled_pos);
+	RUN_TEST(test_arena);
+	RUN_TEST(test_allocator);
+#ifdef OPTPARSE_WIDE_POSITIONAL
+	RUN_TEST(test_wide_pos);
+#endif
 	return UNITY_END();
 }
@@ -0,0 +1,93 @@
+/**
+ * @file
+ * @author  Juan I Carrano <juan@carrano.com.ar.
+ *
+ * Generate the help text of a configuration at build time.
+ *
+ * The configuration must be defined in a header of its own. Build this file
+ * for the host with:
+ *
+ *     -DHELPGEN_INCLUDE='"rules.h"' -DHELPGEN_CONF=cfg -DHELPGEN_NAME=cfg_help
+ *
+ * and link it with the library (and with any custom actions referenced by
+ * the rules). When run, it prints a C header that defines the complete help,
+ * with the columns aligned exactly as optparse_help_render() writes them, as
+ * "static const char HELPGEN_NAME[]". Include that header before the
+ * configuration and set opt_conf::help_text with
+ * OPTPARSE_HELP_TEXT(HELPGEN_NAME). The firmware can then be built with
+ * OPTPARSE_NO_HELP_FORMAT.
+ */
+
+#define OPTPARSE_HELPGEN
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "optparse.h"
+#include HELPGEN_INCLUDE
+
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
+/**
+ * Print a piece of text as a string literal on a line of its own.
+ */
+static void put_line(const char *s, size_t len)
+{
+	const char *end = s + len;
+
+	putchar('\t');
+	putchar('"');
+	for (; s < end; s++) {
+		unsigned char c = (unsigned char)*s;
+
+		if (c == '\t') {
+			fputs("\\t", stdout);
+		} else if (c == '\n') {
+			fputs("\\n", stdout);
+		} else if (c == '"' || c == '\\'
+			   || (c == '?' && s + 1 < end && s[1] == '?')) {
+			/* Escaping the first '?' of "??" avoids trigraphs. */
+			putchar('\\');
+			putchar(c);
+		} else if (c < ' ' || c > '~') {
+			printf("\\%03o", c);
+		} else {
+			putchar(c);
+		}
+	}
+	fputs("\"\n", stdout);
+}
+
+int main(void)
+{
+	const struct opt_conf *config = &HELPGEN_CONF;
+	size_t len = optparse_help_render(config, NULL, 0);
+	char *text = malloc(len + 1);
+	const char *line, *nl;
+
+	if (text == NULL) {
+		return 1;
+	}
+	optparse_help_render(config, text, len + 1);
+
+	printf("/* Generated by helpgen from %s. Do not edit. */\n\n",
+	       HELPGEN_INCLUDE);
+	printf("static const char %s[] =\n", STR(HELPGEN_NAME));
+
+	/* One line of the help per line of the literal. */
+	line = text;
+	while ((nl = strchr(line, '\n')) != NULL) {
+		put_line(line, (size_t)(nl + 1 - line));
+		line = nl + 1;
+	}
+	if (*line != '\0' || line == text) {
+		put_line(line, strlen(line));
+	}
+	printf("\t;\n");
+
+	free(text);
+
+	return ferror(stdout) ? 1 : 0;
+}
@@ -0,0 +1,368 @@
+/**
+ * @file
+ * @author  Juan I Carrano <juan@carrano.com.ar.
+ *
+ * Generate a specialized option matcher for a configuration.
+ *
+ * Like helpgen.c, this is built for the host with:
+ *
+ *     -DMATCHGEN_INCLUDE='"rules.h"' -DMATCHGEN_CONF=cfg \
+ *     -DMATCHGEN_NAME=cfg_match
+ *
+ * When run, it prints a C header that defines "static int MATCHGEN_NAME(const
+ * char *long_id, char short_id)", which finds options with a switch on the
+ * short id, or with switches on the length and then on each character of
+ * the long id, instead of comparing strings. Set opt_conf::matcher to it
+ * with OPTPARSE_MATCHER(MATCHGEN_NAME).
+ *
+ * The header also defines MATCHGEN_NAME_apply(), with the code of the
+ * built-in action of each rule inlined in a switch on the rule, so that
+ * conversions and stores do not go through the generic action dispatch. Set
+ * opt_conf::apply to it with OPTPARSE_APPLY(MATCHGEN_NAME_apply). Actions
+ * that need the state of the parser (copies, arrays, custom actions and the
+ * help) are left to the library.
+ */
+
+#define OPTPARSE_MATCHGEN
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "optparse.h"
+#include MATCHGEN_INCLUDE
+
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
+/** A long id and its rule. */
+struct long_key {
+	const char *id;
+	size_t len;
+	int rule;
+};
+
+static int is_argument(const struct opt_rule *rule)
+{
+	return rule->action >= _OPTPARSE_POSITIONAL_START
+	       && rule->action < _OPTPARSE_POSITIONAL_END;
+}
+
+/**
+ * Order by length, then by contents, then by rule so that the first rule
+ * comes first among repeated ids.
+ */
+static int compare_keys(const void *a, const void *b)
+{
+	const struct long_key *ka = a, *kb = b;
+	int c;
+
+	if (ka->len != kb->len) {
+		return (ka->len < kb->len) ? -1 : 1;
+	}
+	if ((c = memcmp(ka->id, kb->id, ka->len)) != 0) {
+		return c;
+	}
+	return ka->rule - kb->rule;
+}
+
+static void indent(int level)
+{
+	while (level--) {
+		putchar('\t');
+	}
+}
+
+/**
+ * Print a character constant.
+ *
+ * Characters outside of ASCII are cast to char, so that they match whether
+ * char is signed or not.
+ */
+static void put_char(char c)
+{
+	unsigned char u = (unsigned char)c;
+
+	if (u > 127) {
+		printf("(char)0x%02x", u);
+	} else if (isalnum(u) || c == '-' || c == '_') {
+		printf("'%c'", c);
+	} else {
+		printf("%d", u);
+	}
+}
+
+/** Print a string literal with n characters of s. */
+static void put_string(const char *s, size_t n)
+{
+	putchar('"');
+	while (n--) {
+		unsigned char c = (unsigned char)*s++;
+
+		if (c == '"' || c == '\\' || c == '?') {
+			printf("\\%c", c);
+		} else if (c < ' ' || c > '~') {
+			printf("\\%03o", c);
+		} else {
+			putchar(c);
+		}
+	}
+	putchar('"');
+}
+
+/**
+ * Print the code that matches keys[0..n), which have the same length and
+ * the same first pos characters.
+ */
+static void put_trie(const struct long_key *keys, size_t n, size_t pos,
+		     int level)
+{
+	size_t i, j;
+
+	if (n == 1) {
+		const struct long_key *k = keys;
+
+		indent(level);
+		if (pos == k->len) {
+			printf("return %d;\n", k->rule);
+		} else {
+			printf((pos > 0) ? "return memcmp(long_id + %zu, "
+					 : "return memcmp(long_id, ", pos);
+			put_string(k->id + pos, k->len - pos);
+			printf(", %zu) ? -1 : %d;\n", k->len - pos, k->rule);
+		}
+		return;
+	}
+
+	indent(level);
+	printf("switch (long_id[%zu]) {\n", pos);
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && keys[j].id[pos] == keys[i].id[pos]; j++)
+			;
+		indent(level + 1);
+		printf("case ");
+		put_char(keys[i].id[pos]);
+		printf(":\n");
+		put_trie(keys + i, j - i, pos + 1, level + 2);
+	}
+	indent(level);
+	printf("}\n");
+	indent(level);
+	printf("return -1;\n");
+}
+
+static enum OPTPARSE_ACTIONS real_action(const struct opt_rule *rule)
+{
+	return is_argument(rule) ? rule->action_data.argument.pos_action
+				 : rule->action;
+}
+
+/**
+ * Code of an action that does not need the parser, or NULL.
+ *
+ * i_value and u_value are temporaries of type int64_t and uint64_t.
+ */
+static const char *action_code(enum OPTPARSE_ACTIONS action)
+{
+	switch (action) {
+		case OPTPARSE_IGNORE: case OPTPARSE_IGNORE_SWITCH:
+			return "return OPTPARSE_OK;";
+		case OPTPARSE_INT:
+			return "ret = optparse_conv_int(value, INT_MIN, INT_MAX, "
+			       "&i_value, msg);\n"
+			       "if (ret == OPTPARSE_OK) {\n"
+			       "\tdest->d_int = (int)i_value;\n"
+			       "}\n"
+			       "return ret;";
+		case OPTPARSE_UINT:
+			return "ret = optparse_conv_uint(value, UINT_MAX, "
+			       "&u_value, msg);\n"
+			       "if (ret == OPTPARSE_OK) {\n"
+			       "\tdest->d_uint = (unsigned int)u_value;\n"
+			       "}\n"
+			       "return ret;";
+		case OPTPARSE_INT64:
+			return "return optparse_conv_int(value, INT64_MIN, "
+			       "INT64_MAX, &dest->d_int64, msg);";
+		case OPTPARSE_UINT64:
+			return "return optparse_conv_uint(value, UINT64_MAX, "
+			       "&dest->d_uint64, msg);";
+		case OPTPARSE_SIZE:
+			return "return optparse_conv_size(value, "
+			       "&dest->d_uint64, msg);";
+		case OPTPARSE_DURATION:
+			return "return optparse_conv_duration(value, "
+			       "&dest->d_int64, msg);";
+		case OPTPARSE_FLOAT:
+			return "return optparse_conv_float(value, "
+			       "&dest->d_float, msg);";
+		case OPTPARSE_DOUBLE:
+			return "return optparse_conv_double(value, "
+			       "&dest->d_double, msg);";
+		case OPTPARSE_STR_NOCOPY:
+			return "dest->d_cstr = value;\n"
+			       "return OPTPARSE_OK;";
+		case OPTPARSE_VIEW:
+			return "dest->d_view.ptr = value;\n"
+			       "dest->d_view.len = strlen(value);\n"
+			       "return OPTPARSE_OK;";
+		case OPTPARSE_SET_BOOL:
+			return "dest->d_bool = true;\n"
+			       "return OPTPARSE_OK;";
+		case OPTPARSE_UNSET_BOOL:
+			return "dest->d_bool = false;\n"
+			       "return OPTPARSE_OK;";
+		case OPTPARSE_COUNT:
+			return "dest->d_int++;\n"
+			       "return OPTPARSE_OK;";
+		default:
+			return NULL;
+	}
+}
+
+/** Print code, indenting each of its lines. */
+static void put_code(const char *code, int level)
+{
+	while (*code != '\0') {
+		const char *nl = strchr(code, '\n');
+		size_t len = (nl != NULL) ? (size_t)(nl - code) : strlen(code);
+
+		indent(level);
+		printf("%.*s\n", (int)len, code);
+		code += len + (nl != NULL);
+	}
+}
+
+/**
+ * Print the function that runs the actions of the rules, grouping the rules
+ * that have the same action.
+ */
+static void put_apply(const struct opt_conf *config)
+{
+	bool done[_OPTPARSE_POSITIONAL_START] = {false};
+	bool uses_ret = false, uses_i = false, uses_u = false;
+	int r, r2;
+
+	for (r = 0; r < config->n_rules; r++) {
+		enum OPTPARSE_ACTIONS action = real_action(config->rules + r);
+
+		uses_ret |= action == OPTPARSE_INT || action == OPTPARSE_UINT;
+		uses_i |= action == OPTPARSE_INT;
+		uses_u |= action == OPTPARSE_UINT;
+	}
+
+	printf("static int %s_apply(int rule, const char *value,\n"
+	       "\t\tunion opt_data *dest, const char **msg)\n{\n",
+	       STR(MATCHGEN_NAME));
+	if (uses_ret) {
+		printf("\tint ret;\n");
+	}
+	if (uses_i) {
+		printf("\tint64_t i_value;\n");
+	}
+	if (uses_u) {
+		printf("\tuint64_t u_value;\n");
+	}
+	if (uses_ret) {
+		printf("\n");
+	}
+	printf("\t(void)value;\n\t(void)dest;\n\t(void)msg;\n\n");
+
+	printf("\tswitch (rule) {\n");
+	for (r = 0; r < config->n_rules; r++) {
+		enum OPTPARSE_ACTIONS action = real_action(config->rules + r);
+		const char *code = action_code(action);
+
+		if (code == NULL || done[action]) {
+			continue;
+		}
+		done[action] = true;
+
+		printf("\t\tcase %d:", r);
+		for (r2 = r + 1; r2 < config->n_rules; r2++) {
+			if (real_action(config->rules + r2) == action) {
+				printf(" case %d:", r2);
+			}
+		}
+		printf("\n");
+		put_code(code, 3);
+	}
+	printf("\t}\n\n\treturn OPTPARSE_DEFAULT_ACTION;\n}\n");
+}
+
+int main(void)
+{
+	const struct opt_conf *config = &MATCHGEN_CONF;
+	struct long_key *keys;
+	unsigned char seen[256] = {0};
+	size_t n_keys = 0, i, j, k;
+	int r;
+
+	keys = malloc(sizeof(*keys) * (size_t)(config->n_rules + 1));
+	if (keys == NULL) {
+		return 1;
+	}
+
+	printf("/* Generated by matchgen from %s. Do not edit. */\n\n",
+	       MATCHGEN_INCLUDE);
+	printf("#include <limits.h>\n#include <stdbool.h>\n"
+	       "#include <stdint.h>\n#include <string.h>\n\n"
+	       "#include \"optparse.h\"\n\n");
+	printf("static int %s(const char *long_id, char short_id)\n{\n",
+	       STR(MATCHGEN_NAME));
+
+	/* Short ids. The first rule wins, as in the generic lookup. */
+	printf("\tif (long_id == NULL) {\n\t\tswitch (short_id) {\n");
+	for (r = 0; r < config->n_rules; r++) {
+		const struct opt_rule *rule = config->rules + r;
+		unsigned char c = (unsigned char)rule->action_data.option.short_id;
+
+		if (is_argument(rule) || c == 0 || seen[c]) {
+			continue;
+		}
+		seen[c] = 1;
+		printf("\t\t\tcase ");
+		put_char((char)c);
+		printf(": return %d;\n", r);
+	}
+	printf("\t\t}\n\t\treturn -1;\n\t}\n\n");
+
+	for (r = 0; r < config->n_rules; r++) {
+		const struct opt_rule *rule = config->rules + r;
+
+		if (!is_argument(rule) && rule->action_data.option.long_id != NULL) {
+			keys[n_keys].id = rule->action_data.option.long_id;
+			keys[n_keys].len = strlen(keys[n_keys].id);
+			keys[n_keys].rule = r;
+			n_keys++;
+		}
+	}
+	qsort(keys, n_keys, sizeof(*keys), compare_keys);
+
+	/* Drop repeated ids, keeping the first rule. */
+	for (i = 0, k = 0; i < n_keys; i++) {
+		if (k == 0 || keys[k - 1].len != keys[i].len
+		    || memcmp(keys[k - 1].id, keys[i].id, keys[i].len) != 0) {
+			keys[k++] = keys[i];
+		}
+	}
+	n_keys = k;
+
+	/* Long ids, by length and then character by character. */
+	printf("\tswitch (strlen(long_id)) {\n");
+	for (i = 0; i < n_keys; i = j) {
+		for (j = i + 1; j < n_keys && keys[j].len == keys[i].len; j++)
+			;
+		printf("\t\tcase %zu:\n", keys[i].len);
+		put_trie(keys + i, j - i, 0, 3);
+	}
+	printf("\t}\n\n\treturn -1;\n}\n\n");
+
+	put_apply(config);
+
+	free(keys);
+
+	return ferror(stdout) ? 1 : 0;
+}